@@ -0,0 +1,547 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "base/aux_math.h"
+#include "control/leg_ik.h"
+#include "control/madgwick_batch.h"
+#include "control/madgwick_filter.h"
+#include "bench.h"
+#include "suites.h"
+
+
+/*
+ * Approximations are compared with libm in double precision on dense grids.
+ * Bounds are the documented ones from aux_math.h.
+ */
+#define N 4096
+
+static float xs[N], ys[N], outs[N];
+static int32_t ps[N];
+static float quats[N][4];
+static float yaws[N], pitches[N], rolls[N];
+
+
+static double rel_error(double value, double ref) {
+  return fabs(value - ref) / fabs(ref);
+}
+
+
+// Angles which differ by 2π are equal.
+static double angle_error(double value, double ref) {
+  double error = fabs(value - ref);
+  return error > M_PI ? 2*M_PI - error : error;
+}
+
+
+static double ref_press_to_alt(int32_t p) {
+  return 44330 * (1 - pow(p/101325.0, 0.19029496));
+}
+
+
+/*
+ * `updateIK()` of misc/demo_ik/demo_ik.js as is. The margin is the distance
+ * of the target from borders of states: states of points near borders depend
+ * on rounding.
+ */
+static int ref_update_ik(double l1, double l2, double beta, double x,
+                         double y, double* a0, double* a1, double* margin) {
+  double l1l1 = l1*l1, l2l2 = l2*l2,
+         l1ml2l1ml2 = (l2-l1)*(l2-l1), l1pl2l1pl2 = (l2+l1)*(l2+l1),
+         phi = M_PI_2 - beta, sx = sin(beta)*l1, sy = cos(beta)*l1,
+         a = 2 * sx, b = 2 * sy, c = l2l2 - sx*sx - sy*sy;
+
+  double rr = x*x + y*y;
+  int state;
+
+  *margin = fabs(x*sy + sx*y) / l1;
+
+  if (x*sy >= -sx*y) {
+    *margin = fmin(*margin, fabs(sqrt(rr) - (l1+l2)));
+    *margin = fmin(*margin, fabs(x*(x+a) + y*(y-b) - c) / (l1+l2));
+
+    if (rr <= l1pl2l1pl2)
+      state = x*(x+a) + y*(y-b) >= c ? LEG_IK_NORMAL : LEG_IK_CLOSE;
+    else
+      state = LEG_IK_DISTANT;
+  } else {
+    *margin = fmin(*margin, fabs(sqrt(rr) - fabs(l2-l1)));
+    *margin = fmin(*margin, fabs(x*(x-a) + y*(y+b) - c) / (l1+l2));
+    *margin = fmin(*margin, fabs(y));
+
+    if (rr >= l1ml2l1ml2)
+      if (x*(x-a) + y*(y+b) <= c)
+        state = LEG_IK_NORMAL;
+      else
+        state = y > 0 ? LEG_IK_DISTANT : LEG_IK_DROWNED;
+    else
+      state = LEG_IK_BENDED;
+  }
+
+  switch (state) {
+    case LEG_IK_NORMAL: {
+      double r = sqrt(rr);
+      *a0 = acos((l1l1 + rr - l2l2)/(2 * l1 * r)) + atan2(x, -y) - beta;
+      *a1 = acos((l1l1 + l2l2 - rr)/(2 * l1 * l2));
+      if (*a0 < 0) *a0 += 2*M_PI;
+      break;
+    }
+
+    case LEG_IK_DROWNED:
+      *a0 = 0;
+      *a1 = atan2(-y-sy, -x+sx) + phi;
+      break;
+
+    case LEG_IK_BENDED:
+      *a0 = fmod(atan2(y, x) + phi + M_PI, M_PI);
+      *a1 = 0;
+      break;
+
+    case LEG_IK_CLOSE:
+      *a0 = M_PI;
+      *a1 = atan2(y-sy, x+sx) + phi;
+      break;
+
+    case LEG_IK_DISTANT:
+    default:
+      *a0 = atan2(y, x) + phi;
+      if (*a0 > M_PI) *a0 = M_PI;
+      *a1 = M_PI;
+      break;
+  }
+
+  return state;
+}
+
+
+static void check_rsqrt(void) {
+  double inv = 0, fast = 0, batch = 0;
+
+  // Geometric grid from 1e-6 to 1e6.
+  for (int k = 0; k < 256; ++k) {
+    for (int i = 0; i < N; ++i)
+      xs[i] = 1e-6f * pow(1e12, (k*N + i) / (256.0*N));
+
+    fast_rsqrt_n(xs, outs, N);
+
+    for (int i = 0; i < N; ++i) {
+      double ref = 1/sqrt((double)xs[i]);
+      inv = fmax(inv, rel_error(inv_sqrt(xs[i]), ref));
+      fast = fmax(fast, rel_error(fast_rsqrt(xs[i]), ref));
+      batch = fmax(batch, rel_error(outs[i], ref));
+    }
+  }
+
+  bench_check("inv_sqrt", inv, 1.8e-3);
+  bench_check("fast_rsqrt", fast, 5e-6);
+  bench_check("fast_rsqrt_n", batch, 5e-6);
+}
+
+
+static void check_atan2(void) {
+  double fast = 0, batch = 0;
+
+  // The square [-1, 1]², including axes and the diagonals.
+  for (int k = 0; k <= 1024; ++k) {
+    for (int i = 0; i <= 1024; ++i) {
+      ys[i] = (k - 512) / 512.f;
+      xs[i] = (i - 512) / 512.f;
+    }
+
+    fast_atan2_n(ys, xs, outs, 1025);
+
+    for (int i = 0; i <= 1024; ++i) {
+      if (xs[i] == 0 && ys[i] == 0) continue;
+
+      double ref = atan2((double)ys[i], (double)xs[i]);
+      fast = fmax(fast, angle_error(fast_atan2(ys[i], xs[i]), ref));
+      batch = fmax(batch, angle_error(outs[i], ref));
+    }
+  }
+
+  bench_check("fast_atan2", fast, 4e-6);
+  bench_check("fast_atan2_n", batch, 4e-6);
+}
+
+
+static void check_asin(void) {
+  double fast = 0, batch = 0;
+
+  for (int k = 0; k < 512; ++k) {
+    for (int i = 0; i < N; ++i)
+      xs[i] = -1 + (k*N + i) / (256.f*N);
+
+    fast_asin_n(xs, outs, N);
+
+    for (int i = 0; i < N; ++i) {
+      double ref = asin((double)xs[i]);
+      fast = fmax(fast, fabs(fast_asin(xs[i]) - ref));
+      batch = fmax(batch, fabs(outs[i] - ref));
+    }
+  }
+
+  bench_check("fast_asin", fast, 2e-6);
+  bench_check("fast_asin_n", batch, 2e-6);
+}
+
+
+static void check_log2_exp2(void) {
+  double lg = 0, ex = 0;
+
+  // Every mantissa of [0.5, 2) and some exponents.
+  for (int32_t m = 0; m < 1 << 24; m += 7) {
+    float x = ldexp(1.f + m / 16777216.f, -1 + m % 5 * 16 - 32);
+    double ref = log2((double)x);
+    lg = fmax(lg, fabs(fast_log2(x) - ref) / fmax(1, fabs(ref)));
+  }
+
+  for (int i = -125 * (1 << 14); i <= 125 * (1 << 14); i += 3) {
+    float x = i / 16384.f;
+    ex = fmax(ex, rel_error(fast_exp2(x), exp2((double)x)));
+  }
+
+  bench_check("fast_log2", lg, 4e-7);
+  bench_check("fast_exp2", ex, 2.5e-7);
+}
+
+
+static void check_press_to_alt(void) {
+  double fast = 0, batch = 0;
+
+  // Every pascal from 30 kPa to 110 kPa.
+  for (int32_t p = 30000; p < 110000; p += N) {
+    for (int i = 0; i < N; ++i)
+      ps[i] = p + i;
+
+    press_to_alt_n(ps, outs, N);
+
+    for (int i = 0; i < N; ++i) {
+      double ref = ref_press_to_alt(ps[i]);
+      fast = fmax(fast, fabs(press_to_alt(ps[i]) - ref));
+      batch = fmax(batch, fabs(outs[i] - ref));
+    }
+  }
+
+  bench_check("press_to_alt", fast, 0.01);
+  bench_check("press_to_alt_n", batch, 0.01);
+}
+
+
+static void check_quat_to_euler(void) {
+  double fast = 0, batch = 0;
+
+  for (int k = 0; k < 64; ++k) {
+    for (int i = 0; i < N; ++i) {
+      float* q = quats[i];
+      for (int j = 0; j < 4; ++j)
+        q[j] = bench_uniform(-1, 1);
+
+      float norm = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+      for (int j = 0; j < 4; ++j)
+        q[j] /= norm;
+    }
+
+    quat_to_euler_n(quats, yaws, pitches, rolls, N);
+
+    for (int i = 0; i < N; ++i) {
+      const float* q = quats[i];
+      float yaw, pitch, roll;
+      quat_to_euler(q, &yaw, &pitch, &roll);
+
+      // Arguments are rounded as in aux_math, otherwise rounding near the
+      // gimbal lock dominates the error of the approximation itself.
+      float yx = 2*q[0]*q[0] + 2*q[1]*q[1]-1, yy = 2*q[1]*q[2]-2*q[0]*q[3];
+      float rx = 2*q[0]*q[0] + 2*q[3]*q[3]-1, ry = 2*q[2]*q[3]-2*q[0]*q[1];
+      float px = 2*q[1]*q[3] + 2*q[0]*q[2];
+
+      double ref[3] = {
+        atan2((double)yy, (double)yx), -asin(fmin(fmax(px, -1.), 1.)),
+        atan2((double)ry, (double)rx)
+      };
+
+      fast = fmax(fast, angle_error(yaw, ref[0]));
+      fast = fmax(fast, angle_error(pitch, ref[1]));
+      fast = fmax(fast, angle_error(roll, ref[2]));
+      batch = fmax(batch, angle_error(yaws[i], ref[0]));
+      batch = fmax(batch, angle_error(pitches[i], ref[1]));
+      batch = fmax(batch, angle_error(rolls[i], ref[2]));
+    }
+  }
+
+  bench_check("quat_to_euler", fast, 1e-5);
+  bench_check("quat_to_euler_n", batch, 1e-5);
+}
+
+
+/*
+ * Planar legs (without the coxa) are compared with the demo over the half
+ * plane in front of the femur joint, where the coxa doesn't turn the leg.
+ * Reached targets of 3-DOF legs are checked by the forward kinematics.
+ */
+static void check_leg_ik(void) {
+  static const double betas[] = {0, 15, -30, 60};
+  double angles = 0, reach = 0;
+  int mismatches = 0;
+
+  for (int k = 0; k < 4; ++k) {
+    double beta = betas[k] * M_PI/180;
+    leg_ik_leg_t leg = {.femur = 4.5, .tibia = 8.5, .beta = beta};
+    leg_ik_t ik;
+    leg_ik_start(&ik, &leg, 1);
+
+    for (int i = 0; i <= 256; ++i) {
+      for (int j = 0; j <= 512; ++j) {
+        float x = i * 15 / 256.f, z = (j - 256) * 15 / 256.f;
+        float zero = 0, joints[3];
+        float* out[3] = {&joints[0], &joints[1], &joints[2]};
+        const float* foot[3] = {&x, &zero, &z};
+        int state;
+
+        leg_ik_solve(&ik, foot, out, &state);
+
+        double a0, a1, margin;
+        int ref = ref_update_ik(4.5, 8.5, beta, x, z, &a0, &a1, &margin);
+        if (margin < 1e-3) continue;
+
+        if (state != ref) {
+          ++mismatches;
+          continue;
+        }
+
+        angles = fmax(angles, angle_error(joints[1], a0));
+        angles = fmax(angles, angle_error(joints[2], a1));
+      }
+    }
+  }
+
+  // Legs of the hexapod around the body, targets are under the legs.
+  leg_ik_leg_t legs[6];
+  for (int i = 0; i < 6; ++i) {
+    double yaw = (i * 60 + 30) * M_PI/180;
+    legs[i] = (leg_ik_leg_t){
+      .x = 6*cos(yaw), .y = 6*sin(yaw), .z = 0, .yaw = yaw,
+      .coxa = 2.5, .femur = 4.5, .tibia = 8.5, .beta = 15 * M_PI/180
+    };
+  }
+
+  leg_ik_t ik;
+  leg_ik_start(&ik, legs, 6);
+
+  for (int k = 0; k < 4096; ++k) {
+    float foot[3][6], joints[3][6];
+    const float* in[3] = {foot[0], foot[1], foot[2]};
+    float* out[3] = {joints[0], joints[1], joints[2]};
+    int states[6];
+
+    for (int i = 0; i < 6; ++i) {
+      double dist = bench_uniform(4, 12), turn = bench_uniform(-0.6, 0.6);
+      foot[0][i] = legs[i].x + dist*cos(legs[i].yaw + turn);
+      foot[1][i] = legs[i].y + dist*sin(legs[i].yaw + turn);
+      foot[2][i] = bench_uniform(-9, -3);
+    }
+
+    leg_ik_solve(&ik, in, out, states);
+
+    for (int i = 0; i < 6; ++i) {
+      if (states[i] != LEG_IK_NORMAL) continue;
+
+      // Joints are turned by the coxa, then by the femur and the tibia.
+      double femur = joints[1][i] + legs[i].beta;
+      double knee = femur + joints[2][i];
+      double h = legs[i].coxa + 4.5*sin(femur) - 8.5*sin(knee);
+      double v = -4.5*cos(femur) + 8.5*cos(knee);
+      double dir = legs[i].yaw + joints[0][i];
+
+      double dx = legs[i].x + h*cos(dir) - foot[0][i];
+      double dy = legs[i].y + h*sin(dir) - foot[1][i];
+      double dz = legs[i].z + v - foot[2][i];
+      reach = fmax(reach, sqrt(dx*dx + dy*dy + dz*dz));
+    }
+  }
+
+  bench_check("leg_ik_states", mismatches, 0);
+  bench_check("leg_ik_demo", angles, 1e-4);
+  bench_check("leg_ik_reach", reach, 1e-3);
+}
+
+
+/*
+ * Batched filters are compared with scalar ones over random steps, zero
+ * samples included. Every step starts from the same state, rounding of steps
+ * only accumulates over the whole recording. Runs over the recording must not
+ * depend on threads.
+ */
+#define FILTERS 37
+#define STEPS 3000
+
+static madgwick_batch_sample_t steps[STEPS];
+
+
+static void random_sample(madgwick_batch_sample_t* s) {
+  for (int k = 0; k < 3; ++k) {
+    s->g[k] = bench_uniform(-2, 2);
+    s->a[k] = bench_uniform(-1, 1);
+    s->m[k] = bench_uniform(-0.5, 0.5);
+  }
+
+  s->a[2] += 1;
+  s->dt = bench_uniform(0.002, 0.02);
+
+  if (bench_uniform(0, 1) < 0.15) s->a[0] = s->a[1] = s->a[2] = 0;
+  if (bench_uniform(0, 1) < 0.15) s->m[0] = s->m[1] = s->m[2] = 0;
+}
+
+
+static double attitude_error(const madgwick_batch_t* batch,
+                             madgwick_filter_t* const* filters) {
+  double error = 0;
+
+  for (int i = 0; i < FILTERS; ++i) {
+    float q[4];
+    madgwick_batch_attitude(batch, i, q);
+
+    for (int k = 0; k < 4; ++k)
+      error = fmax(error, fabs(q[k] - filters[i]->attitude[k]));
+  }
+
+  return error;
+}
+
+
+static void sync_filters(const madgwick_batch_t* batch,
+                         madgwick_filter_t* const* filters) {
+  for (int i = 0; i < FILTERS; ++i) {
+    madgwick_batch_attitude(batch, i, filters[i]->attitude);
+    filters[i]->lag = batch->lag[i];
+  }
+}
+
+
+static void scalar_step(madgwick_filter_t* f, const float* g, const float* a,
+                        const float* m, float dt) {
+  if (!a) madgwick_filter_propagate(f, g[0], g[1], g[2], dt);
+  else if (!m) madgwick_filter_update_imu(f, g[0], g[1], g[2],
+                                          a[0], a[1], a[2], dt);
+  else madgwick_filter_update(f, g[0], g[1], g[2], a[0], a[1], a[2],
+                              m[0], m[1], m[2], dt);
+}
+
+
+static void check_madgwick_batch(void) {
+  float beta[FILTERS];
+  for (int i = 0; i < FILTERS; ++i)
+    beta[i] = bench_uniform(0.01, 0.5);
+
+  madgwick_filter_t* filters[FILTERS];
+  madgwick_batch_t* batch = madgwick_batch_start(FILTERS, beta);
+  for (int i = 0; i < FILTERS; ++i)
+    filters[i] = madgwick_filter_start(beta[i]);
+
+  // Own measurements of every filter, all filters propagate or go without
+  // the magnetometer sometimes.
+  double own = 0;
+  for (int n = 0; n < STEPS; ++n) {
+    static float g[3][FILTERS], a[3][FILTERS], m[3][FILTERS];
+    float dt = bench_uniform(0.002, 0.02);
+
+    for (int i = 0; i < FILTERS; ++i) {
+      madgwick_batch_sample_t s;
+      random_sample(&s);
+
+      for (int k = 0; k < 3; ++k) {
+        g[k][i] = s.g[k];
+        a[k][i] = s.a[k];
+        m[k][i] = s.m[k];
+      }
+    }
+
+    const float* gs[3] = {g[0], g[1], g[2]};
+    const float* as[3] = {a[0], a[1], a[2]};
+    const float* ms[3] = {m[0], m[1], m[2]};
+    float mode = bench_uniform(0, 1);
+    bool propagate = mode < 0.1, imu_only = mode > 0.9;
+
+    sync_filters(batch, filters);
+    madgwick_batch_update(batch, gs, propagate ? NULL : as,
+                          imu_only ? NULL : ms, dt);
+
+    for (int i = 0; i < FILTERS; ++i) {
+      float gi[3] = {g[0][i], g[1][i], g[2][i]};
+      float ai[3] = {a[0][i], a[1][i], a[2][i]};
+      float mi[3] = {m[0][i], m[1][i], m[2][i]};
+      scalar_step(filters[i], gi, propagate ? NULL : ai,
+                  imu_only ? NULL : mi, dt);
+    }
+
+    own = fmax(own, attitude_error(batch, filters));
+  }
+
+  // The same sample for all filters.
+  double shared = 0;
+  for (int n = 0; n < STEPS; ++n) {
+    madgwick_batch_sample_t s;
+    random_sample(&s);
+
+    sync_filters(batch, filters);
+    madgwick_batch_update_shared(batch, s.g, s.a, s.m, s.dt);
+    for (int i = 0; i < FILTERS; ++i)
+      scalar_step(filters[i], s.g, s.a, s.m, s.dt);
+
+    shared = fmax(shared, attitude_error(batch, filters));
+  }
+
+  madgwick_batch_stop(batch);
+
+  // The recording by different numbers of threads.
+  for (int n = 0; n < STEPS; ++n)
+    random_sample(&steps[n]);
+
+  for (int i = 0; i < FILTERS; ++i) {
+    madgwick_filter_stop(filters[i]);
+    filters[i] = madgwick_filter_start(beta[i]);
+
+    for (int n = 0; n < STEPS; ++n)
+      scalar_step(filters[i], steps[n].g, steps[n].a, steps[n].m, steps[n].dt);
+  }
+
+  static const int threads[] = {1, 2, 3, 8};
+  float first[FILTERS][4];
+  double run = 0, divergence = 0;
+
+  for (int t = 0; t < 4; ++t) {
+    batch = madgwick_batch_start(FILTERS, beta);
+    madgwick_batch_run(batch, steps, STEPS, threads[t]);
+    run = fmax(run, attitude_error(batch, filters));
+
+    for (int i = 0; i < FILTERS; ++i) {
+      float q[4];
+      madgwick_batch_attitude(batch, i, q);
+
+      for (int k = 0; k < 4; ++k) {
+        if (t == 0) first[i][k] = q[k];
+        divergence = fmax(divergence, fabs(q[k] - first[i][k]));
+      }
+    }
+
+    madgwick_batch_stop(batch);
+  }
+
+  for (int i = 0; i < FILTERS; ++i)
+    madgwick_filter_stop(filters[i]);
+
+  bench_check("madgwick_batch_update", own, 4e-7);
+  bench_check("madgwick_batch_update_shared", shared, 4e-7);
+  bench_check("madgwick_batch_run", run, 1e-5);
+  bench_check("madgwick_batch_threads", divergence, 0);
+}
+
+
+void bench_accuracy(void) {
+  check_rsqrt();
+  check_atan2();
+  check_asin();
+  check_log2_exp2();
+  check_press_to_alt();
+  check_quat_to_euler();
+  check_leg_ik();
+  check_madgwick_batch();
+}
@@ -0,0 +1,209 @@
+#include "bench.h"
+
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define REPEATS 5
+
+static const uint64_t CALIBRATION_NS = 10000000;
+static const uint64_t TARGET_NS = 100000000;
+
+
+typedef struct {
+  uint64_t iters;
+  uint64_t ns;
+  uint64_t cycles;
+  uint64_t instructions;
+} sample_t;
+
+
+static FILE* out;
+static const char* filter;
+static const char* section;  // The current array of the report.
+static bool first;
+static int failures;
+static int leader = -1;  // Cycles, the group leader.
+static int follower = -1;  // Instructions.
+static uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+
+static int open_counter(uint64_t config, int group) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.disabled = group < 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+
+static uint64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static sample_t measure(bench_fn fn, void* ctx, uint64_t iters) {
+  sample_t sample = {iters, 0, 0, 0};
+
+  if (leader >= 0) {
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+
+  uint64_t start = now();
+  fn(ctx, iters);
+  sample.ns = now() - start;
+
+  if (leader >= 0) {
+    ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    // The group layout: the number of counters and their values.
+    uint64_t values[3];
+    if (read(leader, values, sizeof(values)) == sizeof(values)) {
+      sample.cycles = values[1];
+      sample.instructions = values[2];
+    }
+  }
+
+  return sample;
+}
+
+
+static void enter(const char* name) {
+  if (section == name) return;
+
+  fprintf(out, "%s,\n  \"%s\": [", section ? "\n  ]" : "", name);
+  section = name;
+  first = true;
+}
+
+
+static int by_ns(const void* a, const void* b) {
+  const sample_t* x = a;
+  const sample_t* y = b;
+  return (x->ns > y->ns) - (x->ns < y->ns);
+}
+
+
+void bench_start(const char* name_filter) {
+  // Logging writes to stdout too, so the report takes the original stdout
+  // and everything else goes to stderr.
+  fflush(stdout);
+  out = fdopen(dup(STDOUT_FILENO), "w");
+  dup2(STDERR_FILENO, STDOUT_FILENO);
+
+  filter = name_filter;
+  section = NULL;
+  failures = 0;
+
+  leader = open_counter(PERF_COUNT_HW_CPU_CYCLES, -1);
+  if (leader >= 0)
+    follower = open_counter(PERF_COUNT_HW_INSTRUCTIONS, leader);
+
+  if (leader >= 0 && follower < 0) {
+    close(leader);
+    leader = -1;
+  }
+
+  if (leader < 0)
+    fprintf(stderr, "Hardware counters are unavailable, "
+                    "check /proc/sys/kernel/perf_event_paranoid.\n");
+
+  fprintf(out, "{\n  \"counters\": %s", leader >= 0 ? "true" : "false");
+}
+
+
+void bench_run(const char* name, bench_fn fn, void* ctx) {
+  if (filter && !strstr(name, filter)) return;
+  enter("benchmarks");
+
+  // Find the number of iterations to run for about `TARGET_NS`.
+  uint64_t iters = 1;
+  sample_t sample = measure(fn, ctx, iters);
+
+  while (sample.ns < CALIBRATION_NS) {
+    iters *= sample.ns > 0 ? CALIBRATION_NS/sample.ns + 1 : 16;
+    sample = measure(fn, ctx, iters);
+  }
+
+  iters = TARGET_NS * sample.iters / sample.ns + 1;
+
+  sample_t samples[REPEATS];
+  for (int i = 0; i < REPEATS; ++i)
+    samples[i] = measure(fn, ctx, iters);
+
+  qsort(samples, REPEATS, sizeof(sample_t), by_ns);
+  const sample_t* median = &samples[REPEATS/2];
+
+  fprintf(out, "%s\n    {\"name\": \"%s\", \"iterations\": %llu, "
+         "\"ns_per_op\": %.3f, \"ns_per_op_min\": %.3f, ",
+         first ? "" : ",", name, (unsigned long long)iters,
+         (double)median->ns/iters, (double)samples[0].ns/iters);
+
+  if (leader >= 0)
+    fprintf(out, "\"cycles_per_op\": %.3f, \"instructions_per_op\": %.3f}",
+           (double)median->cycles/iters, (double)median->instructions/iters);
+  else
+    fprintf(out, "\"cycles_per_op\": null, \"instructions_per_op\": null}");
+
+  fflush(out);
+  first = false;
+}
+
+
+void bench_check(const char* name, double error, double bound) {
+  if (filter && !strstr(name, filter)) return;
+  enter("accuracy");
+
+  bool ok = error <= bound;
+  failures += !ok;
+
+  fprintf(out, "%s\n    {\"name\": \"%s\", \"max_error\": %.3g, "
+         "\"bound\": %.3g, \"ok\": %s}", first ? "" : ",", name, error, bound,
+         ok ? "true" : "false");
+
+  if (!ok)
+    fprintf(stderr, "%s: the error %.3g exceeds %.3g.\n", name, error, bound);
+
+  fflush(out);
+  first = false;
+}
+
+
+bool bench_finish(void) {
+  fprintf(out, "%s\n}\n", section ? "\n  ]" : "");
+  fclose(out);
+
+  if (follower >= 0) close(follower);
+  if (leader >= 0) close(leader);
+  leader = follower = -1;
+
+  return failures == 0;
+}
+
+
+float bench_uniform(float lo, float hi) {
+  // xorshift64*
+  seed ^= seed >> 12;
+  seed ^= seed << 25;
+  seed ^= seed >> 27;
+  uint64_t bits = (seed * 0x2545f4914f6cdd1dull) >> 40;
+
+  return lo + (hi - lo) * (bits / 16777216.f);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*!
+ * Run `iters` iterations of the measured operation.
+ * @param ctx    the context passed to `bench_run()`
+ * @param iters  number of operations to perform
+ */
+typedef void (*bench_fn)(void* ctx, uint64_t iters);
+
+
+/*!
+ * Start the report: open hardware counters and print the JSON header.
+ * @param filter  run only benchmarks containing this substring, or NULL
+ */
+extern void bench_start(const char* filter);
+
+/*!
+ * Measure the operation and print the JSON record with ns, cycles and
+ * instructions per operation. The number of iterations is calibrated to run
+ * about 100 ms, the median of 5 runs is reported.
+ */
+extern void bench_run(const char* name, bench_fn fn, void* ctx);
+
+/*!
+ * Print the JSON record of the maximal error of the approximation measured
+ * against the reference. The run fails if the error exceeds the bound.
+ */
+extern void bench_check(const char* name, double error, double bound);
+
+/*! Finish the report, fail if some of checks failed. */
+extern bool bench_finish(void);
+
+/*! Pseudo-random number in [lo, hi), the sequence is the same for every run. */
+extern float bench_uniform(float lo, float hi);
+
+
+/*! Make the compiler believe that the memory is used. */
+#define bench_escape(ptr) __asm__ volatile("" : : "g"(ptr) : "memory")
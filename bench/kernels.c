@@ -0,0 +1,348 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <tgmath.h>
+
+#include "base/aux_math.h"
+#include "bench.h"
+#include "control/attitude_filter.h"
+#include "control/leg_ik.h"
+#include "control/madgwick_batch.h"
+#include "control/madgwick_filter.h"
+#include "control/mahony_filter.h"
+#include "control/prefilter.h"
+#include "devices/bmp085.h"
+#include "suites.h"
+
+
+// Inputs are taken from tables, so results can't be computed in advance.
+#define N 1024
+
+static float values[N];
+static int32_t pressures[N];
+static float quats[N][4];
+static float outs[3][N];
+
+typedef struct {
+  float g[3], a[3], m[3];
+} imu_t;
+
+static imu_t imu[N];
+static madgwick_batch_sample_t samples[N];
+
+// The oversampled accelerometer: a full FIFO of noisy gravity.
+static sensor_batch_t fifo;
+static prefilter_t prefilter;
+
+// Filters of batches, e.g. a sweep of gains. Reports are per filter update.
+#define BATCH 256
+
+
+static void run_inv_sqrt(void* ctx, uint64_t iters) {
+  float sum = 0;
+  for (uint64_t i = 0; i < iters; ++i)
+    sum += inv_sqrt(values[i % N]);
+
+  bench_escape(&sum);
+}
+
+
+static void run_fast_rsqrt(void* ctx, uint64_t iters) {
+  float sum = 0;
+  for (uint64_t i = 0; i < iters; ++i)
+    sum += fast_rsqrt(values[i % N]);
+
+  bench_escape(&sum);
+}
+
+
+// Batches are of `N` elements, the report is per element.
+static void run_fast_rsqrt_n(void* ctx, uint64_t iters) {
+  for (uint64_t i = 0; i < iters; i += N)
+    fast_rsqrt_n(values, outs[0], N);
+
+  bench_escape(outs);
+}
+
+
+// The libm version which aux_math had before approximations.
+static void run_press_to_alt_libm(void* ctx, uint64_t iters) {
+  float sum = 0;
+  for (uint64_t i = 0; i < iters; ++i)
+    sum += 44330 * (1 - pow(pressures[i % N]/101325.0f, 0.19029496f));
+
+  bench_escape(&sum);
+}
+
+
+static void run_press_to_alt(void* ctx, uint64_t iters) {
+  float sum = 0;
+  for (uint64_t i = 0; i < iters; ++i)
+    sum += press_to_alt(pressures[i % N]);
+
+  bench_escape(&sum);
+}
+
+
+static void run_press_to_alt_n(void* ctx, uint64_t iters) {
+  for (uint64_t i = 0; i < iters; i += N)
+    press_to_alt_n(pressures, outs[0], N);
+
+  bench_escape(outs);
+}
+
+
+static void run_quat_to_euler_libm(void* ctx, uint64_t iters) {
+  float sum = 0;
+  for (uint64_t i = 0; i < iters; ++i) {
+    const float* q = quats[i % N];
+    sum += atan2(2*q[1]*q[2]-2*q[0]*q[3], 2*q[0]*q[0] + 2*q[1]*q[1]-1);
+    sum -= asin(2*q[1]*q[3] + 2*q[0]*q[2]);
+    sum += atan2(2*q[2]*q[3]-2*q[0]*q[1], 2*q[0]*q[0] + 2*q[3]*q[3]-1);
+  }
+
+  bench_escape(&sum);
+}
+
+
+static void run_quat_to_euler(void* ctx, uint64_t iters) {
+  float yaw, pitch, roll, sum = 0;
+  for (uint64_t i = 0; i < iters; ++i) {
+    quat_to_euler(quats[i % N], &yaw, &pitch, &roll);
+    sum += yaw + pitch + roll;
+  }
+
+  bench_escape(&sum);
+}
+
+
+static void run_quat_to_euler_n(void* ctx, uint64_t iters) {
+  for (uint64_t i = 0; i < iters; i += N)
+    quat_to_euler_n(quats, outs[0], outs[1], outs[2], N);
+
+  bench_escape(outs);
+}
+
+
+// Filters are called through `attitude_filter_t` as ahrs does.
+static void run_filter(void* ctx, uint64_t iters) {
+  attitude_filter_t* filter = ctx;
+
+  for (uint64_t i = 0; i < iters; ++i) {
+    const imu_t* s = &imu[i % N];
+    attitude_filter_update(filter, s->g, s->a, s->m, 0.01f);
+  }
+
+  bench_escape(attitude_filter_attitude(filter));
+}
+
+
+static void run_filter_propagate(void* ctx, uint64_t iters) {
+  attitude_filter_t* filter = ctx;
+
+  for (uint64_t i = 0; i < iters; ++i)
+    attitude_filter_update(filter, imu[i % N].g, NULL, NULL, 0.01f);
+
+  bench_escape(attitude_filter_attitude(filter));
+}
+
+
+static void run_filter_imu(void* ctx, uint64_t iters) {
+  attitude_filter_t* filter = ctx;
+
+  for (uint64_t i = 0; i < iters; ++i) {
+    const imu_t* s = &imu[i % N];
+    attitude_filter_update(filter, s->g, s->a, NULL, 0.01f);
+  }
+
+  bench_escape(attitude_filter_attitude(filter));
+}
+
+
+static void run_batch_shared(void* ctx, uint64_t iters) {
+  madgwick_batch_t* batch = ctx;
+
+  for (uint64_t i = 0; i < iters; i += BATCH) {
+    const imu_t* s = &imu[i/BATCH % N];
+    madgwick_batch_update_shared(batch, s->g, s->a, s->m, 0.01f);
+  }
+
+  bench_escape(batch->attitude[0]);
+}
+
+
+static void run_batch_run(void* ctx, uint64_t iters) {
+  madgwick_batch_t* batch = ctx;
+
+  for (uint64_t i = 0; i < iters; i += BATCH * N)
+    madgwick_batch_run(batch, samples, N, 4);
+
+  bench_escape(batch->attitude[0]);
+}
+
+
+// Batches are copied before filtering, the report is per input sample.
+static void run_prefilter(void* ctx, uint64_t iters) {
+  sensor_batch_t batch;
+
+  for (uint64_t i = 0; i < iters; i += SENSOR_BATCH_CAPACITY) {
+    memcpy(&batch, &fifo, sizeof(batch));
+    prefilter_run(ctx, &batch);
+  }
+
+  bench_escape(&batch);
+}
+
+
+// All legs of the hexapod per call, the report is per leg.
+static void run_leg_ik(void* ctx, uint64_t iters) {
+  const leg_ik_t* ik = ctx;
+  float joints[3][6];
+  float* out[3] = {joints[0], joints[1], joints[2]};
+  int states[6];
+
+  for (uint64_t i = 0; i < iters; i += 6) {
+    const float* foot[3] = {outs[0] + i % N/6*6, outs[1] + i % N/6*6,
+                            outs[2] + i % N/6*6};
+    leg_ik_solve(ik, foot, out, states);
+  }
+
+  bench_escape(joints);
+}
+
+
+static void run_bmp085(void* ctx, uint64_t iters) {
+  bmp085_t* dev = ctx;
+  int32_t sum = 0;
+
+  for (uint64_t i = 0; i < iters; ++i) {
+    bmp085_compensate_temp(dev, 27898 + (i & 63));
+    bmp085_compensate_press(dev, 23843 + (i & 255));
+    sum += dev->pressure;
+  }
+
+  bench_escape(&sum);
+}
+
+
+static void fill_inputs(void) {
+  for (int i = 0; i < N; ++i) {
+    values[i] = bench_uniform(0.5f, 2.f);
+    pressures[i] = bench_uniform(90000, 105000);
+
+    float q[4], norm = 0;
+    for (int j = 0; j < 4; ++j) {
+      q[j] = bench_uniform(-1, 1);
+      norm += q[j]*q[j];
+    }
+
+    for (int j = 0; j < 4; ++j)
+      quats[i][j] = q[j]/sqrt(norm);
+
+    // Slow rotation, gravity and the magnetic field with noise.
+    for (int j = 0; j < 3; ++j)
+      imu[i].g[j] = bench_uniform(-0.5f, 0.5f);
+
+    imu[i].a[0] = bench_uniform(-0.05f, 0.05f);
+    imu[i].a[1] = bench_uniform(-0.05f, 0.05f);
+    imu[i].a[2] = bench_uniform(0.95f, 1.05f);
+    imu[i].m[0] = bench_uniform(0.2f, 0.25f);
+    imu[i].m[1] = bench_uniform(-0.02f, 0.02f);
+    imu[i].m[2] = bench_uniform(-0.45f, -0.4f);
+
+    samples[i].dt = 0.01f;
+    for (int j = 0; j < 3; ++j) {
+      samples[i].g[j] = imu[i].g[j];
+      samples[i].a[j] = imu[i].a[j];
+      samples[i].m[j] = imu[i].m[j];
+    }
+  }
+
+  fifo.count = SENSOR_BATCH_CAPACITY;
+  fifo.period = 1e9f/3200;
+  for (int i = 0; i < SENSOR_BATCH_CAPACITY; ++i) {
+    fifo.x[i] = imu[i].a[0];
+    fifo.y[i] = imu[i].a[1];
+    fifo.z[i] = imu[i].a[2];
+  }
+}
+
+
+// Typical chains for the accelerometer at 3200 Hz fused at 100 Hz.
+static void bench_prefilter(const char* name, const char* spec) {
+  if (prefilter_start(&prefilter, spec, 3200, 0.004f))
+    bench_run(name, run_prefilter, &prefilter);
+}
+
+
+void bench_kernels(void) {
+  fill_inputs();
+
+  bench_run("inv_sqrt", run_inv_sqrt, NULL);
+  bench_run("fast_rsqrt", run_fast_rsqrt, NULL);
+  bench_run("fast_rsqrt_n", run_fast_rsqrt_n, NULL);
+  bench_run("press_to_alt_libm", run_press_to_alt_libm, NULL);
+  bench_run("press_to_alt", run_press_to_alt, NULL);
+  bench_run("press_to_alt_n", run_press_to_alt_n, NULL);
+  bench_run("quat_to_euler_libm", run_quat_to_euler_libm, NULL);
+  bench_run("quat_to_euler", run_quat_to_euler, NULL);
+  bench_run("quat_to_euler_n", run_quat_to_euler_n, NULL);
+
+  attitude_filter_t filter = {
+    &madgwick_filter_ops, madgwick_filter_start(MADGWICK_FILTER_BETA)
+  };
+  bench_run("madgwick_filter_update", run_filter, &filter);
+  bench_run("madgwick_filter_update_imu", run_filter_imu, &filter);
+  bench_run("madgwick_filter_propagate", run_filter_propagate, &filter);
+  attitude_filter_stop(&filter);
+
+  float gains[BATCH];
+  for (int i = 0; i < BATCH; ++i)
+    gains[i] = (i + 1) * 0.5f / BATCH;
+
+  madgwick_batch_t* batch = madgwick_batch_start(BATCH, gains);
+  bench_run("madgwick_batch_update_shared", run_batch_shared, batch);
+  bench_run("madgwick_batch_run_4_threads", run_batch_run, batch);
+  madgwick_batch_stop(batch);
+
+  filter.ops = &mahony_filter_ops;
+  filter.state = mahony_filter_start(MAHONY_FILTER_KP, MAHONY_FILTER_KI);
+  bench_run("mahony_filter_update", run_filter, &filter);
+  bench_run("mahony_filter_update_imu", run_filter_imu, &filter);
+  bench_run("mahony_filter_propagate", run_filter_propagate, &filter);
+  attitude_filter_stop(&filter);
+
+  // Calibration from the datasheet.
+  bmp085_t bmp = {
+    .oss = 0,
+    .ac1 = 408, .ac2 = -72, .ac3 = -14383, .ac4 = 32741, .ac5 = 32757,
+    .ac6 = 23153, .b1 = 6190, .b2 = 4, .mb = -32768, .mc = -8711, .md = 2868
+  };
+
+  bench_run("bmp085_compensate", run_bmp085, &bmp);
+
+  // Feet around the body, under legs of the hexapod.
+  leg_ik_leg_t legs[6];
+  for (int i = 0; i < 6; ++i) {
+    float yaw = (i * 60 + 30) * M_PI/180;
+    legs[i] = (leg_ik_leg_t){
+      .x = 6*cos(yaw), .y = 6*sin(yaw), .yaw = yaw,
+      .coxa = 2.5, .femur = 4.5, .tibia = 8.5, .beta = 15 * M_PI/180
+    };
+  }
+
+  for (int i = 0; i < N; ++i) {
+    float dist = bench_uniform(10, 18), yaw = legs[i % 6].yaw;
+    outs[0][i] = dist*cos(yaw) + bench_uniform(-3, 3);
+    outs[1][i] = dist*sin(yaw) + bench_uniform(-3, 3);
+    outs[2][i] = bench_uniform(-10, -2);
+  }
+
+  leg_ik_t ik;
+  leg_ik_start(&ik, legs, 6);
+  bench_run("leg_ik_solve", run_leg_ik, &ik);
+
+  bench_prefilter("prefilter_median_cic_fir", "median:3 cic:8:3 fir:15:40");
+  bench_prefilter("prefilter_boxcar_biquad", "boxcar:32 biquad:30");
+  bench_prefilter("prefilter_fir_32", "fir:32:400");
+}
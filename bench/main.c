@@ -0,0 +1,20 @@
+#include <stdio.h>
+
+#include "bench.h"
+#include "suites.h"
+
+
+/*
+ * Usage: bench [filter] > report.json
+ * Runs benchmarks whose names contain `filter`, all by default. Fails if some
+ * approximation is less accurate than documented.
+ */
+int main(int argc, char** argv) {
+  bench_start(argc > 1 ? argv[1] : NULL);
+
+  bench_accuracy();
+  bench_kernels();
+  bench_runtime();
+
+  return bench_finish() ? 0 : 1;
+}
@@ -0,0 +1,218 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "base/flight_log.h"
+#include "base/logging.h"
+#include "base/pubsub.h"
+#include "bench.h"
+#include "control/attitude_filter.h"
+#include "control/madgwick_filter.h"
+#include "devices/adxl345.h"
+#include "devices/hmc5883l.h"
+#include "devices/i2c.h"
+#include "devices/l3g4200d.h"
+#include "suites.h"
+
+
+#define FRAMES 1024
+#define LOG_SIZE (64 << 20)
+
+static flight_frame_t frames[FRAMES];
+static char log_path[256];
+
+
+static void noop(void* ctx, void* data) {
+  bench_escape(data);
+}
+
+
+static void run_publish(void* ctx, uint64_t iters) {
+  event_t* ev = ctx;
+  float data[4] = {1, 0, 0, 0};
+
+  for (uint64_t i = 0; i < iters; ++i)
+    publish(ev, data);
+}
+
+
+static void bench_publish(const char* name, int count) {
+  event_t ev = EVENT_INIT(name);
+  static int ctxs[EVENT_CAPACITY];
+
+  for (int i = 0; i < count; ++i)
+    subscribe(&ev, noop, &ctxs[i]);
+
+  bench_run(name, run_publish, &ev);
+  unsubscribe_all(&ev);
+}
+
+
+static void run_log_message(void* ctx, uint64_t iters) {
+  // Only the first messages of the second pass the rate limit,
+  // the rest shows the cost of a message on the hot path.
+  for (uint64_t i = 0; i < iters; ++i)
+    log__message("embed/bench", __LINE__, __func__, LOG_LEVEL_DEBUG,
+                 "Benchmark message %d of %s.", (int)i, "bench");
+}
+
+
+static void run_flight_log_append(void* ctx, uint64_t iters) {
+  flight_log_t** fl = ctx;
+
+  for (uint64_t i = 0; i < iters; ++i)
+    if (!flight_log_append(*fl, &frames[i % FRAMES])) {
+      // The log is full, the cost of the new one is the part of the result.
+      flight_log_close(*fl);
+      *fl = flight_log_create(log_path, LOG_SIZE);
+    }
+}
+
+
+static void run_flight_log_next(void* ctx, uint64_t iters) {
+  flight_log_t* fl = ctx;
+  flight_frame_t frame;
+
+  for (uint64_t i = 0; i < iters; ++i)
+    if (!flight_log_next(fl, &frame))
+      flight_log_seek(fl, 0);
+
+  bench_escape(&frame);
+}
+
+
+typedef struct {
+  attitude_filter_t filter;
+  attitude_fusion_t fusion;
+  event_t ev;
+  adxl345_t* adxl345;
+  hmc5883l_t* hmc5883l;
+  l3g4200d_t* l3g4200d;
+  i2c_read_t reads[3];
+} tick_t;
+
+
+static void run_tick_replay(void* ctx, uint64_t iters) {
+  tick_t* tick = ctx;
+  tick->fusion.last_run = frames[0].stamp[FLIGHT_GYRO];
+
+  for (uint64_t i = 0; i < iters; ++i) {
+    // Stamps go on through passes over the frames.
+    flight_frame_t frame = frames[i % FRAMES];
+    uint64_t pass = i / FRAMES;
+    frame.stamp[FLIGHT_GYRO] += pass * FRAMES * 2500000;
+
+    attitude_filter_fuse_frame(&tick->filter, &tick->fusion, &frame, true);
+    publish(&tick->ev, attitude_filter_attitude(&tick->filter));
+  }
+}
+
+
+static void run_tick_sim(void* ctx, uint64_t iters) {
+  tick_t* tick = ctx;
+  uint64_t stamp = tick->fusion.last_run = 0;
+  flight_frame_t frame = frames[0];
+
+  for (uint64_t i = 0; i < iters; ++i) {
+    if (!i2c_read_many(tick->reads, 3)) abort();
+
+    adxl345_decode(tick->adxl345);
+    hmc5883l_decode(tick->hmc5883l);
+    l3g4200d_decode(tick->l3g4200d);
+
+    for (int k = 0; k < 3; ++k) {
+      frame.raw[FLIGHT_ACC][k] = tick->adxl345->raw[k];
+      frame.raw[FLIGHT_MAG][k] = tick->hmc5883l->raw[k];
+      frame.raw[FLIGHT_GYRO][k] = tick->l3g4200d->raw[k];
+    }
+
+    // All sensors are read every tick, so all samples are fresh.
+    stamp += 2500000;
+    frame.stamp[FLIGHT_ACC] = frame.stamp[FLIGHT_MAG] = stamp;
+    frame.stamp[FLIGHT_GYRO] = stamp;
+    attitude_filter_fuse_frame(&tick->filter, &tick->fusion, &frame, true);
+    publish(&tick->ev, attitude_filter_attitude(&tick->filter));
+  }
+}
+
+
+static void fill_frames(void) {
+  // 400 Hz samples of the level sensor with noise.
+  static const int16_t acc[3] = {0, 0, 256};
+  static const int16_t mag[3] = {240, 0, -460};
+
+  for (int i = 0; i < FRAMES; ++i) {
+    flight_frame_t* fr = &frames[i];
+    uint64_t stamp = 1000000000ull + i * 2500000ull;
+
+    fr->stamp[FLIGHT_ACC] = fr->stamp[FLIGHT_MAG] = stamp;
+    fr->stamp[FLIGHT_GYRO] = stamp;
+    fr->gain[FLIGHT_ACC] = 4.f/1024;
+    fr->gain[FLIGHT_MAG] = 1/1090.f;
+    fr->gain[FLIGHT_GYRO] = 8.75e-3f;
+
+    for (int k = 0; k < 3; ++k) {
+      fr->raw[FLIGHT_ACC][k] = acc[k] + bench_uniform(-8, 8);
+      fr->raw[FLIGHT_MAG][k] = mag[k] + bench_uniform(-4, 4);
+      fr->raw[FLIGHT_GYRO][k] = bench_uniform(-20, 20);
+    }
+  }
+}
+
+
+void bench_runtime(void) {
+  fill_frames();
+
+  bench_publish("publish_0", 0);
+  bench_publish("publish_1", 1);
+  bench_publish("publish_4", 4);
+
+  bench_run("log_message_limited", run_log_message, NULL);
+
+  const char* tmp = getenv("TMPDIR");
+  snprintf(log_path, sizeof(log_path), "%s/bench.flight", tmp ? tmp : "/tmp");
+
+  flight_log_t* fl = flight_log_create(log_path, LOG_SIZE);
+  if (fl) {
+    bench_run("flight_log_append", run_flight_log_append, &fl);
+    flight_log_close(fl);
+  }
+
+  if ((fl = flight_log_open(log_path))) {
+    bench_run("flight_log_next", run_flight_log_next, fl);
+    flight_log_close(fl);
+  }
+
+  remove(log_path);
+
+  tick_t tick = {
+    .filter = {
+      &madgwick_filter_ops, madgwick_filter_start(MADGWICK_FILTER_BETA)
+    },
+    .ev = EVENT_INIT("ahrs")
+  };
+  subscribe(&tick.ev, noop, NULL);
+  bench_run("ahrs_tick_replay", run_tick_replay, &tick);
+
+  bool ok = (tick.adxl345 = adxl345_open("sim", ADXL345_ADDR))
+         && (tick.hmc5883l = hmc5883l_open("sim", HMC5883L_ADDR))
+         && (tick.l3g4200d = l3g4200d_open("sim", L3G4200D_ADDR))
+         && adxl345_tune(tick.adxl345, 400, 4.0f)
+         && hmc5883l_tune(tick.hmc5883l, 75, 4.0f)
+         && l3g4200d_tune(tick.l3g4200d, 400, 250.0f);
+
+  if (ok) {
+    adxl345_prepare_read(tick.adxl345, &tick.reads[0]);
+    hmc5883l_prepare_read(tick.hmc5883l, &tick.reads[1]);
+    l3g4200d_prepare_read(tick.l3g4200d, &tick.reads[2]);
+    bench_run("ahrs_tick_sim", run_tick_sim, &tick);
+  }
+
+  if (tick.adxl345) adxl345_close(tick.adxl345);
+  if (tick.hmc5883l) hmc5883l_close(tick.hmc5883l);
+  if (tick.l3g4200d) l3g4200d_close(tick.l3g4200d);
+
+  unsubscribe_all(&tick.ev);
+  attitude_filter_stop(&tick.filter);
+}
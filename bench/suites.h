@@ -0,0 +1,14 @@
+#pragma once
+
+
+/*!
+ * Accuracy of aux_math approximations against libm, of the leg IK against
+ * the demo and of batched filters against scalar ones.
+ */
+extern void bench_accuracy(void);
+
+/*! Math kernels: aux_math, filters, prefilters and compensation of bmp085. */
+extern void bench_kernels(void);
+
+/*! Runtime: pubsub, logging, the flight log and ahrs ticks. */
+extern void bench_runtime(void);
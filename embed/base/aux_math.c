@@ -5,26 +5,189 @@
 #include <tgmath.h>
 
 
+/*
+ * Polynomials are minimax (Remez) approximations, coefficients go in
+ * ascending powers. Constants are floats to keep the arithmetic in single
+ * precision, which is what the VFP of ARMv6 does fast.
+ */
+static const float HALF_PI = 1.57079633f;
+static const float PI = 3.14159265f;
+
+// Both functions of air are taken from the bmp085 datasheet.
+static const float SEA_LEVEL = 101325.f;
+static const float BARO_EXPONENT = 0.19029496f;
+static const float BARO_SCALE = 44330.f;
+
+
+// The union keeps the type punning valid with strict aliasing.
+typedef union {float f; int32_t i;} pun_t;
+
+
+static inline float rsqrt_kernel(float x) {
+  pun_t conv = {x};
+  float halfx = 0.5f * x;
+  conv.i = 0x5f375a86 - (conv.i>>1);
+  float y = conv.f;
+  y = y * (1.5f - (halfx * y * y));
+  y = y * (1.5f - (halfx * y * y));
+  return y;
+}
+
+
+// atan(t) = t * P(t²) for t in [0, 1], the error is 3.7e-6.
+static inline float atan_kernel(float t) {
+  float t2 = t*t;
+  return t * (0.999954148f + t2*(-0.332179523f + t2*(0.191123995f
+           + t2*(-0.111010298f + t2*(0.0473110791f + t2*-0.00980123733f)))));
+}
+
+
+static inline float atan2_kernel(float y, float x) {
+  float ax = fabs(x), ay = fabs(y);
+  float hi = ax > ay ? ax : ay;
+  float lo = ax > ay ? ay : ax;
+
+  // Reduce to the first octant and reflect back.
+  float r = atan_kernel(lo / (hi > 0 ? hi : 1));
+  r = ay > ax ? HALF_PI - r : r;
+  r = x < 0 ? PI - r : r;
+  return copysign(r, y);
+}
+
+
+// asin(x) = π/2 - sqrt(1 - x) * P(x) for x in [0, 1], the error is 1.1e-6.
+static inline float asin_kernel(float x) {
+  float ax = fabs(x);
+  ax = ax < 1 ? ax : 1;
+
+  float p = 1.57079633f + ax*(-0.214578797f + ax*(0.0884934919f
+          + ax*(-0.0469291395f + ax*(0.0218797667f + ax*-0.00546127826f))));
+  return copysign(HALF_PI - sqrt(1 - ax) * p, x);
+}
+
+
+// log2(m) = u * P(u), u = m - 1 for m in [√½, √2), the error is 3.0e-7.
+static inline float log2_kernel(float x) {
+  pun_t conv = {x};
+
+  // Split into the exponent and the mantissa around √½.
+  int32_t e = (conv.i - 0x3f3504f3) >> 23;
+  conv.i -= e * (1 << 23);
+
+  float u = conv.f - 1;
+  return e + u * (1.44269973f + u*(-0.721375871f + u*(0.480465034f
+           + u*(-0.358961851f + u*(0.297262587f + u*(-0.272697926f
+           + u*0.170634504f))))));
+}
+
+
+// 2^y - 1 = y * Q(y) for y in [-½, ½], the error is 9.3e-8.
+static inline float exp2m1_kernel(float y) {
+  return y * (0.693147215f + y*(0.240222346f + y*(0.0555030836f
+           + y*(0.00967187506f + y*0.00134072591f))));
+}
+
+
+static inline float exp2_kernel(float x) {
+  x = x < -126 ? -126 : x > 127 ? 127 : x;
+
+  // Round to nearest, the remainder is in [-½, ½].
+  int32_t n = x + (x < 0 ? -0.5f : 0.5f);
+  pun_t conv = {1 + exp2m1_kernel(x - n)};
+  conv.i += n * (1 << 23);
+  return conv.f;
+}
+
+
+static inline float press_to_alt_kernel(int32_t p) {
+  // 1 - (p/p0)^k = -(2^y - 1), y = k*log2(p/p0), |y| < ½ for p in 3..600 kPa.
+  float y = BARO_EXPONENT * log2_kernel(p * (1/SEA_LEVEL));
+  return -BARO_SCALE * exp2m1_kernel(y);
+}
+
+
+static inline void quat_to_euler_kernel(const float q[4], float* yaw,
+                                        float* pitch, float* roll) {
+  *yaw = atan2_kernel(2*q[1]*q[2]-2*q[0]*q[3], 2*q[0]*q[0] + 2*q[1]*q[1]-1);
+  *pitch = -asin_kernel(2*q[1]*q[3] + 2*q[0]*q[2]);
+  *roll = atan2_kernel(2*q[2]*q[3]-2*q[0]*q[1], 2*q[0]*q[0] + 2*q[3]*q[3]-1);
+}
+
+
 float inv_sqrt(float x) {
+  pun_t conv = {x};
   float halfx = 0.5f * x;
-  float y = x;
-  int32_t i = *(int32_t*)&y;
-  i = 0x5f3759df - (i>>1);
-  y = *(float*)&i;
+  conv.i = 0x5f3759df - (conv.i>>1);
+  float y = conv.f;
   y = y * (1.5f - (halfx * y * y));
   return y;
 }
 
 
+float fast_rsqrt(float x) {
+  return rsqrt_kernel(x);
+}
+
+
+float fast_atan2(float y, float x) {
+  return atan2_kernel(y, x);
+}
+
+
+float fast_asin(float x) {
+  return asin_kernel(x);
+}
+
+
+float fast_log2(float x) {
+  return log2_kernel(x);
+}
+
+
+float fast_exp2(float x) {
+  return exp2_kernel(x);
+}
+
+
 float press_to_alt(int32_t p) {
   assert(p > 0);
-  return 44330 * (1 - pow(p/101325.0f, 0.19029496f));
+  return press_to_alt_kernel(p);
 }
 
 
-void quat_to_euler(float q[4], float* yaw, float* pitch, float* roll) {
+void quat_to_euler(const float q[4], float* yaw, float* pitch, float* roll) {
   assert(yaw && pitch && roll);
-  *yaw = atan2(2*q[1]*q[2]-2*q[0]*q[3], 2*q[0]*q[0] + 2*q[1]*q[1]-1);
-  *pitch = -asin(2*q[1]*q[3] + 2*q[0]*q[2]);
-  *roll = atan2(2*q[2]*q[3]-2*q[0]*q[1], 2*q[0]*q[0] + 2*q[3]*q[3]-1);
+  quat_to_euler_kernel(q, yaw, pitch, roll);
+}
+
+
+void fast_rsqrt_n(const float* restrict x, float* restrict out, int n) {
+  for (int i = 0; i < n; ++i)
+    out[i] = rsqrt_kernel(x[i]);
+}
+
+
+void fast_atan2_n(const float* restrict y, const float* restrict x,
+                  float* restrict out, int n) {
+  for (int i = 0; i < n; ++i)
+    out[i] = atan2_kernel(y[i], x[i]);
+}
+
+
+void fast_asin_n(const float* restrict x, float* restrict out, int n) {
+  for (int i = 0; i < n; ++i)
+    out[i] = asin_kernel(x[i]);
+}
+
+
+void press_to_alt_n(const int32_t* restrict p, float* restrict out, int n) {
+  for (int i = 0; i < n; ++i)
+    out[i] = press_to_alt_kernel(p[i]);
+}
+
+
+void quat_to_euler_n(float (* restrict q)[4], float* restrict yaw,
+                     float* restrict pitch, float* restrict roll, int n) {
+  for (int i = 0; i < n; ++i)
+    quat_to_euler_kernel(q[i], &yaw[i], &pitch[i], &roll[i]);
 }
@@ -5,20 +5,60 @@
 
 
 /*!
- * Calculate inverse square root.
+ * Calculate inverse square root, the relative error is below 1.8e-3.
  * @see http://en.wikipedia.org/wiki/Fast_inverse_square_root
  */
 extern float inv_sqrt(float x);
 
-/*! Convert pressure to altitude for air. */
+/*! Inverse square root with two Newton steps, the relative error < 5e-6. */
+extern float fast_rsqrt(float x);
+
+/*! Approximation of `atan2(y, x)`, the absolute error < 4e-6 rad. */
+extern float fast_atan2(float y, float x);
+
+/*! Approximation of `asin(x)`, the absolute error < 2e-6 rad. |x| ≤ 1. */
+extern float fast_asin(float x);
+
+/*!
+ * Approximation of `log2(x)` for normal x > 0.
+ * The error is below 4e-7 · max(1, |log2(x)|).
+ */
+extern float fast_log2(float x);
+
+/*! Approximation of `exp2(x)` for |x| < 126, the relative error < 2.5e-7. */
+extern float fast_exp2(float x);
+
+/*!
+ * Convert pressure [Pa] to altitude [m] for air.
+ * The error is below 1 cm from 30 kPa to 110 kPa.
+ */
 extern float press_to_alt(int32_t p);
 
 /*!
- * Convert quaternion to Euler's angles.
+ * Convert quaternion to Euler's angles, the error is below 1e-5 rad.
  * @param q               quaternion
  * @param yaw,pitch,roll  angles
  */
-extern void quat_to_euler(float q[4], float* yaw, float* pitch, float* roll);
+extern void quat_to_euler(const float q[4], float* yaw, float* pitch,
+                          float* roll);
+
+/*
+ * Batch versions process `n` elements. Loops are branch-free, so the compiler
+ * vectorizes them where the target has SIMD. Results are the same as of the
+ * scalar versions up to rounding.
+ */
+extern void fast_rsqrt_n(const float* restrict x, float* restrict out, int n);
+
+extern void fast_atan2_n(const float* restrict y, const float* restrict x,
+                         float* restrict out, int n);
+
+extern void fast_asin_n(const float* restrict x, float* restrict out, int n);
+
+extern void press_to_alt_n(const int32_t* restrict p, float* restrict out,
+                           int n);
+
+extern void quat_to_euler_n(float (* restrict q)[4], float* restrict yaw,
+                            float* restrict pitch, float* restrict roll, int n);
 
 
 #define deg_to_rad(x) (x) * M_PI/180
@@ -4,19 +4,33 @@
 #include <limits.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
 
 #include "base/logging.h"
 
 
 static const char* CONFIG_FILE = "config.ini";
 
+// Of lists of numbers: their values and items.
+#define LIST_SIZE 256
+#define LIST_MAX (LIST_SIZE / 2)
+
 
 static dictionary* dict;
 
+// Probes read the config concurrently, but lookups of iniparser lowercase
+// keys into the static buffer.
+static uv_mutex_t lock;
+
 
 void cfg_init(void) {
   if (!(dict = iniparser_load(CONFIG_FILE)))
     log_fatal("Failure while loading %s.", CONFIG_FILE);
+
+  uv_mutex_init(&lock);
 }
 
 
@@ -25,28 +39,84 @@ void cfg_init(void) {
 
 
 const char* cfg_str(const char* key) {
+  uv_mutex_lock(&lock);
   char* str = iniparser_getstring(dict, key, NULL);
+  uv_mutex_unlock(&lock);
+
   NOT_FOUND_IF(!str);
   return str;
 }
 
 
 int cfg_int(const char* key) {
+  uv_mutex_lock(&lock);
   int res = iniparser_getint(dict, key, INT_MIN);
+  uv_mutex_unlock(&lock);
+
   NOT_FOUND_IF(res == INT_MIN);
   return res;
 }
 
 
 double cfg_double(const char* key) {
+  uv_mutex_lock(&lock);
   double res = iniparser_getdouble(dict, key, NAN);
+  uv_mutex_unlock(&lock);
+
   NOT_FOUND_IF(isnan(res));
   return res;
 }
 
 
 bool cfg_bool(const char* key) {
+  uv_mutex_lock(&lock);
   int res = iniparser_getboolean(dict, key, -1);
+  uv_mutex_unlock(&lock);
+
   NOT_FOUND_IF(res == -1);
   return res;
 }
+
+
+int cfg_words(const char* key, char* buf, size_t size, char** words,
+              int max) {
+  snprintf(buf, size, "%s", cfg_str(key));
+
+  int count = 0;
+  char* saveptr;
+  for (char* word = strtok_r(buf, " ,", &saveptr); word;
+       word = strtok_r(NULL, " ,", &saveptr), ++count)
+    if (count < max) words[count] = word;
+
+  return count;
+}
+
+
+int cfg_ints(const char* key, int* values, int max) {
+  char list[LIST_SIZE];
+  char* items[LIST_MAX];
+  int count = cfg_words(key, list, sizeof(list), items, LIST_MAX);
+
+  for (int i = 0; i < count && i < max; ++i) {
+    char* end;
+    values[i] = strtol(items[i], &end, 0);
+    if (*end) log_fatal("%s must list integers, not %s.", key, items[i]);
+  }
+
+  return count;
+}
+
+
+int cfg_floats(const char* key, float* values, int max) {
+  char list[LIST_SIZE];
+  char* items[LIST_MAX];
+  int count = cfg_words(key, list, sizeof(list), items, LIST_MAX);
+
+  for (int i = 0; i < count && i < max; ++i) {
+    char* end;
+    values[i] = strtof(items[i], &end);
+    if (*end) log_fatal("%s must list numbers, not %s.", key, items[i]);
+  }
+
+  return count;
+}
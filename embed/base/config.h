@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 
 
 extern void cfg_init(void);
@@ -9,3 +10,17 @@ extern const char* cfg_str(const char* key);
 extern int cfg_int(const char* key);
 extern double cfg_double(const char* key);
 extern bool cfg_bool(const char* key);
+
+/*
+ * Lists are values of items separated by spaces or commas. Readers return
+ * the number of items in the list, only `max` first ones are stored.
+ */
+
+/*! Split the list into `buf`, `words` point into it. */
+extern int cfg_words(const char* key, char* buf, size_t size, char** words,
+                     int max);
+
+/*! Read the list of integers, prefixes of bases (e.g. "0x40") are allowed. */
+extern int cfg_ints(const char* key, int* values, int max);
+
+extern int cfg_floats(const char* key, float* values, int max);
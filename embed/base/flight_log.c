@@ -0,0 +1,348 @@
+#include "base/flight_log.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "base/logging.h"
+
+
+static const char MAGIC[8] = "T6FLIGHT";
+static const uint32_t VERSION = 1;
+
+// Stamps take at most 10 bytes, deltas of raw values at most 3 bytes.
+#define MAX_FRAME_SIZE (3*10 + 9*3)
+
+// Frames take at least 12 bytes, so chunks are not less than this.
+#define MIN_CHUNK_SIZE (FLIGHT_LOG_CHUNK * 12)
+
+
+typedef struct {
+  uint64_t offset;  // From the beginning of the file.
+  uint64_t stamp;   // Of the first frame [ns].
+  uint32_t frames;
+  uint32_t size;    // [bytes]
+} chunk_t;
+
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t chunk_frames;
+  float gain[3];
+  uint32_t capacity;  // Of the index.
+  uint32_t chunks;
+  uint32_t reserved;
+  uint64_t size;      // Used bytes of the file.
+  chunk_t index[];
+} header_t;
+
+
+struct flight_log_s {
+  bool writable;
+  int fd;
+  size_t size;  // Of the mapping.
+  uint8_t* map;
+  header_t* header;  // The same as `map`.
+
+  // The cursor: the current chunk, frames passed in it and the next frame.
+  uint32_t chunk;
+  uint32_t frame;
+  uint64_t pos;
+  flight_frame_t prev;
+};
+
+
+static uint64_t zigzag(int64_t value) {
+  return (uint64_t)value << 1 ^ (uint64_t)(value >> 63);
+}
+
+
+static int64_t unzigzag(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+
+static uint8_t* put_varint(uint8_t* p, uint64_t value) {
+  for (; value >= 0x80; value >>= 7)
+    *p++ = value | 0x80;
+
+  *p++ = value;
+  return p;
+}
+
+
+static const uint8_t* get_varint(const uint8_t* p, const uint8_t* end,
+                                 uint64_t* value) {
+  *value = 0;
+
+  for (int shift = 0; p < end && shift < 64; shift += 7) {
+    *value |= (uint64_t)(*p & 0x7f) << shift;
+    if (!(*p++ & 0x80)) return p;
+  }
+
+  return NULL;
+}
+
+
+static uint8_t* encode(uint8_t* p, const flight_frame_t* frame,
+                       const flight_frame_t* prev) {
+  p = put_varint(p, zigzag(frame->stamp[0] - prev->stamp[0]));
+  p = put_varint(p, zigzag(frame->stamp[1] - frame->stamp[0]));
+  p = put_varint(p, zigzag(frame->stamp[2] - frame->stamp[0]));
+
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      p = put_varint(p, zigzag(frame->raw[i][j] - prev->raw[i][j]));
+
+  return p;
+}
+
+
+static const uint8_t* decode(const uint8_t* p, const uint8_t* end,
+                             flight_frame_t* frame,
+                             const flight_frame_t* prev) {
+  uint64_t value[12];
+
+  for (int i = 0; i < 12; ++i)
+    if (!(p = get_varint(p, end, &value[i])))
+      return NULL;
+
+  frame->stamp[0] = prev->stamp[0] + unzigzag(value[0]);
+  frame->stamp[1] = frame->stamp[0] + unzigzag(value[1]);
+  frame->stamp[2] = frame->stamp[0] + unzigzag(value[2]);
+
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      frame->raw[i][j] = prev->raw[i][j] + unzigzag(value[3 + 3*i + j]);
+
+  return p;
+}
+
+
+flight_log_t* flight_log_create(const char* path, size_t size) {
+  assert(path);
+
+  uint32_t capacity = size / MIN_CHUNK_SIZE + 1;
+  size_t start = sizeof(header_t) + capacity * sizeof(chunk_t);
+
+  if (size < start + MAX_FRAME_SIZE)
+    return log_error("Too small size of the flight log: %zu bytes.", size);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return log_error("Cannot create %s: %s.", path, strerror(errno));
+
+  // Allocate blocks right now, not by page faults while recording.
+  int err = posix_fallocate(fd, 0, size);
+  if (err) {
+    close(fd);
+    return log_error("Cannot preallocate %s: %s.", path, strerror(err));
+  }
+
+  void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return log_error("Cannot map %s: %s.", path, strerror(errno));
+  }
+
+  flight_log_t* log = malloc(sizeof(flight_log_t));
+  log->writable = true;
+  log->fd = fd;
+  log->size = size;
+  log->map = map;
+  log->header = map;
+  log->chunk = 0;
+  log->frame = 0;
+  log->pos = start;
+
+  header_t* header = log->header;
+  memcpy(header->magic, MAGIC, sizeof(MAGIC));
+  header->version = VERSION;
+  header->chunk_frames = FLIGHT_LOG_CHUNK;
+  header->gain[0] = header->gain[1] = header->gain[2] = 0.f;
+  header->capacity = capacity;
+  header->chunks = 0;
+  header->reserved = 0;
+  header->size = start;
+
+  return log;
+}
+
+
+bool flight_log_append(flight_log_t* log, const flight_frame_t* frame) {
+  assert(log && frame);
+  assert(log->writable);
+
+  header_t* header = log->header;
+
+  if (header->size + MAX_FRAME_SIZE > log->size)
+    return false;
+
+  if (header->chunks == 0 || log->frame == FLIGHT_LOG_CHUNK) {
+    if (header->chunks == header->capacity)
+      return false;
+
+    if (header->chunks == 0)
+      memcpy(header->gain, frame->gain, sizeof(header->gain));
+
+    log->chunk = header->chunks;
+    log->frame = 0;
+    memset(&log->prev, 0, sizeof(log->prev));
+    header->index[log->chunk] = (chunk_t){header->size, frame->stamp[0], 0, 0};
+    ++header->chunks;
+  }
+
+  uint8_t* end = encode(log->map + header->size, frame, &log->prev);
+  uint64_t size = end - log->map;
+
+  // The frame becomes visible only after it's written completely.
+  chunk_t* chunk = &header->index[log->chunk];
+  chunk->size += size - header->size;
+  chunk->frames = ++log->frame;
+  header->size = size;
+  log->prev = *frame;
+
+  return true;
+}
+
+
+flight_log_t* flight_log_open(const char* path) {
+  assert(path);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return log_error("Cannot open %s: %s.", path, strerror(errno));
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(header_t)) {
+    close(fd);
+    return log_error("%s isn't a flight log.", path);
+  }
+
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return log_error("Cannot map %s: %s.", path, strerror(errno));
+  }
+
+  flight_log_t* log = malloc(sizeof(flight_log_t));
+  log->writable = false;
+  log->fd = fd;
+  log->size = st.st_size;
+  log->map = map;
+  log->header = map;
+
+  const header_t* header = log->header;
+  bool ok = !memcmp(header->magic, MAGIC, sizeof(MAGIC))
+         && header->version == VERSION
+         && header->chunks <= header->capacity
+         && sizeof(header_t) + header->capacity * sizeof(chunk_t) <= log->size
+         && header->size <= log->size;
+
+  for (uint32_t i = 0; ok && i < header->chunks; ++i)
+    ok = header->index[i].offset + header->index[i].size <= header->size;
+
+  if (!ok) {
+    flight_log_close(log);
+    return log_error("%s isn't a flight log of version %u.", path, VERSION);
+  }
+
+  flight_log_seek(log, 0);
+  return log;
+}
+
+
+bool flight_log_next(flight_log_t* log, flight_frame_t* frame) {
+  assert(log && frame);
+  assert(!log->writable);
+
+  const header_t* header = log->header;
+  if (log->chunk >= header->chunks) return false;
+
+  const chunk_t* chunk = &header->index[log->chunk];
+
+  while (log->frame == chunk->frames) {
+    if (++log->chunk == header->chunks) return false;
+    chunk = &header->index[log->chunk];
+    log->frame = 0;
+    log->pos = chunk->offset;
+    memset(&log->prev, 0, sizeof(log->prev));
+  }
+
+  const uint8_t* end = log->map + chunk->offset + chunk->size;
+  const uint8_t* p = decode(log->map + log->pos, end, frame, &log->prev);
+
+  if (!p) {
+    log_error("The chunk %u of the flight log is corrupted.", log->chunk);
+    log->chunk = header->chunks;
+    return false;
+  }
+
+  memcpy(frame->gain, header->gain, sizeof(frame->gain));
+  log->pos = p - log->map;
+  log->prev = *frame;
+  ++log->frame;
+
+  return true;
+}
+
+
+void flight_log_seek(flight_log_t* log, uint64_t stamp) {
+  assert(log);
+  assert(!log->writable);
+
+  const header_t* header = log->header;
+
+  // Find the last chunk which starts not later than the stamp.
+  uint32_t lo = 0, hi = header->chunks;
+  while (hi - lo > 1) {
+    uint32_t mid = lo + (hi - lo)/2;
+    if (header->index[mid].stamp <= stamp) lo = mid;
+    else hi = mid;
+  }
+
+  log->chunk = lo;
+  log->frame = 0;
+  log->pos = header->chunks > 0 ? header->index[lo].offset : 0;
+  memset(&log->prev, 0, sizeof(log->prev));
+}
+
+
+uint64_t flight_log_frames(const flight_log_t* log) {
+  assert(log);
+
+  uint64_t frames = 0;
+  for (uint32_t i = 0; i < log->header->chunks; ++i)
+    frames += log->header->index[i].frames;
+
+  return frames;
+}
+
+
+bool flight_log_close(flight_log_t* log) {
+  assert(log);
+  bool res = true;
+
+  uint64_t used = log->header->size;
+
+  if (munmap(log->map, log->size) < 0)
+    res = log_error("Cannot unmap the flight log: %s.", strerror(errno));
+
+  // Give back preallocated but unused space.
+  if (log->writable && ftruncate(log->fd, used) < 0)
+    res = log_error("Cannot truncate the flight log: %s.", strerror(errno));
+
+  if (close(log->fd) < 0)
+    res = log_error("Cannot close the flight log: %s.", strerror(errno));
+
+  free(log);
+  return res;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum {FLIGHT_ACC, FLIGHT_MAG, FLIGHT_GYRO};
+
+
+/*! Raw measurements of the accelerometer, magnetometer and gyroscope. */
+typedef struct {
+  uint64_t stamp[3];  //!< Time of sampling [ns] (`uv_hrtime()`).
+  int16_t raw[3][3];  //!< Raw measurements in order x, y, z.
+  float gain[3];      //!< Scales of raw measurements: [g], [Ga] and [°/s].
+} flight_frame_t;
+
+
+/*!
+ * The flight log is the preallocated memory-mapped file of frames.
+ *
+ * Frames are grouped by chunks of `FLIGHT_LOG_CHUNK` frames. Every field of
+ * the frame is stored as the zigzag varint of the delta to the previous frame
+ * of the chunk (stamps of magnetometer and gyroscope relative to the stamp of
+ * accelerometer), so the usual frame takes 15-20 bytes instead of 42. The
+ * index of chunks at the beginning of the file allows to seek by time.
+ *
+ * Appending is a copy to the mapping, there are no syscalls per frame.
+ * Gains are stored once per log, they are expected to be constant.
+ */
+typedef struct flight_log_s flight_log_t;
+
+#define FLIGHT_LOG_CHUNK 4096
+
+
+/*! Create (or truncate) the log and preallocate `size` bytes. */
+extern flight_log_t* flight_log_create(const char* path, size_t size);
+
+/*! Append the frame, fail if the log is full. Only for created logs. */
+extern bool flight_log_append(flight_log_t* log, const flight_frame_t* frame);
+
+/*! Open the log for reading. */
+extern flight_log_t* flight_log_open(const char* path);
+
+/*! Read the next frame, fail at the end of the log. Only for opened logs. */
+extern bool flight_log_next(flight_log_t* log, flight_frame_t* frame);
+
+/*! Move to the first frame of the chunk which contains `stamp` [ns]. */
+extern void flight_log_seek(flight_log_t* log, uint64_t stamp);
+
+/*! Number of frames in the log. */
+extern uint64_t flight_log_frames(const flight_log_t* log);
+
+/*! Close the log. Created logs are truncated to the used size. */
+extern bool flight_log_close(flight_log_t* log);
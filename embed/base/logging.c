@@ -1,13 +1,20 @@
 #include "base/logging.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <uv.h>
 
+#include "base/spsc.h"
+#include "base/trace.h"
+
 
 static const log_level_t LOG_ERRMASK = LOG_LEVEL_FATAL
                                      | LOG_LEVEL_ERROR
@@ -28,6 +35,77 @@ static const int PREFIX_SIZE  = 45;
 static const int MESSAGE_SIZE = 80;
 
 
+/*
+ * Messages are put into the ring of the calling thread unformatted: the
+ * format and copies of arguments. The writer thread formats and writes them
+ * by batches. Every call site may repeat the same text (the format with same
+ * arguments) `RATE_BURST` times per `RATE_WINDOW`, further repeats are
+ * counted and reported as suppressed. Messages with other text are never
+ * suppressed.
+ *
+ * Rings of exited threads are handed to new ones, the writer drains what is
+ * left in them meanwhile. Messages of threads over `MAX_THREADS` and of call
+ * sites over `MAX_SITES` are counted as dropped.
+ */
+
+#define MAX_ARGS      8
+#define STRINGS_SIZE  96
+#define MAX_THREADS   16
+#define MAX_SITES     256
+
+static const uint32_t RING_CAPACITY = 256;
+static const uint64_t WRITE_PERIOD  = 10;          // [ms]
+static const uint64_t RATE_WINDOW   = 1000000000;  // [ns]
+static const uint32_t RATE_BURST    = 5;
+
+
+typedef struct {
+  const char* file;
+  int line;
+  const char* func;
+  log_level_t level;
+  const char* format;
+
+  uint32_t hash;        // Of arguments of the last message.
+  uint64_t window;      // [ns], start of the current window.
+  uint32_t count;       // Emitted repeats in the current window.
+  uint32_t suppressed;  // Suppressed messages since the last report.
+} site_t;
+
+typedef union {
+  long long i;
+  double d;
+  const void* p;
+  size_t s;  // Offset of the copied string.
+} arg_t;
+
+typedef struct {
+  uint64_t stamp;  // [ns]
+  site_t* site;
+  uint32_t suppressed;
+  bool raw;        // The message is formatted already (into `strings`).
+  arg_t args[MAX_ARGS];
+  char strings[STRINGS_SIZE];
+} entry_t;
+
+
+static site_t sites[MAX_SITES];
+
+static spsc_t* rings[MAX_THREADS];
+static bool ring_owned[MAX_THREADS];  // By alive threads.
+static int ring_count;
+static uint32_t dropped;
+
+static __thread spsc_t* local_ring;
+static pthread_key_t ring_key;  // Releases the ring on the thread exit.
+
+static uv_once_t start_once = UV_ONCE_INIT;
+static uv_mutex_t rings_lock;
+static uv_mutex_t sites_lock;
+static uv_mutex_t write_lock;
+static uv_thread_t writer;
+
+
 static const char* level_str(log_level_t level) {
   switch (level) {
     case LOG_LEVEL_FATAL:   return "fatal";
@@ -42,35 +120,209 @@ static const char* level_str(log_level_t level) {
 }
 
 
-void* log__message(const char* file, int line, const char* func,
-                  log_level_t level, const char* format, ...) {
-  const int FULL_SIZE = PREFIX_SIZE + MESSAGE_SIZE + 1;
-  assert(file && func && format);
+/*
+ * Conversion specifications.
+ */
 
-  // Remove prefix 'embed/'.
-  assert(strncmp(file, "embed/", 6) == 0);
-  file += 6;
+typedef enum {
+  ARG_NONE, ARG_INT, ARG_LONG, ARG_LLONG, ARG_SIZE, ARG_INTMAX, ARG_PTRDIFF,
+  ARG_DOUBLE, ARG_STRING, ARG_POINTER, ARG_UNSUPPORTED
+} arg_kind_t;
 
-  va_list arg;
-  FILE* log_file = level & LOG_ERRMASK ? stderr : stdout;
+typedef struct {
+  const char* start;  // '%'
+  const char* end;    // After the conversion.
+  int stars;          // Number of '*' in the width and the precision.
+  arg_kind_t kind;
+} spec_t;
+
+
+static const char* parse_spec(const char* fmt, spec_t* spec) {
+  assert(*fmt == '%');
+  spec->start = fmt++;
+  spec->stars = 0;
+
+  while (*fmt && strchr("-+ #0'", *fmt)) ++fmt;
+
+  if (*fmt == '*') ++spec->stars, ++fmt;
+  while ('0' <= *fmt && *fmt <= '9') ++fmt;
+
+  if (*fmt == '.') {
+    ++fmt;
+    if (*fmt == '*') ++spec->stars, ++fmt;
+    while ('0' <= *fmt && *fmt <= '9') ++fmt;
+  }
+
+  arg_kind_t integer = ARG_INT;
+  bool bad_length = false;
+
+  if (fmt[0] == 'h' && fmt[1] == 'h') fmt += 2;
+  else if (fmt[0] == 'l' && fmt[1] == 'l') fmt += 2, integer = ARG_LLONG;
+  else if (*fmt == 'h') ++fmt;
+  else if (*fmt == 'l') ++fmt, integer = ARG_LONG;
+  else if (*fmt == 'q') ++fmt, integer = ARG_LLONG;
+  else if (*fmt == 'z') ++fmt, integer = ARG_SIZE;
+  else if (*fmt == 'j') ++fmt, integer = ARG_INTMAX;
+  else if (*fmt == 't') ++fmt, integer = ARG_PTRDIFF;
+  else if (*fmt == 'L') ++fmt, bad_length = true;
+
+  switch (*fmt) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+      spec->kind = bad_length ? ARG_UNSUPPORTED : integer; break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+    case 'a': case 'A':
+      spec->kind = bad_length ? ARG_UNSUPPORTED : ARG_DOUBLE; break;
+    case 's': spec->kind = integer == ARG_INT ? ARG_STRING
+                                              : ARG_UNSUPPORTED; break;
+    case 'p': spec->kind = ARG_POINTER; break;
+    case '%': spec->kind = ARG_NONE; break;
+
+    default:
+      spec->kind = ARG_UNSUPPORTED;
+      return fmt;
+  }
+
+  return spec->end = fmt + 1;
+}
+
+
+// Copy arguments, return false if the message must be formatted in place.
+static bool capture(entry_t* entry, const char* format, va_list arg) {
+  int argc = 0;
+  size_t used = 0;
+
+  for (const char* fmt = strchr(format, '%'); fmt; fmt = strchr(fmt, '%')) {
+    spec_t spec;
+    fmt = parse_spec(fmt, &spec);
+
+    if (spec.kind == ARG_UNSUPPORTED || argc + spec.stars >= MAX_ARGS)
+      return false;
+
+    for (int i = 0; i < spec.stars; ++i)
+      entry->args[argc++].i = va_arg(arg, int);
+
+    arg_t* dst = &entry->args[argc];
+
+    switch (spec.kind) {
+      case ARG_NONE: continue;
+      case ARG_INT: dst->i = va_arg(arg, int); break;
+      case ARG_LONG: dst->i = va_arg(arg, long); break;
+      case ARG_LLONG: dst->i = va_arg(arg, long long); break;
+      case ARG_SIZE: dst->i = va_arg(arg, size_t); break;
+      case ARG_INTMAX: dst->i = va_arg(arg, intmax_t); break;
+      case ARG_PTRDIFF: dst->i = va_arg(arg, ptrdiff_t); break;
+      case ARG_DOUBLE: dst->d = va_arg(arg, double); break;
+      case ARG_POINTER: dst->p = va_arg(arg, void*); break;
+
+      case ARG_STRING: {
+        const char* str = va_arg(arg, const char*);
+        if (!str) str = "(null)";
+
+        size_t len = strnlen(str, STRINGS_SIZE - 1 - used);
+        memcpy(entry->strings + used, str, len);
+        entry->strings[used + len] = '\0';
+        dst->s = used;
+        used += len + (used + len < STRINGS_SIZE - 1);
+        break;
+      }
+
+      case ARG_UNSUPPORTED:
+      default:
+        assert(0);
+    }
+
+    ++argc;
+  }
+
+  return true;
+}
+
+
+// Format the message using copied arguments.
+static int render(const entry_t* entry, char* out, int size) {
+  const char* format = entry->site->format;
+  const arg_t* args = entry->args;
+  int len = 0;
+
+  if (entry->raw)
+    return snprintf(out, size, "%s", entry->strings);
+
+  while (*format) {
+    const char* percent = strchr(format, '%');
+    int literal = percent ? percent - format : (int)strlen(format);
+
+    if (len < size) snprintf(out + len, size - len, "%.*s", literal, format);
+    len += literal;
+    if (!percent) break;
+
+    spec_t spec;
+    format = parse_spec(percent, &spec);
+
+    // Substitute '*' by values of the width and the precision.
+    char fmt[32];
+    unsigned fmt_len = 0;
+    for (const char* c = spec.start; c < spec.end && fmt_len < 20; ++c)
+      if (*c == '*')
+        fmt_len += snprintf(fmt + fmt_len, 12, "%d", (int)(args++)->i);
+      else
+        fmt[fmt_len++] = *c;
+    fmt[fmt_len] = '\0';
+
+    char* dst = len < size ? out + len : NULL;
+    int rest = len < size ? size - len : 0;
+
+    switch (spec.kind) {
+      case ARG_NONE: len += snprintf(dst, rest, "%%"); continue;
+      case ARG_INT: len += snprintf(dst, rest, fmt, (int)args->i); break;
+      case ARG_LONG: len += snprintf(dst, rest, fmt, (long)args->i); break;
+      case ARG_LLONG: len += snprintf(dst, rest, fmt, args->i); break;
+      case ARG_SIZE: len += snprintf(dst, rest, fmt, (size_t)args->i); break;
+      case ARG_INTMAX: len += snprintf(dst, rest, fmt, (intmax_t)args->i);
+                       break;
+      case ARG_PTRDIFF: len += snprintf(dst, rest, fmt, (ptrdiff_t)args->i);
+                        break;
+      case ARG_DOUBLE: len += snprintf(dst, rest, fmt, args->d); break;
+      case ARG_POINTER: len += snprintf(dst, rest, fmt, args->p); break;
+      case ARG_STRING: len += snprintf(dst, rest, fmt,
+                                       entry->strings + args->s); break;
+
+      case ARG_UNSUPPORTED:
+      default:
+        assert(0);
+    }
+
+    ++args;
+  }
+
+  return len;
+}
+
+
+/*
+ * Writing.
+ */
+
+static void write_line(const site_t* site, uint64_t stamp, const char* text,
+                       int offset) {
+  const int FULL_SIZE = PREFIX_SIZE + MESSAGE_SIZE + 1;
+  FILE* log_file = site->level & LOG_ERRMASK ? stderr : stdout;
 
   char message[FULL_SIZE];
-  int timestamp = uv_now(uv_default_loop()) % 1000000;
-  int offset = snprintf(message, PREFIX_SIZE, "%6d %s:%d (%s)",
-                        timestamp, file, line, func);
+  int timestamp = stamp/1000000 % 1000000;
+  int prefix = snprintf(message, PREFIX_SIZE, "%6d %s:%d (%s)",
+                        timestamp, site->file, site->line, site->func);
 
-  if (offset > PREFIX_SIZE-10) {
+  if (prefix > PREFIX_SIZE-10) {
     message[PREFIX_SIZE-10] = ' ';
     memset(message + PREFIX_SIZE-13, '.', 3);
   } else {
-    memset(message + offset, ' ', PREFIX_SIZE-6 - offset);
+    memset(message + prefix, ' ', PREFIX_SIZE-6 - prefix);
   }
 
-  snprintf(message + PREFIX_SIZE-9, MESSAGE_SIZE+10, "%7s> ", level_str(level));
-
-  va_start(arg, format);
-  offset = vsnprintf(message + PREFIX_SIZE, MESSAGE_SIZE+1, format, arg);
-  va_end(arg);
+  snprintf(message + PREFIX_SIZE-9, MESSAGE_SIZE+10, "%7s> ",
+           level_str(site->level));
+  memcpy(message + PREFIX_SIZE, text,
+         offset < MESSAGE_SIZE ? offset : MESSAGE_SIZE);
 
   if (offset > MESSAGE_SIZE) {
     memset(message + FULL_SIZE - 4, '.', 3);
@@ -80,13 +332,283 @@ void* log__message(const char* file, int line, const char* func,
     message[PREFIX_SIZE + offset] = '\n';
     fwrite(message, 1, PREFIX_SIZE + offset + 1, log_file);
   }
+}
+
+
+static void write_entry(const entry_t* entry) {
+  char text[MESSAGE_SIZE + 2];
+  int offset = render(entry, text, sizeof(text));
+
+  if (entry->suppressed && offset < MESSAGE_SIZE)
+    offset += snprintf(text + offset, sizeof(text) - offset,
+                       " (suppressed %u times)", entry->suppressed);
+
+  write_line(entry->site, entry->stamp, text, offset);
+}
+
+
+// Report call sites which have been silent since the suppression, all ones
+// if it's the last report.
+static void write_suppressed(uint64_t now, bool last) {
+  for (int i = 0; i < MAX_SITES; ++i) {
+    site_t* site = &sites[i];
+    if (!__atomic_load_n(&site->format, __ATOMIC_ACQUIRE)) continue;
+    if (!__atomic_load_n(&site->suppressed, __ATOMIC_RELAXED)) continue;
+    if (!last &&
+        now - __atomic_load_n(&site->window, __ATOMIC_RELAXED) < RATE_WINDOW)
+      continue;
+
+    uint32_t count = __atomic_exchange_n(&site->suppressed, 0,
+                                         __ATOMIC_RELAXED);
+    if (!count) continue;
+
+    char text[MESSAGE_SIZE + 2];
+    int offset = snprintf(text, sizeof(text), "Suppressed %u times.", count);
+    write_line(site, now, text, offset);
+  }
+}
+
+
+static void flush(bool last) {
+  entry_t entry;
+  uint64_t span = trace_begin();
+
+  uv_mutex_lock(&write_lock);
+
+  int count = __atomic_load_n(&ring_count, __ATOMIC_ACQUIRE);
+  int written = 0;
+
+  for (int i = 0; i < count; ++i)
+    for (; spsc_pop(rings[i], &entry); ++written)
+      write_entry(&entry);
+
+  uint32_t lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+  if (lost)
+    fprintf(stderr, "logging: %u messages are dropped.\n", lost);
+
+  write_suppressed(uv_hrtime(), last);
+
+  fflush(stdout);
+  fflush(stderr);
+
+  uv_mutex_unlock(&write_lock);
+
+  // Idle flushes would clutter the timeline.
+  if (written > 0) trace_end(span, "log_flush", NULL);
+}
+
+
+static void write_loop(void* arg) {
+  const struct timespec period = {0, WRITE_PERIOD * 1000000};
+
+  for (;;) {
+    nanosleep(&period, NULL);
+    flush(false);
+  }
+}
+
+
+static void finish(void) {
+  flush(true);
+}
+
+
+static void release_ring(void* ring) {
+  uv_mutex_lock(&rings_lock);
+
+  for (int i = 0; i < ring_count; ++i)
+    if (rings[i] == ring) ring_owned[i] = false;
+
+  uv_mutex_unlock(&rings_lock);
+}
+
+
+static void start(void) {
+  if (pthread_key_create(&ring_key, release_ring)) {
+    fprintf(stderr, "logging: cannot create the key of rings.\n");
+    abort();
+  }
+
+  uv_mutex_init(&rings_lock);
+  uv_mutex_init(&sites_lock);
+  uv_mutex_init(&write_lock);
+  atexit(finish);
+
+  if (uv_thread_create(&writer, write_loop, NULL) < 0) {
+    fprintf(stderr, "logging: cannot start the writer thread.\n");
+    abort();
+  }
+}
+
+
+// Reuse the ring of the exited thread or allocate the new one, NULL if
+// threads are over the limit.
+static spsc_t* acquire_ring(void) {
+  spsc_t* ring = NULL;
+  uv_mutex_lock(&rings_lock);
+
+  for (int i = 0; i < ring_count && !ring; ++i)
+    if (!ring_owned[i]) {
+      ring_owned[i] = true;
+      ring = rings[i];
+    }
+
+  if (!ring && ring_count < MAX_THREADS) {
+    ring = malloc(sizeof(spsc_t));
+
+    if (ring && spsc_init(ring, sizeof(entry_t), RING_CAPACITY)) {
+      rings[ring_count] = ring;
+      ring_owned[ring_count] = true;
+      __atomic_store_n(&ring_count, ring_count + 1, __ATOMIC_RELEASE);
+    } else {
+      free(ring);
+      ring = NULL;
+    }
+  }
+
+  uv_mutex_unlock(&rings_lock);
+
+  if (ring) pthread_setspecific(ring_key, ring);
+  return ring;
+}
+
+
+/*
+ * Call sites.
+ */
+
+static site_t* find_site(const char* file, int line, const char* func,
+                         log_level_t level, const char* format) {
+  uintptr_t hash = (uintptr_t)format ^ (uintptr_t)line * 2654435761u;
+
+  for (int probe = 0; probe < MAX_SITES; ++probe) {
+    site_t* site = &sites[(hash + probe) % MAX_SITES];
+    const char* key = __atomic_load_n(&site->format, __ATOMIC_ACQUIRE);
+
+    if (!key) {
+      // Claim the slot, fields are published by the release of `format`.
+      uv_mutex_lock(&sites_lock);
+
+      if (!(key = site->format)) {
+        site->file = file;
+        site->line = line;
+        site->func = func;
+        site->level = level;
+        __atomic_store_n(&site->format, format, __ATOMIC_RELEASE);
+        key = format;
+      }
+
+      uv_mutex_unlock(&sites_lock);
+    }
+
+    if (key == format && site->line == line && site->file == file)
+      return site;
+  }
+
+  return NULL;
+}
+
+
+// FNV-1a of copied arguments (or the formatted text), unused ones are zeros.
+static uint32_t hash_args(const entry_t* entry) {
+  const uint8_t* bytes = (const uint8_t*)entry->args;
+  uint32_t hash = 2166136261u;
+
+  for (size_t i = 0; i < sizeof(entry->args); ++i)
+    hash = (hash ^ bytes[i]) * 16777619u;
+
+  for (size_t i = 0; i < sizeof(entry->strings); ++i)
+    hash = (hash ^ (uint8_t)entry->strings[i]) * 16777619u;
+
+  return hash;
+}
+
+
+// Check the rate limit, return the number of suppressed repeats to report
+// or -1 if the message must be suppressed. Repeats suppressed before the
+// other text are left to `write_suppressed()`.
+static int64_t limit_rate(site_t* site, uint32_t hash, uint64_t now) {
+  uint32_t last = __atomic_exchange_n(&site->hash, hash, __ATOMIC_RELAXED);
+  uint64_t window = __atomic_load_n(&site->window, __ATOMIC_RELAXED);
+
+  if (hash != last || now - window >= RATE_WINDOW) {
+    __atomic_store_n(&site->window, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->count, 1, __ATOMIC_RELAXED);
+    return hash != last ? 0 : __atomic_exchange_n(&site->suppressed, 0,
+                                                  __ATOMIC_RELAXED);
+  }
+
+  if (__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) <= RATE_BURST)
+    return 0;
+
+  __atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+  return -1;
+}
+
+
+void* log__message(const char* file, int line, const char* func,
+                  log_level_t level, const char* format, ...) {
+  assert(file && func && format);
+
+  // Remove prefix 'embed/'.
+  assert(strncmp(file, "embed/", 6) == 0);
+  file += 6;
+
+  uv_once(&start_once, start);
+  if (!local_ring) local_ring = acquire_ring();
+
+  uint64_t now = uv_hrtime();
+  site_t* site = find_site(file, line, func, level, format);
+
+  if (!site) {
+    __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+    if (level != LOG_LEVEL_FATAL) return NULL;
+
+    flush(true);
+    fprintf(stderr, "%s:%d (%s) fatal> %s\n", file, line, func, format);
+    abort();
+  }
+
+  // Zeros of unused arguments are hashed too.
+  entry_t entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.stamp = now;
+  entry.site = site;
 
-#ifdef NDEBUG
-  if (level & LOG_ERRMASK)
-#endif
-    fflush(stdout);
+  va_list arg;
+  va_start(arg, format);
+  entry.raw = !capture(&entry, format, arg);
+  va_end(arg);
+
+  if (entry.raw) {
+    va_start(arg, format);
+    vsnprintf(entry.strings, STRINGS_SIZE, format, arg);
+    va_end(arg);
+  }
+
+  if (level != LOG_LEVEL_FATAL) {
+    int64_t suppressed = limit_rate(site, hash_args(&entry), now);
+    if (suppressed < 0) return NULL;
+    entry.suppressed = suppressed;
+  }
+
+  bool queued = local_ring && spsc_push(local_ring, &entry);
+
+  if (level == LOG_LEVEL_FATAL) {
+    flush(true);
+
+    // The fatal message is never lost.
+    if (!queued) {
+      uv_mutex_lock(&write_lock);
+      write_entry(&entry);
+      fflush(stderr);
+      uv_mutex_unlock(&write_lock);
+    }
+
+    abort();
+  }
 
-  if (level == LOG_LEVEL_FATAL) abort();
+  if (!queued) __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
 
   return NULL;
 }
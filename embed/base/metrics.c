@@ -0,0 +1,175 @@
+#include "base/metrics.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <uv.h>
+
+
+#define SUB_BITS 4
+#define SUB_COUNT (1 << SUB_BITS)
+
+
+// Metrics are registered from the threadpool and listed by the loop.
+static metric_t registry = {"", false, &registry, &registry};
+static uv_mutex_t lock;
+static uv_once_t once = UV_ONCE_INIT;
+
+
+static void init_lock(void) {
+  uv_mutex_init(&lock);
+}
+
+
+static void add(metric_t* metric, bool histogram, const char* format,
+                va_list args) {
+  vsnprintf(metric->name, sizeof(metric->name), format, args);
+  metric->histogram = histogram;
+
+  uv_once(&once, init_lock);
+  uv_mutex_lock(&lock);
+  metric->prev = registry.prev;
+  metric->next = &registry;
+  registry.prev->next = metric;
+  registry.prev = metric;
+  uv_mutex_unlock(&lock);
+}
+
+
+static void remove_metric(metric_t* metric) {
+  uv_mutex_lock(&lock);
+  metric->prev->next = metric->next;
+  metric->next->prev = metric->prev;
+  uv_mutex_unlock(&lock);
+}
+
+
+static uint32_t upper_bound(int bucket) {
+  if (bucket < SUB_COUNT) return bucket;
+
+  int exp = bucket / SUB_COUNT + SUB_BITS - 1;
+  uint32_t width = 1u << (exp - SUB_BITS);
+  return (SUB_COUNT + bucket % SUB_COUNT) * width + (width - 1);
+}
+
+
+void histogram_register(histogram_t* hist, const char* format, ...) {
+  assert(hist && format);
+  memset(hist, 0, sizeof(*hist));
+
+  va_list args;
+  va_start(args, format);
+  add(&hist->metric, true, format, args);
+  va_end(args);
+}
+
+
+void histogram_unregister(histogram_t* hist) {
+  assert(hist);
+  remove_metric(&hist->metric);
+}
+
+
+#ifndef NMETRICS
+static int bucket_of(uint32_t value) {
+  if (value < SUB_COUNT) return value;
+
+  int exp = 31 - __builtin_clz(value);
+  int sub = (value >> (exp - SUB_BITS)) & (SUB_COUNT - 1);
+  return (exp - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+
+void histogram_record(histogram_t* hist, uint64_t value) {
+  uint32_t clamped = value < UINT32_MAX ? value : UINT32_MAX;
+
+  __atomic_add_fetch(&hist->buckets[bucket_of(clamped)], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&hist->count, 1, __ATOMIC_RELAXED);
+
+  uint32_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+  while (clamped > max && !__atomic_compare_exchange_n(&hist->max, &max,
+                                                       clamped, true,
+                                                       __ATOMIC_RELAXED,
+                                                       __ATOMIC_RELAXED));
+}
+#endif
+
+
+uint32_t histogram_quantile(const histogram_t* hist, double p) {
+  assert(hist);
+  assert(0 <= p && p <= 1);
+
+  uint32_t count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+  uint32_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+  if (count == 0) return 0;
+
+  uint64_t rank = p * count + 0.5;
+  uint64_t seen = 0;
+
+  for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+    seen += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+    if (seen >= rank && seen > 0) {
+      uint32_t bound = upper_bound(i);
+      return bound < max ? bound : max;
+    }
+  }
+
+  return max;
+}
+
+
+void counter_register(counter_t* counter, const char* format, ...) {
+  assert(counter && format);
+  counter->value = 0;
+
+  va_list args;
+  va_start(args, format);
+  add(&counter->metric, false, format, args);
+  va_end(args);
+}
+
+
+void counter_unregister(counter_t* counter) {
+  assert(counter);
+  remove_metric(&counter->metric);
+}
+
+
+#ifndef NMETRICS
+void counter_add(counter_t* counter, uint32_t value) {
+  __atomic_add_fetch(&counter->value, value, __ATOMIC_RELAXED);
+}
+
+
+uint64_t metrics_now(void) {
+  return uv_hrtime();
+}
+#endif
+
+
+void metrics_write(FILE* file) {
+  assert(file);
+
+  uv_once(&once, init_lock);
+  uv_mutex_lock(&lock);
+
+  for (metric_t* m = registry.next; m != &registry; m = m->next) {
+    if (m->histogram) {
+      const histogram_t* hist = (const histogram_t*)m;
+      fprintf(file, "%s count=%u p50=%u p90=%u p99=%u p999=%u max=%u\n",
+              m->name, __atomic_load_n(&hist->count, __ATOMIC_RELAXED),
+              histogram_quantile(hist, 0.5), histogram_quantile(hist, 0.9),
+              histogram_quantile(hist, 0.99), histogram_quantile(hist, 0.999),
+              __atomic_load_n(&hist->max, __ATOMIC_RELAXED));
+    } else {
+      const counter_t* counter = (const counter_t*)m;
+      fprintf(file, "%s %u\n",
+              m->name, __atomic_load_n(&counter->value, __ATOMIC_RELAXED));
+    }
+  }
+
+  uv_mutex_unlock(&lock);
+}
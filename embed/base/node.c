@@ -2,23 +2,289 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
 
+#include "base/config.h"
 #include "base/logging.h"
 #include "base/pubsub.h"
+#include "base/trace.h"
 
 
-bool node_init(node_t* node) {
-  assert(node && node->init);
-  assert(!node->active);
+// Bounds of the registry are defined by the linker, weak ones are NULL if
+// no node is linked.
+extern node_t* const __start_nodes[] __attribute__((weak));
+extern node_t* const __stop_nodes[] __attribute__((weak));
 
-  if (node->init()) {
-    log_info("Initialization of %s is done.", node->name);
-    node->active = true;
-    return true;
-  } else {
+
+typedef struct {
+  node_t* node;
+  uv_work_t work;
+  bool probed;  // The probe has succeeded.
+  bool sorted;  // Checked for cycles.
+  int waiting;  // For the probe and inits of preceding nodes.
+} slot_t;
+
+static slot_t* slots;   // Of enabled nodes.
+static int count;
+static bool* before;    // [i*count + j]: the node i is initialized before j.
+static node_t** order;  // Of initialization.
+static int initialized;
+static int probing;
+static bool failed;
+static uint64_t started;  // [ns]
+static void (*done)(bool ok);
+
+
+static int find(const char* name) {
+  for (int i = 0; i < count; ++i)
+    if (strcmp(slots[i].node->name, name) == 0)
+      return i;
+
+  return -1;
+}
+
+
+static bool enabled(const node_t* node) {
+  char key[64];
+  snprintf(key, sizeof(key), "nodes:%s", node->name);
+  return cfg_bool(key);
+}
+
+
+static bool publishes(const node_t* node, const event_t* ev) {
+  for (event_t* const* it = node->publishes; it && *it; ++it)
+    if (*it == ev) return true;
+
+  return false;
+}
+
+
+// The graph is acyclic here.
+static bool reaches(int from, int to) {
+  if (before[from*count + to]) return true;
+
+  for (int k = 0; k < count; ++k)
+    if (before[from*count + k] && reaches(k, to))
+      return true;
+
+  return false;
+}
+
+
+static bool link_deps(void) {
+  for (int i = 0; i < count; ++i) {
+    const node_t* node = slots[i].node;
+
+    for (const char* const* dep = node->deps; dep && *dep; ++dep) {
+      int j = find(*dep);
+
+      if (j < 0)
+        return log_error("%s depends on %s, which isn't enabled.",
+                         node->name, *dep);
+      if (j == i)
+        return log_error("%s depends on itself.", node->name);
+
+      before[j*count + i] = true;
+    }
+  }
+
+  return true;
+}
+
+
+// Kahn's algorithm, counters of waiting are left zeroed.
+static bool check_cycles(void) {
+  int left = count;
+
+  for (int i = 0; i < count; ++i)
+    for (int j = 0; j < count; ++j)
+      slots[j].waiting += before[i*count + j];
+
+  for (bool progress = true; progress;) {
+    progress = false;
+
+    for (int i = 0; i < count; ++i) {
+      if (slots[i].sorted || slots[i].waiting > 0) continue;
+
+      for (int j = 0; j < count; ++j)
+        slots[j].waiting -= before[i*count + j];
+
+      slots[i].sorted = progress = true;
+      --left;
+    }
+  }
+
+  if (left == 0) return true;
+
+  int cyclic = 0;
+  while (slots[cyclic].sorted) ++cyclic;
+
+  return log_error("Dependencies of %s are cyclic.", slots[cyclic].node->name);
+}
+
+
+// Consumers go before publishers unless they depend on them.
+static void link_events(void) {
+  for (int i = 0; i < count; ++i) {
+    const node_t* node = slots[i].node;
+
+    for (event_t* const* ev = node->consumes; ev && *ev; ++ev) {
+      bool published = false;
+
+      for (int j = 0; j < count; ++j) {
+        if (j == i || !publishes(slots[j].node, *ev)) continue;
+
+        published = true;
+        if (!reaches(j, i)) before[i*count + j] = true;
+      }
+
+      if (!published)
+        log_warning("%s consumes %s, which no enabled node publishes.",
+                    node->name, (*ev)->name);
+    }
+  }
+}
+
+
+static void finish(void) {
+  if (probing > 0 || !done) return;
+  if (!failed && initialized < count) return;
+
+  if (!failed)
+    log_info("Started %d nodes in %.1f ms.",
+             count, (uv_hrtime() - started)/1e6);
+
+  void (*cb)(bool ok) = done;
+  done = NULL;
+
+  free(slots);
+  free(before);
+  slots = NULL;
+  before = NULL;
+
+  cb(!failed);
+}
+
+
+static void init_node(slot_t* slot) {
+  node_t* node = slot->node;
+  if (failed || node->active) return;
+
+  uint64_t span = trace_begin();
+  bool ok = node->init();
+  trace_end(span, "init", node->name);
+
+  if (!ok) {
     log_error("Initialization of %s is failed.", node->name);
+    failed = true;
+    return;
+  }
+
+  log_info("Initialization of %s is done.", node->name);
+  node->active = true;
+  order[initialized++] = node;
+
+  int i = slot - slots;
+  for (int j = 0; j < count; ++j)
+    if (before[i*count + j] && --slots[j].waiting == 0)
+      init_node(&slots[j]);
+}
+
+
+static void run_probe(uv_work_t* work) {
+  slot_t* slot = work->data;
+
+  uint64_t span = trace_begin();
+  slot->probed = slot->node->probe();
+  trace_end(span, "probe", slot->node->name);
+}
+
+
+static void after_probe(uv_work_t* work, int status) {
+  slot_t* slot = work->data;
+  --probing;
+
+  if (status < 0 || !slot->probed) {
+    log_error("Probing of %s is failed.", slot->node->name);
+    failed = true;
+  } else if (--slot->waiting == 0) {
+    init_node(slot);
+  }
+
+  finish();
+}
+
+
+bool node_start_all(void (*cb)(bool ok)) {
+  assert(cb);
+  assert(!slots && !done);
+
+  int total = __stop_nodes - __start_nodes;
+  slots = calloc(total, sizeof(slot_t));
+  count = 0;
+
+  for (int i = 0; i < total; ++i)
+    if (enabled(__start_nodes[i])) {
+      assert(__start_nodes[i]->init);
+      slots[count++].node = __start_nodes[i];
+    }
+
+  before = calloc(count*count, sizeof(bool));
+  free(order);
+  order = calloc(count, sizeof(node_t*));
+  initialized = 0;
+  failed = false;
+
+  if (!(link_deps() && check_cycles())) {
+    free(slots);
+    free(before);
+    slots = NULL;
+    before = NULL;
     return false;
   }
+
+  link_events();
+
+  for (int i = 0; i < count; ++i) {
+    slots[i].waiting = slots[i].node->probe != NULL;
+    for (int j = 0; j < count; ++j)
+      slots[i].waiting += before[j*count + i];
+  }
+
+  done = cb;
+  started = uv_hrtime();
+
+  for (int i = 0; i < count; ++i) {
+    slot_t* slot = &slots[i];
+    if (!slot->node->probe) continue;
+
+    slot->work.data = slot;
+    if (uv_queue_work(uv_default_loop(), &slot->work, run_probe,
+                      after_probe) < 0) {
+      log_error("Cannot queue probing of %s.", slot->node->name);
+      failed = true;
+      break;
+    }
+
+    ++probing;
+  }
+
+  for (int i = 0; i < count && !failed; ++i)
+    if (slots[i].waiting == 0)
+      init_node(&slots[i]);
+
+  finish();
+  return true;
+}
+
+
+void node_term_all(void) {
+  while (initialized > 0)
+    node_term(order[--initialized]);
 }
 
 
@@ -26,6 +292,10 @@ void node_term(node_t* node) {
   assert(node);
   assert(node->active);
 
+  uint64_t span = trace_begin();
   if (node->term) node->term();
+  trace_end(span, "term", node->name);
+
+  node->active = false;
   log_info("%s is terminated.", node->name);
 }
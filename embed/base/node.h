@@ -5,17 +5,48 @@
 #include "base/pubsub.h"
 
 
+/*!
+ * Nodes are started in two stages. `probe` does the blocking work with devices
+ * and files on the threadpool, so probes of all nodes go concurrently. It must
+ * not touch the loop and must release what it has acquired on failure. `init`
+ * runs on the loop after the own probe and after inits of `deps` and of nodes
+ * consuming the published events, so no subscriber misses the first events.
+ * `term` undoes both stages and is called only for initialized nodes.
+ */
 typedef struct {
   const char* name;
-  bool active;
+  const char* const* deps;     //!< Names of nodes, NULL-terminated.
+  event_t* const* publishes;   //!< NULL-terminated.
+  event_t* const* consumes;    //!< NULL-terminated.
+  bool (*probe)(void);         //!< Optional, runs on the threadpool.
   bool (*init)(void);
   void (*term)(void);
+  bool active;
 } node_t;
 
 
-#define NODE_REGISTER(name, init, term)                                       \
-  node_t name = {#name, false, init, term}
+#define NODE_DEPS(...) ((const char* const[]){__VA_ARGS__, NULL})
+#define NODE_EVENTS(...) ((event_t* const[]){__VA_ARGS__, NULL})
+
+/*!
+ * Define the node and put it to the registry, the rest are fields, e.g.
+ * `NODE_REGISTER(baro, .probe = probe, .init = init, .term = term)`.
+ */
+#define NODE_REGISTER(node, ...)                                              \
+  node_t node = {.name = #node, __VA_ARGS__};                                 \
+  static node_t* const node##_entry                                           \
+    __attribute__((section("nodes"), used)) = &node
+
+
+/*!
+ * Start nodes enabled by "nodes:<name>". Returns false if the graph of nodes
+ * is invalid. Otherwise `cb` is called on the loop thread when all nodes are
+ * initialized or the startup has failed and no probe is running anymore.
+ * Probed, but not initialized nodes aren't terminated then.
+ */
+extern bool node_start_all(void (*cb)(bool ok));
 
+/*! Terminate initialized nodes in the reverse order. */
+extern void node_term_all(void);
 
-extern bool node_init(node_t* node);
 extern void node_term(node_t* node);
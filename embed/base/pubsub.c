@@ -1,72 +1,81 @@
 #include "base/pubsub.h"
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
-#include <string.h>
 
 #include "base/logging.h"
+#include "base/trace.h"
+
+
+static void compact(event_t* ev) {
+  int count = 0;
+
+  for (int i = 0; i < ev->count; ++i)
+    if (ev->subscribers[i].cb)
+      ev->subscribers[count++] = ev->subscribers[i];
+
+  ev->count = count;
+  ev->holes = false;
+}
 
 
 void publish(event_t* ev, void* data) {
   assert(ev && data);
 
-  if (!ev->subscriber) return;
-  for (; ev; ev = ev->next) {
-    assert(ev->subscriber);
-    ev->subscriber(data);
-  }
+  // Subscribers added by callbacks are skipped.
+  int count = ev->count;
+  subscriber_t* subscribers = ev->subscribers;
+
+  uint64_t span = trace_begin();
+  ++ev->depth;
+
+  for (int i = 0; i < count; ++i)
+    if (subscribers[i].cb)
+      subscribers[i].cb(subscribers[i].ctx, data);
+
+  trace_end(span, "publish", ev->name);
+
+  if (--ev->depth == 0 && ev->holes)
+    compact(ev);
 }
 
 
-void (subscribe)(event_t* ev, event_cb cb) {
+bool (subscribe)(event_t* ev, event_cb cb, void* ctx) {
   assert(ev && cb);
 
-  if (ev->subscriber) {
-    while (ev->next) ev = ev->next;
-    ev = ev->next = malloc(sizeof(event_t));
-  }
+  if (ev->count == EVENT_CAPACITY && ev->holes && ev->depth == 0)
+    compact(ev);
 
-  ev->subscriber = cb;
-  ev->next = NULL;
+  if (ev->count == EVENT_CAPACITY)
+    return log_error("Too many subscribers (%d) of %s.", EVENT_CAPACITY,
+                     ev->name);
+
+  ev->subscribers[ev->count++] = (subscriber_t){cb, ctx};
+  return true;
 }
 
 
-void (unsubscribe)(event_t* ev, event_cb cb) {
+void (unsubscribe)(event_t* ev, event_cb cb, void* ctx) {
   assert(ev && cb);
 
-  while (ev->subscriber == cb) {
-    if (ev->next) {
-      event_t* next = ev->next;
-      ev->subscriber = next->subscriber;
-      ev->next = next->next;
-      free(next);
-    } else {
-      ev->subscriber = NULL;
-    }
-  }
-
-  event_t* prev = ev;
-  while ((ev = ev->next)) {
-    assert(ev->subscriber);
-    if (ev->subscriber == cb) {
-      prev->next = ev->next;
-      free(ev);
-      ev = prev;
-    } else {
-      prev = ev;
+  for (int i = 0; i < ev->count; ++i)
+    if (ev->subscribers[i].cb == cb && ev->subscribers[i].ctx == ctx) {
+      ev->subscribers[i].cb = NULL;
+      ev->holes = true;
     }
-  }
+
+  if (ev->depth == 0 && ev->holes)
+    compact(ev);
 }
 
 
 void unsubscribe_all(event_t* ev) {
   assert(ev);
-  event_t* next;
 
-  while ((next = ev->next)) {
-    ev->next = next->next;
-    free(next);
-  }
+  for (int i = 0; i < ev->count; ++i)
+    ev->subscribers[i].cb = NULL;
 
-  ev->subscriber = NULL;
+  ev->holes = ev->count > 0;
+  if (ev->depth == 0) compact(ev);
 }
@@ -1,22 +1,44 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdlib.h>
 
 
-typedef void (*event_cb)(void* data);
+/*! The maximal number of subscribers of an event. */
+#ifndef EVENT_CAPACITY
+# define EVENT_CAPACITY 8
+#endif
 
-typedef struct event_node_s {
-  event_cb subscriber;
-  struct event_node_s* next;
+
+typedef void (*event_cb)(void* ctx, void* data);
+
+typedef struct {
+  event_cb cb;
+  void* ctx;
+} subscriber_t;
+
+/*!
+ * Subscribers are stored contiguously, so dispatching doesn't touch the heap.
+ * (Un)subscribing is allowed inside callbacks: new subscribers are called
+ * since the next publishing, removed ones aren't called anymore.
+ */
+typedef struct {
+  const char* name;  //!< The detail of spans of dispatching.
+  int count;
+  int depth;   //!< Level of nested dispatching.
+  bool holes;  //!< Subscribers were removed while dispatching.
+  subscriber_t subscribers[EVENT_CAPACITY];
 } event_t;
 
-#define EVENT_INIT {NULL, NULL}
+#define EVENT_INIT(name) {name, 0, 0, false, {{NULL, NULL}}}
 
 
 extern void publish(event_t* ev, void* data);
-extern void subscribe(event_t* ev, event_cb cb);
-extern void unsubscribe(event_t* ev, event_cb cb);
+
+/*! Add the callback, which is called with `ctx` as the first argument. */
+extern bool subscribe(event_t* ev, event_cb cb, void* ctx);
+extern void unsubscribe(event_t* ev, event_cb cb, void* ctx);
 extern void unsubscribe_all(event_t* ev);
 
-#define subscribe(ev, cb) subscribe(ev, (event_cb)cb)
-#define unsubscribe(ev, cb) unsubscribe(ev, (event_cb)cb)
+#define subscribe(ev, cb, ctx) subscribe(ev, (event_cb)cb, ctx)
+#define unsubscribe(ev, cb, ctx) unsubscribe(ev, (event_cb)cb, ctx)
@@ -0,0 +1,258 @@
+#include "base/shm_channel.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static const char MAGIC[8] = "T6SHMCHN";
+static const uint32_t VERSION = 1;
+
+// Slots take whole cache lines, so readers don't share lines with the slot
+// being written.
+#define LINE 64
+
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t size;      // Of the sample.
+  uint32_t capacity;
+  uint32_t stride;    // Size of the slot.
+  char pad0[LINE - 24];
+  uint32_t head;      // Number of written samples, accessed atomically.
+  char pad1[LINE - sizeof(uint32_t)];
+} header_t;
+
+typedef struct {
+  uint32_t lock;    // Odd while the slot is written, accessed atomically.
+  uint32_t number;
+  uint64_t stamp;
+  char data[];
+} slot_t;
+
+
+struct shm_channel_s {
+  bool writable;
+  char* path;
+  size_t mapped;
+  header_t* header;
+  char* slots;
+  uint32_t mask;
+  uint32_t next;  // The next sample to read.
+};
+
+
+static slot_t* get_slot(const shm_channel_t* ch, uint32_t number) {
+  return (slot_t*)(void*)(ch->slots + (number & ch->mask)
+                          * (size_t)ch->header->stride);
+}
+
+
+static shm_channel_t* map(const char* path, int fd, size_t size,
+                          bool writable) {
+  int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  void* addr = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) return NULL;
+
+  shm_channel_t* ch = calloc(1, sizeof(shm_channel_t));
+  ch->writable = writable;
+  ch->path = strdup(path);
+  ch->mapped = size;
+  ch->header = addr;
+  ch->slots = (char*)addr + sizeof(header_t);
+  return ch;
+}
+
+
+shm_channel_t* shm_channel_create(const char* path, size_t size,
+                                  uint32_t capacity) {
+  assert(path);
+  assert(size > 0);
+  assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+
+  uint32_t stride = (sizeof(slot_t) + size + LINE-1) / LINE * LINE;
+  size_t total = sizeof(header_t) + (size_t)stride * capacity;
+
+  // Readers of the previous channel keep the old file.
+  unlink(path);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) return NULL;
+
+  shm_channel_t* ch = NULL;
+  if (ftruncate(fd, total) == 0)
+    ch = map(path, fd, total, true);
+
+  int err = errno;
+  close(fd);
+
+  if (!ch) {
+    unlink(path);
+    errno = err;
+    return NULL;
+  }
+
+  header_t* header = ch->header;
+  header->version = VERSION;
+  header->size = size;
+  header->capacity = capacity;
+  header->stride = stride;
+  ch->mask = capacity - 1;
+
+  // Readers check the magic, so it's published last.
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(header->magic, MAGIC, sizeof(MAGIC));
+
+  return ch;
+}
+
+
+void shm_channel_write(shm_channel_t* ch, const void* data, uint64_t stamp) {
+  assert(ch && ch->writable && data);
+
+  uint32_t number = ch->header->head;
+  slot_t* slot = get_slot(ch, number);
+  uint32_t lock = slot->lock;
+
+  __atomic_store_n(&slot->lock, lock + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  slot->number = number;
+  slot->stamp = stamp;
+  memcpy(slot->data, data, ch->header->size);
+
+  __atomic_store_n(&slot->lock, lock + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&ch->header->head, number + 1, __ATOMIC_RELEASE);
+}
+
+
+shm_channel_t* shm_channel_open(const char* path, size_t size) {
+  assert(path);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+
+  struct stat st;
+  shm_channel_t* ch = NULL;
+
+  if (fstat(fd, &st) < 0)
+    goto done;
+
+  if ((size_t)st.st_size < sizeof(header_t)) {
+    errno = EPROTO;
+    goto done;
+  }
+
+  if (!(ch = map(path, fd, st.st_size, false)))
+    goto done;
+
+  const header_t* header = ch->header;
+  bool valid = memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0
+            && header->version == VERSION
+            && header->size == size
+            && header->capacity >= 2
+            && (header->capacity & (header->capacity - 1)) == 0
+            && header->stride >= sizeof(slot_t) + size
+            && sizeof(header_t) + (size_t)header->stride * header->capacity
+               <= (size_t)st.st_size;
+
+  if (!valid) {
+    shm_channel_close(ch);
+    ch = NULL;
+    errno = EPROTO;
+    goto done;
+  }
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  ch->mask = header->capacity - 1;
+  ch->next = __atomic_load_n(&ch->header->head, __ATOMIC_ACQUIRE);
+
+done:
+  close(fd);
+  return ch;
+}
+
+
+// Copy the sample, fail if it's overwritten meanwhile.
+static bool read_slot(shm_channel_t* ch, uint32_t number, void* data,
+                      shm_meta_t* meta) {
+  slot_t* slot = get_slot(ch, number);
+  uint32_t lock = __atomic_load_n(&slot->lock, __ATOMIC_ACQUIRE);
+  if (lock & 1) return false;
+
+  uint32_t read_number = slot->number;
+  meta->stamp = slot->stamp;
+  memcpy(data, slot->data, ch->header->size);
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&slot->lock, __ATOMIC_RELAXED) == lock
+      && read_number == number;
+}
+
+
+bool shm_channel_latest(shm_channel_t* ch, void* data, shm_meta_t* meta) {
+  assert(ch && !ch->writable && data && meta);
+
+  for (;;) {
+    uint32_t head = __atomic_load_n(&ch->header->head, __ATOMIC_ACQUIRE);
+    if (head == 0) return false;
+
+    uint32_t number = head - 1;
+    if (!read_slot(ch, number, data, meta)) continue;
+
+    meta->number = number;
+    meta->lost = (int32_t)(number - ch->next) > 0 ? number - ch->next : 0;
+    ch->next = head;
+    return true;
+  }
+}
+
+
+bool shm_channel_next(shm_channel_t* ch, void* data, shm_meta_t* meta) {
+  assert(ch && !ch->writable && data && meta);
+
+  uint32_t capacity = ch->mask + 1;
+  uint32_t skipped = 0;
+
+  for (;;) {
+    uint32_t head = __atomic_load_n(&ch->header->head, __ATOMIC_ACQUIRE);
+    if (head == ch->next) return false;
+
+    // The oldest samples are being overwritten, so the one after them is
+    // taken.
+    if (head - ch->next >= capacity) {
+      uint32_t oldest = head - capacity + 1;
+      skipped += oldest - ch->next;
+      ch->next = oldest;
+    }
+
+    if (!read_slot(ch, ch->next, data, meta)) {
+      ++skipped;
+      ++ch->next;
+      continue;
+    }
+
+    meta->number = ch->next++;
+    meta->lost = skipped;
+    return true;
+  }
+}
+
+
+void shm_channel_close(shm_channel_t* ch) {
+  assert(ch);
+
+  munmap(ch->header, ch->mapped);
+  if (ch->writable) unlink(ch->path);
+
+  free(ch->path);
+  free(ch);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*!
+ * The channel is the ring of samples in the shared memory file (e.g. in
+ * /dev/shm), so samples reach other processes without syscalls and copies
+ * through the kernel. The only writer never waits readers: every slot is
+ * protected by the seqlock, readers retry torn reads and skip samples which
+ * are overwritten before they are read. Samples are numbered and stamped.
+ *
+ * The module depends on libc only, readers build it along with their code:
+ *   cc -iquote embed reader.c embed/base/shm_channel.c
+ * and poll the channel, waiting isn't provided.
+ */
+typedef struct shm_channel_s shm_channel_t;
+
+typedef struct {
+  uint32_t number;  //!< Of the sample, from 0 (wraps around).
+  uint32_t lost;    //!< Samples skipped since the previous read.
+  uint64_t stamp;   //!< Time of the sample [ns] (`CLOCK_MONOTONIC`).
+} shm_meta_t;
+
+
+/*!
+ * Create (or replace) the channel, errno is set on failure.
+ * @param size      size of the sample
+ * @param capacity  number of slots, a power of two, at least 2
+ */
+extern shm_channel_t* shm_channel_create(const char* path, size_t size,
+                                         uint32_t capacity);
+
+/*! Publish the sample. Writer only. */
+extern void shm_channel_write(shm_channel_t* ch, const void* data,
+                              uint64_t stamp);
+
+/*!
+ * Open the channel for reading, errno is set on failure (`EPROTO` if it has
+ * another format or `size` of samples). Reading starts from new samples.
+ */
+extern shm_channel_t* shm_channel_open(const char* path, size_t size);
+
+/*! Read the newest sample, fail if nothing is written yet. Reader only. */
+extern bool shm_channel_latest(shm_channel_t* ch, void* data,
+                               shm_meta_t* meta);
+
+/*! Read the next unread sample, fail if there is no one. Reader only. */
+extern bool shm_channel_next(shm_channel_t* ch, void* data, shm_meta_t* meta);
+
+/*! Unmap the channel, the writer also removes the file. */
+extern void shm_channel_close(shm_channel_t* ch);
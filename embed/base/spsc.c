@@ -0,0 +1,56 @@
+#include "base/spsc.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+bool spsc_init(spsc_t* ring, size_t size, uint32_t capacity) {
+  assert(ring);
+  assert(size > 0);
+  assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+  if (!(ring->data = malloc(size * capacity)))
+    return false;
+
+  ring->head = ring->tail = 0;
+  ring->mask = capacity - 1;
+  ring->size = size;
+
+  return true;
+}
+
+
+bool spsc_push(spsc_t* ring, const void* elem) {
+  uint32_t head = ring->head;
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+  if (head - tail > ring->mask) return false;
+
+  memcpy(ring->data + (head & ring->mask) * ring->size, elem, ring->size);
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+
+bool spsc_pop(spsc_t* ring, void* elem) {
+  uint32_t tail = ring->tail;
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+  if (head == tail) return false;
+
+  memcpy(elem, ring->data + (tail & ring->mask) * ring->size, ring->size);
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+
+void spsc_free(spsc_t* ring) {
+  assert(ring);
+  free(ring->data);
+  ring->data = NULL;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*!
+ * Lock-free ring buffer for a single producer and a single consumer thread.
+ * Elements are copied in and out, the capacity is a power of two.
+ */
+typedef struct {
+  uint32_t head;  //!< Written by the producer only.
+  char pad0[64 - sizeof(uint32_t)];
+  uint32_t tail;  //!< Written by the consumer only.
+  char pad1[64 - sizeof(uint32_t)];
+
+  uint32_t mask;
+  size_t size;
+  char* data;
+} spsc_t;
+
+
+/*!
+ * Allocate the ring.
+ * @param size      size of the element
+ * @param capacity  maximal number of elements, must be a power of two
+ */
+extern bool spsc_init(spsc_t* ring, size_t size, uint32_t capacity);
+
+/*! Copy the element to the ring, fail if it's full. Producer only. */
+extern bool spsc_push(spsc_t* ring, const void* elem);
+
+/*!
+ * Copy the oldest element out of the ring, fail if it's empty.
+ * Consumer only.
+ */
+extern bool spsc_pop(spsc_t* ring, void* elem);
+
+extern void spsc_free(spsc_t* ring);
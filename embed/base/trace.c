@@ -0,0 +1,214 @@
+#include "base/trace.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <uv.h>
+
+#include "base/logging.h"
+#include "base/spsc.h"
+
+
+#define DETAIL_SIZE  24
+#define MAX_THREADS  32
+
+static const uint32_t RING_CAPACITY = 4096;
+static const uint64_t WRITE_PERIOD  = 50;  // [ms]
+
+
+typedef struct {
+  const char* name;
+  uint64_t start;     // [ns]
+  uint32_t duration;  // [ns]
+  char detail[DETAIL_SIZE];
+} span_t;
+
+
+bool trace__enabled;
+
+static FILE* file;
+static const char* path;
+static uint64_t origin;   // [ns]
+static bool separated;    // Spans are preceded by the comma.
+static uint64_t written;
+static uint32_t dropped;
+
+static spsc_t* rings[MAX_THREADS];
+static int ring_count;
+static __thread spsc_t* local_ring;
+static __thread bool no_ring;  // The thread is over the limit.
+
+static uv_mutex_t rings_lock;
+static uv_mutex_t write_lock;
+static uv_thread_t writer;
+static bool stopping;  // Accessed atomically.
+
+
+static void write_json_string(const char* str) {
+  fputc('"', file);
+
+  for (; *str; ++str)
+    if (*str == '"' || *str == '\\') fprintf(file, "\\%c", *str);
+    else if ((unsigned char)*str < 0x20) fprintf(file, "\\u%04x", *str);
+    else fputc(*str, file);
+
+  fputc('"', file);
+}
+
+
+static void write_span(const span_t* span, int tid) {
+  fprintf(file, "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                "\"dur\":%.3f,\"name\":",
+          separated ? ",\n" : "", tid, (span->start - origin)/1e3,
+          span->duration/1e3);
+  write_json_string(span->name);
+
+  if (span->detail[0]) {
+    fputs(",\"args\":{\"detail\":", file);
+    write_json_string(span->detail);
+    fputc('}', file);
+  }
+
+  fputc('}', file);
+  separated = true;
+  ++written;
+}
+
+
+// Name the thread on the timeline, the first one is the loop.
+static void write_thread(int tid) {
+  fprintf(file, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\","
+                "\"args\":{\"name\":\"%s %d\"}}",
+          separated ? ",\n" : "", tid, tid == 0 ? "loop" : "thread", tid);
+  separated = true;
+}
+
+
+static void flush(void) {
+  span_t span;
+
+  uv_mutex_lock(&write_lock);
+
+  int count = __atomic_load_n(&ring_count, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < count; ++i)
+    while (spsc_pop(rings[i], &span))
+      write_span(&span, i);
+
+  uv_mutex_unlock(&write_lock);
+}
+
+
+static void write_loop(void* arg) {
+  const struct timespec period = {0, WRITE_PERIOD * 1000000};
+
+  while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+    nanosleep(&period, NULL);
+    flush();
+  }
+}
+
+
+// Rings aren't freed, threads may still trace after the stop.
+static spsc_t* acquire_ring(void) {
+  spsc_t* ring = malloc(sizeof(spsc_t));
+  if (!ring || !spsc_init(ring, sizeof(span_t), RING_CAPACITY)) {
+    free(ring);
+    return NULL;
+  }
+
+  uv_mutex_lock(&rings_lock);
+
+  if (ring_count == MAX_THREADS) {
+    uv_mutex_unlock(&rings_lock);
+    spsc_free(ring);
+    free(ring);
+    return NULL;
+  }
+
+  rings[ring_count] = ring;
+
+  uv_mutex_lock(&write_lock);
+  if (file) write_thread(ring_count);
+  uv_mutex_unlock(&write_lock);
+
+  __atomic_store_n(&ring_count, ring_count + 1, __ATOMIC_RELEASE);
+  uv_mutex_unlock(&rings_lock);
+
+  return ring;
+}
+
+
+uint64_t trace__now(void) {
+  return uv_hrtime();
+}
+
+
+void trace__end(uint64_t begin, const char* name, const char* detail) {
+  assert(name);
+
+  if (!local_ring && (no_ring || !(local_ring = acquire_ring()))) {
+    no_ring = true;
+    __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  uint64_t duration = uv_hrtime() - begin;
+  span_t span = {name, begin, duration < UINT32_MAX ? duration : UINT32_MAX,
+                 ""};
+  if (detail) snprintf(span.detail, DETAIL_SIZE, "%s", detail);
+
+  if (!spsc_push(local_ring, &span))
+    __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+}
+
+
+bool trace_start(const char* trace_path) {
+  assert(trace_path);
+  assert(!trace__enabled);
+
+  if (!(file = fopen(trace_path, "w")))
+    return log_error("Cannot open the trace %s.", trace_path);
+
+  uv_mutex_init(&rings_lock);
+  uv_mutex_init(&write_lock);
+
+  path = trace_path;
+  origin = uv_hrtime();
+  fputs("[\n", file);
+
+  // The calling thread gets the first ring.
+  if (!(local_ring = acquire_ring()) ||
+      uv_thread_create(&writer, write_loop, NULL) < 0) {
+    fclose(file);
+    file = NULL;
+    return log_error("Cannot start tracing.");
+  }
+
+  __atomic_store_n(&trace__enabled, true, __ATOMIC_RELAXED);
+  log_info("Tracing to %s.", path);
+  return true;
+}
+
+
+void trace_stop(void) {
+  if (!trace__enabled) return;
+
+  __atomic_store_n(&trace__enabled, false, __ATOMIC_RELAXED);
+  __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+  uv_thread_join(&writer);
+
+  flush();
+
+  uv_mutex_lock(&write_lock);
+  fputs("\n]\n", file);
+  fclose(file);
+  file = NULL;
+  uv_mutex_unlock(&write_lock);
+
+  uint32_t lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+  log_info("Traced %llu spans to %s.", (unsigned long long)written, path);
+  if (lost) log_warning("%u spans are dropped (full ring).", lost);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+ * Spans of callbacks and transactions written as the Chrome trace (JSON),
+ * which is opened by chrome://tracing or ui.perfetto.dev. Spans are put into
+ * rings of calling threads and written by the writer thread, so tracing
+ * doesn't touch the disk in place. Disabled tracing costs a load and a branch.
+ *
+ *   uint64_t span = trace_begin();
+ *   ...
+ *   trace_end(span, "update", imu->section);
+ */
+
+extern bool trace__enabled;
+
+extern uint64_t trace__now(void);
+extern void trace__end(uint64_t begin, const char* name, const char* detail);
+
+
+/*! Start writing spans to `path`, it's called before other threads start. */
+extern bool trace_start(const char* path);
+
+/*! Write remaining spans and close the trace. */
+extern void trace_stop(void);
+
+/*! The start of the span, 0 if tracing is disabled. */
+#define trace_begin()                                                         \
+  (__atomic_load_n(&trace__enabled, __ATOMIC_RELAXED) ? trace__now() : 0)
+
+/*!
+ * Finish the span. `name` must be static, `detail` (e.g. the device) is
+ * copied and may be NULL.
+ */
+#define trace_end(begin, name, detail)                                        \
+  ((begin) ? trace__end(begin, name, detail) : (void)0)
@@ -0,0 +1,77 @@
+#include "control/attitude_filter.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "base/aux_math.h"
+
+
+void attitude_filter_update(attitude_filter_t* filter, const float g[3],
+                            const float a[3], const float m[3], float dt) {
+  assert(filter && filter->state);
+  assert(g);
+
+  if (!a)
+    filter->ops->propagate(filter->state, g[0], g[1], g[2], dt);
+  else if (m)
+    filter->ops->update(filter->state, g[0], g[1], g[2],
+                        a[0], a[1], a[2], m[0], m[1], m[2], dt);
+  else
+    filter->ops->update_imu(filter->state, g[0], g[1], g[2],
+                            a[0], a[1], a[2], dt);
+}
+
+
+float* attitude_filter_attitude(attitude_filter_t* filter) {
+  assert(filter && filter->state);
+  return filter->ops->attitude(filter->state);
+}
+
+
+void attitude_filter_stop(attitude_filter_t* filter) {
+  assert(filter && filter->state);
+
+  filter->ops->stop(filter->state);
+  filter->state = NULL;
+}
+
+
+void attitude_filter_fuse(attitude_filter_t* filter,
+                          attitude_fusion_t* fusion,
+                          float v[3][3], const uint64_t stamp[3],
+                          bool use_mag) {
+  assert(filter && fusion);
+  assert(v && stamp);
+
+  const float* gyro = v[FLIGHT_GYRO];
+  float g[3] = {deg_to_rad(gyro[0]), deg_to_rad(gyro[1]), deg_to_rad(gyro[2])};
+
+  bool fresh_acc = stamp[FLIGHT_ACC] != fusion->corrected[FLIGHT_ACC];
+  bool fresh_mag = use_mag
+                && stamp[FLIGHT_MAG] != fusion->corrected[FLIGHT_MAG];
+
+  attitude_filter_update(filter, g, fresh_acc ? v[FLIGHT_ACC] : NULL,
+                         fresh_mag ? v[FLIGHT_MAG] : NULL,
+                         (stamp[FLIGHT_GYRO] - fusion->last_run)/1e9f);
+
+  if (fresh_acc) {
+    fusion->corrected[FLIGHT_ACC] = stamp[FLIGHT_ACC];
+    if (fresh_mag) fusion->corrected[FLIGHT_MAG] = stamp[FLIGHT_MAG];
+  }
+
+  fusion->last_run = stamp[FLIGHT_GYRO];
+}
+
+
+void attitude_filter_fuse_frame(attitude_filter_t* filter,
+                                attitude_fusion_t* fusion,
+                                const flight_frame_t* frame, bool use_mag) {
+  assert(frame);
+
+  float v[3][3];
+  for (int i = 0; i < 3; ++i)
+    for (int k = 0; k < 3; ++k)
+      v[i][k] = frame->raw[i][k] * frame->gain[i];
+
+  attitude_filter_fuse(filter, fusion, v, frame->stamp, use_mag);
+}
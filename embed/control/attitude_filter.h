@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "base/flight_log.h"
+
+
+/*!
+ * Operations of the attitude filter over its state.
+ * `update_imu` fuses only the gyroscope and accelerometer (6-DOF).
+ * `propagate` integrates only the gyroscope, the next update corrects
+ * the attitude for the whole time passed since the previous correction.
+ */
+typedef struct {
+  const char* name;
+  void (*propagate)(void* state, float gx, float gy, float gz, float dt);
+  void (*update)(void* state, float gx, float gy, float gz,
+                              float ax, float ay, float az,
+                              float mx, float my, float mz, float dt);
+  void (*update_imu)(void* state, float gx, float gy, float gz,
+                                  float ax, float ay, float az, float dt);
+  float* (*attitude)(void* state);
+  void (*stop)(void* state);
+} attitude_filter_ops_t;
+
+
+/*! The attitude filter chosen at runtime, e.g. madgwick or mahony. */
+typedef struct {
+  const attitude_filter_ops_t* ops;
+  void* state;
+} attitude_filter_t;
+
+
+/*!
+ * Update the attitude using measurements of sensors.
+ * Corrections can go at lower rate than the gyroscope: pass only fresh data.
+ * @param filter  the started filter
+ * @param g       gyroscope data [rad/s]
+ * @param a       accelerometer data [g], NULL to propagate by the gyroscope
+ * @param m       magnetometer data [T] or [G], NULL for the IMU-only mode
+ * @param dt      time since the last update [s]
+ */
+extern void attitude_filter_update(attitude_filter_t* filter, const float g[3],
+                                   const float a[3], const float m[3],
+                                   float dt);
+
+/*! The normalized quaternion of the sensor frame. */
+extern float* attitude_filter_attitude(attitude_filter_t* filter);
+
+extern void attitude_filter_stop(attitude_filter_t* filter);
+
+
+/*!
+ * Fusion of stamped samples, the time goes by the gyroscope. The filter is
+ * corrected only by fresh samples of the accelerometer and magnetometer (with
+ * stamps other than of the previous correction), otherwise it propagates the
+ * gyroscope. The magnetometer is fused along with the accelerometer only.
+ */
+typedef struct {
+  uint64_t last_run;      //!< Stamp of the last gyroscope sample [ns].
+  uint64_t corrected[2];  //!< Stamps of FLIGHT_ACC, FLIGHT_MAG fused last.
+} attitude_fusion_t;
+
+/*!
+ * Fuse the gyroscope sample along with the latest samples of other sensors.
+ * @param v        samples by FLIGHT_ACC, FLIGHT_MAG, FLIGHT_GYRO in units
+ *                 of gains of the flight frame: [g], [Ga] and [°/s]
+ * @param stamp    of samples by the same order [ns]
+ * @param use_mag  false for the IMU-only mode
+ */
+extern void attitude_filter_fuse(attitude_filter_t* filter,
+                                 attitude_fusion_t* fusion,
+                                 float v[3][3], const uint64_t stamp[3],
+                                 bool use_mag);
+
+/*! Fuse raw measurements of the frame scaled by its gains. */
+extern void attitude_filter_fuse_frame(attitude_filter_t* filter,
+                                       attitude_fusion_t* fusion,
+                                       const flight_frame_t* frame,
+                                       bool use_mag);
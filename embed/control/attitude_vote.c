@@ -0,0 +1,54 @@
+#include "control/attitude_vote.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <tgmath.h>
+
+
+static float dot(const float a[4], const float b[4]) {
+  return a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3];
+}
+
+
+// |a·b| = cos(θ/2), where θ is the rotation between attitudes, and q ~ -q.
+static bool agree(const float a[4], const float b[4], float min_dot) {
+  return fabs(dot(a, b)) >= min_dot;
+}
+
+
+int attitude_vote(const float* const* q, int count, float max_angle,
+                  float out[4], bool* outliers) {
+  assert(q && out && outliers);
+  assert(count > 0);
+
+  float min_dot = cos(max_angle/2);
+  int ref = 0, best = 0;
+
+  for (int i = 0; i < count; ++i) {
+    int support = 0;
+    for (int j = 0; j < count; ++j)
+      support += agree(q[i], q[j], min_dot);
+
+    if (support > best) {
+      best = support;
+      ref = i;
+    }
+  }
+
+  float sum[4] = {0, 0, 0, 0};
+
+  for (int i = 0; i < count; ++i) {
+    if ((outliers[i] = !agree(q[ref], q[i], min_dot))) continue;
+
+    // Close attitudes are averaged in the same hemisphere.
+    float sign = dot(q[ref], q[i]) < 0 ? -1 : 1;
+    for (int k = 0; k < 4; ++k)
+      sum[k] += sign * q[i][k];
+  }
+
+  float norm = sqrt(dot(sum, sum));
+  for (int k = 0; k < 4; ++k)
+    out[k] = sum[k] / norm;
+
+  return best;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+
+
+/*!
+ * Combine attitudes of redundant IMUs. The attitude which agrees with the most
+ * others is the reference (ties go to the earlier one), attitudes disagreeing
+ * with it are outliers, the rest are averaged.
+ * @param q          normalized quaternions
+ * @param count      number of attitudes, at least one
+ * @param max_angle  maximal rotation between agreeing attitudes [rad]
+ * @param out        the combined normalized quaternion
+ * @param outliers   flags of rejected attitudes
+ * @return number of combined attitudes
+ */
+extern int attitude_vote(const float* const* q, int count, float max_angle,
+                         float out[4], bool* outliers);
@@ -0,0 +1,183 @@
+#include "control/leg_ik.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <tgmath.h>
+
+#include "base/aux_math.h"
+#include "base/logging.h"
+
+
+/*
+ * Legs are solved in passes over arrays: the first one classifies targets and
+ * chooses arguments of trigonometry for the state of every leg, the batch
+ * approximations of aux_math evaluate them, the last one combines angles.
+ * Every state needs one `atan2()` at most, the normal one also two `acos()`.
+ */
+
+static const float HALF_PI = 1.57079633f;
+static const float PI = 3.14159265f;
+
+#define MAX LEG_IK_MAX_LEGS
+
+
+bool leg_ik_start(leg_ik_t* ik, const leg_ik_leg_t* legs, int size) {
+  assert(ik && legs);
+
+  if (size < 1 || size > MAX)
+    return log_error("The number of legs must be 1..%d, not %d.", MAX, size);
+
+  ik->size = size;
+
+  for (int i = 0; i < size; ++i) {
+    const leg_ik_leg_t* leg = &legs[i];
+    float l1 = leg->femur, l2 = leg->tibia;
+
+    if (!(l1 > 0 && l2 > 0 && leg->coxa >= 0))
+      return log_error("Bad lengths of the leg %d.", i);
+
+    ik->x[i] = leg->x;
+    ik->y[i] = leg->y;
+    ik->z[i] = leg->z;
+    ik->cos_yaw[i] = cos(leg->yaw);
+    ik->sin_yaw[i] = sin(leg->yaw);
+    ik->coxa[i] = leg->coxa;
+
+    ik->l1l1[i] = l1*l1;
+    ik->l2l2[i] = l2*l2;
+    ik->inv_2l1[i] = 1 / (2*l1);
+    ik->inv_2l1l2[i] = 1 / (2*l1*l2);
+    ik->near[i] = (l2-l1)*(l2-l1);
+    ik->far[i] = (l2+l1)*(l2+l1);
+    ik->sx[i] = sin(leg->beta)*l1;
+    ik->sy[i] = cos(leg->beta)*l1;
+    ik->c[i] = l2*l2 - ik->sx[i]*ik->sx[i] - ik->sy[i]*ik->sy[i];
+    ik->beta[i] = leg->beta;
+    ik->phi[i] = HALF_PI - leg->beta;
+  }
+
+  return true;
+}
+
+
+static inline float clamp1(float x) {
+  return x < -1 ? -1 : x > 1 ? 1 : x;
+}
+
+
+// Targets in the planes of legs and arguments of the trigonometry.
+typedef struct {
+  int state[MAX];
+
+  // `atan2()` of the coxa angles are followed by ones of the planes.
+  float ay[2*MAX], ax[2*MAX], at[2*MAX];
+
+  // Of `acos()` through `asin()`.
+  float u0[MAX], u1[MAX], as0[MAX], as1[MAX];
+} pass_t;
+
+
+static void classify(const leg_ik_t* ik, const float* const foot[3],
+                     pass_t* restrict p) {
+  int n = ik->size;
+
+  for (int i = 0; i < n; ++i) {
+    // To the frame of the leg.
+    float dx = foot[0][i] - ik->x[i], dy = foot[1][i] - ik->y[i];
+    float lx = ik->cos_yaw[i]*dx + ik->sin_yaw[i]*dy;
+    float ly = ik->cos_yaw[i]*dy - ik->sin_yaw[i]*dx;
+    p->ay[i] = ly;
+    p->ax[i] = lx;
+
+    float x = sqrt(lx*lx + ly*ly) - ik->coxa[i];
+    float y = foot[2][i] - ik->z[i];
+    float sx = ik->sx[i], sy = ik->sy[i], c = ik->c[i];
+    float rr = x*x + y*y;
+
+    // Reached in front: (x+xₛ)² + (y-yₛ)² ≥ l₂²,
+    //         behind:   (x-xₛ)² + (y+yₛ)² ≤ l₂².
+    bool front = x*sy >= -sx*y;
+    bool reach_front = x*(x + 2*sx) + y*(y - 2*sy) >= c;
+    bool reach_back = x*(x - 2*sx) + y*(y + 2*sy) <= c;
+
+    int front_state = rr > ik->far[i] ? LEG_IK_DISTANT
+                    : reach_front ? LEG_IK_NORMAL : LEG_IK_CLOSE;
+    int back_state = rr < ik->near[i] ? LEG_IK_BENDED
+                   : reach_back ? LEG_IK_NORMAL
+                   : y > 0 ? LEG_IK_DISTANT : LEG_IK_DROWNED;
+    int state = front ? front_state : back_state;
+
+    // atan2(x, -y) for the normal state, atan2(y, x) of the target for
+    // distant and bended ones, of the target from the knee otherwise.
+    p->ay[MAX+i] = state == LEG_IK_NORMAL ? x
+                 : state == LEG_IK_DROWNED ? -y - sy
+                 : state == LEG_IK_CLOSE ? y - sy : y;
+    p->ax[MAX+i] = state == LEG_IK_NORMAL ? -y
+                 : state == LEG_IK_DROWNED ? sx - x
+                 : state == LEG_IK_CLOSE ? x + sx : x;
+
+    float r = sqrt(rr);
+    p->u0[i] = clamp1((ik->l1l1[i] + rr - ik->l2l2[i])
+                      * ik->inv_2l1[i] / (r > 0 ? r : 1));
+    p->u1[i] = clamp1((ik->l1l1[i] + ik->l2l2[i] - rr) * ik->inv_2l1l2[i]);
+
+    p->state[i] = state;
+  }
+
+  // Unused lanes.
+  for (int i = n; i < MAX; ++i)
+    p->ay[i] = p->ax[i] = p->ay[MAX+i] = p->ax[MAX+i] = 0;
+}
+
+
+static void combine(const leg_ik_t* ik, const pass_t* restrict p,
+                    float* const joints[3]) {
+  for (int i = 0; i < ik->size; ++i) {
+    int state = p->state[i];
+    float at = p->at[MAX+i];
+    float turned = at + ik->phi[i];
+
+    // acos(u) = π/2 - asin(u).
+    float normal0 = HALF_PI - p->as0[i] + at - ik->beta[i];
+    normal0 = normal0 < 0 ? normal0 + 2*PI : normal0;
+    float normal1 = HALF_PI - p->as1[i];
+
+    // The remainder of the division by π as `%` of the demo.
+    float bended = turned + PI;
+    bended -= PI * (int)(bended / PI);
+
+    float a0 = state == LEG_IK_NORMAL ? normal0
+             : state == LEG_IK_DROWNED ? 0
+             : state == LEG_IK_BENDED ? bended
+             : state == LEG_IK_CLOSE ? PI
+             : turned < PI ? turned : PI;
+
+    float a1 = state == LEG_IK_NORMAL ? normal1
+             : state == LEG_IK_BENDED ? 0
+             : state == LEG_IK_DISTANT ? PI
+             : turned;
+
+    joints[0][i] = p->at[i];
+    joints[1][i] = a0;
+    joints[2][i] = a1;
+  }
+}
+
+
+void leg_ik_solve(const leg_ik_t* ik, const float* const foot[3],
+                  float* const joints[3], int* states) {
+  assert(ik && foot && joints);
+
+  pass_t p;
+  classify(ik, foot, &p);
+
+  fast_atan2_n(p.ay, p.ax, p.at, 2*MAX);
+  fast_asin_n(p.u0, p.as0, ik->size);
+  fast_asin_n(p.u1, p.as1, ik->size);
+
+  combine(ik, &p, joints);
+
+  if (states)
+    for (int i = 0; i < ik->size; ++i)
+      states[i] = p.state[i];
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+
+
+/*
+ * Inverse kinematics of legs: the coxa turns the leg around the vertical
+ * axis, the femur and tibia make the two-link solver of misc/demo_ik. The
+ * femur is mounted with the shift angle `beta` and targets out of reach are
+ * mapped to the nearest pose by states of the demo.
+ *
+ * Constants of legs are computed once by `leg_ik_start()`. All legs are
+ * solved by one call in the structure-of-arrays layout: loops over legs are
+ * branch-free, so they are vectorized where the target has SIMD.
+ *
+ * Lengths are in any unit (e.g. [cm]), angles are in [rad]. The body frame
+ * is X forward, Y left, Z up.
+ */
+
+#define LEG_IK_MAX_LEGS 8
+
+
+typedef enum {
+  LEG_IK_NORMAL,   //!< The target is reached.
+  LEG_IK_CLOSE,    //!< Too close to the femur joint in front of it.
+  LEG_IK_DISTANT,  //!< Farther than the leg.
+  LEG_IK_DROWNED,  //!< Under the femur joint, behind the reach.
+  LEG_IK_BENDED    //!< Too close to the femur joint behind it.
+} leg_ik_state_t;
+
+/*! Geometry of the leg. */
+typedef struct {
+  float x, y, z;  //!< Position of the coxa joint in the body frame.
+  float yaw;      //!< Direction of the leg from the X axis of the body.
+  float coxa;     //!< Length of the coxa, 0 for the planar leg.
+  float femur;
+  float tibia;
+  float beta;     //!< Shift angle of the femur.
+} leg_ik_leg_t;
+
+/*! Per-leg constants, see `updateIK()` of the demo. */
+typedef struct {
+  int size;  //!< Number of legs.
+
+  float x[LEG_IK_MAX_LEGS], y[LEG_IK_MAX_LEGS], z[LEG_IK_MAX_LEGS];
+  float cos_yaw[LEG_IK_MAX_LEGS], sin_yaw[LEG_IK_MAX_LEGS];
+  float coxa[LEG_IK_MAX_LEGS];
+  float l1l1[LEG_IK_MAX_LEGS], l2l2[LEG_IK_MAX_LEGS];
+  float inv_2l1[LEG_IK_MAX_LEGS], inv_2l1l2[LEG_IK_MAX_LEGS];
+  float near[LEG_IK_MAX_LEGS];  // (l₂ - l₁)²
+  float far[LEG_IK_MAX_LEGS];   // (l₂ + l₁)²
+  float sx[LEG_IK_MAX_LEGS], sy[LEG_IK_MAX_LEGS];
+  float c[LEG_IK_MAX_LEGS];     // l₂² - l₁²
+  float beta[LEG_IK_MAX_LEGS], phi[LEG_IK_MAX_LEGS];
+} leg_ik_t;
+
+
+/*! Compute constants of `size` legs. */
+extern bool leg_ik_start(leg_ik_t* ik, const leg_ik_leg_t* legs, int size);
+
+/*!
+ * Solve all legs.
+ * @param foot    x, y, z of targets of feet in the body frame by legs
+ * @param joints  coxa, femur and tibia angles by legs: the coxa from the
+ *                direction of the leg, the femur from the shift direction,
+ *                the tibia between links (π is straight)
+ * @param states  `leg_ik_state_t` by legs, NULL to skip
+ */
+extern void leg_ik_solve(const leg_ik_t* ik, const float* const foot[3],
+                         float* const joints[3], int* states);
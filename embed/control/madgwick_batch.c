@@ -0,0 +1,446 @@
+#include "control/madgwick_batch.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <uv.h>
+
+#include "base/logging.h"
+#include "control/madgwick_filter.h"
+
+
+/*
+ * Filters are processed by blocks of `LANES`: the state and inputs are copied
+ * into the block, so the compiler sees that nothing aliases and vectorizes
+ * loops over lanes without runtime checks.
+ */
+#define LANES 8
+
+#define MAX_THREADS 64
+
+
+typedef struct {
+  float q[4][LANES];
+  float beta[LANES];
+  float lag[LANES];
+  float g[3][LANES];
+  float a[3][LANES];
+  float m[3][LANES];
+} block_t;
+
+
+// Measurements of the filter `i` are `x[k][i*stride]`.
+typedef struct {
+  const float* const* g;
+  const float* const* a;  // NULL to propagate.
+  const float* const* m;  // NULL for the IMU-only mode.
+  int stride;
+} input_t;
+
+
+typedef struct {
+  madgwick_batch_t* batch;
+  int lo, hi;
+  const madgwick_batch_sample_t* samples;
+  size_t count;
+} part_t;
+
+
+// The same as `inv_sqrt()`, but visible to the vectorizer.
+static inline float rsqrt(float x) {
+  union {float f; int32_t i;} conv = {x};
+  float halfx = 0.5f * x;
+  conv.i = 0x5f3759df - (conv.i>>1);
+  float y = conv.f;
+  y = y * (1.5f - (halfx * y * y));
+  return y;
+}
+
+
+/*
+ * Kernels are `madgwick_filter_*()` over lanes. Branches are replaced with
+ * masks: zero vectors give finite garbage instead of NaN, which is discarded.
+ */
+static void propagate_block(block_t* b, float dt) {
+  for (int j = 0; j < LANES; ++j) {
+    float q0 = b->q[0][j], q1 = b->q[1][j], q2 = b->q[2][j], q3 = b->q[3][j];
+    float gx = b->g[0][j], gy = b->g[1][j], gz = b->g[2][j];
+
+    // Rate of change of quaternion from gyroscope.
+    float qdot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+    float qdot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+    float qdot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+    float qdot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+    q0 += qdot1 * dt;
+    q1 += qdot2 * dt;
+    q2 += qdot3 * dt;
+    q3 += qdot4 * dt;
+    b->lag[j] += dt;
+
+    float recip_norm = rsqrt(q0*q0 + q1*q1 + q2*q2 + q3*q3);
+    b->q[0][j] = q0 * recip_norm;
+    b->q[1][j] = q1 * recip_norm;
+    b->q[2][j] = q2 * recip_norm;
+    b->q[3][j] = q3 * recip_norm;
+  }
+}
+
+
+static void update_imu_block(block_t* b, float dt) {
+  for (int j = 0; j < LANES; ++j) {
+    float q0 = b->q[0][j], q1 = b->q[1][j], q2 = b->q[2][j], q3 = b->q[3][j];
+    float gx = b->g[0][j], gy = b->g[1][j], gz = b->g[2][j];
+    float ax = b->a[0][j], ay = b->a[1][j], az = b->a[2][j];
+    bool valid = (ax != 0.0f) | (ay != 0.0f) | (az != 0.0f);
+
+    // Rate of change of quaternion from gyroscope.
+    float qdot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+    float qdot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+    float qdot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+    float qdot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+    float recip_norm = rsqrt(ax*ax + ay*ay + az*az);
+    ax *= recip_norm;
+    ay *= recip_norm;
+    az *= recip_norm;
+
+    float _2q0 = 2.0f * q0;
+    float _2q1 = 2.0f * q1;
+    float _2q2 = 2.0f * q2;
+    float _2q3 = 2.0f * q3;
+    float _4q0 = 4.0f * q0;
+    float _4q1 = 4.0f * q1;
+    float _4q2 = 4.0f * q2;
+    float _8q1 = 8.0f * q1;
+    float _8q2 = 8.0f * q2;
+    float q0q0 = q0 * q0;
+    float q1q1 = q1 * q1;
+    float q2q2 = q2 * q2;
+    float q3q3 = q3 * q3;
+
+    // Gradient decent algorithm corrective step.
+    float s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+    float s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - _4q1
+             + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+    float s2 = 4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2
+             + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+    float s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+
+    // Apply feedback step for the whole time since the last correction.
+    float lag = b->lag[j] + dt;
+    recip_norm = valid * b->beta[j] * lag * rsqrt(s0*s0 + s1*s1 + s2*s2
+                                                  + s3*s3);
+    q0 += qdot1 * dt - s0 * recip_norm;
+    q1 += qdot2 * dt - s1 * recip_norm;
+    q2 += qdot3 * dt - s2 * recip_norm;
+    q3 += qdot4 * dt - s3 * recip_norm;
+    b->lag[j] = !valid * lag;
+
+    recip_norm = rsqrt(q0*q0 + q1*q1 + q2*q2 + q3*q3);
+    b->q[0][j] = q0 * recip_norm;
+    b->q[1][j] = q1 * recip_norm;
+    b->q[2][j] = q2 * recip_norm;
+    b->q[3][j] = q3 * recip_norm;
+  }
+}
+
+
+static void update_block(block_t* b, float dt) {
+  for (int j = 0; j < LANES; ++j) {
+    float q0 = b->q[0][j], q1 = b->q[1][j], q2 = b->q[2][j], q3 = b->q[3][j];
+    float gx = b->g[0][j], gy = b->g[1][j], gz = b->g[2][j];
+    float ax = b->a[0][j], ay = b->a[1][j], az = b->a[2][j];
+    bool valid = (ax != 0.0f) | (ay != 0.0f) | (az != 0.0f);
+    float mx = b->m[0][j], my = b->m[1][j], mz = b->m[2][j];
+
+    // Rate of change of quaternion from gyroscope.
+    float qdot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+    float qdot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+    float qdot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+    float qdot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+    float recip_norm = rsqrt(ax*ax + ay*ay + az*az);
+    ax *= recip_norm;
+    ay *= recip_norm;
+    az *= recip_norm;
+
+    // The zero field zeroes the reference, what turns the step into IMU one.
+    recip_norm = rsqrt(mx*mx + my*my + mz*mz);
+    mx *= recip_norm;
+    my *= recip_norm;
+    mz *= recip_norm;
+
+    float _2q0mx = 2.0f * q0 * mx;
+    float _2q0my = 2.0f * q0 * my;
+    float _2q0mz = 2.0f * q0 * mz;
+    float _2q1mx = 2.0f * q1 * mx;
+    float _2q0 = 2.0f * q0;
+    float _2q1 = 2.0f * q1;
+    float _2q2 = 2.0f * q2;
+    float _2q3 = 2.0f * q3;
+    float _2q0q2 = 2.0f * q0 * q2;
+    float _2q2q3 = 2.0f * q2 * q3;
+    float q0q0 = q0 * q0;
+    float q0q1 = q0 * q1;
+    float q0q2 = q0 * q2;
+    float q0q3 = q0 * q3;
+    float q1q1 = q1 * q1;
+    float q1q2 = q1 * q2;
+    float q1q3 = q1 * q3;
+    float q2q2 = q2 * q2;
+    float q2q3 = q2 * q3;
+    float q3q3 = q3 * q3;
+
+    // Reference direction of Earth's magnetic field.
+    float hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1
+             + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+    float hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2
+             - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+    float _2bx = sqrtf(hx * hx + hy * hy);
+    float _2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3
+               - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+    float _4bx = 2.0f * _2bx;
+    float _4bz = 2.0f * _2bz;
+
+    // Gradient decent algorithm corrective step.
+    float s0 = -_2q2 * (2.0f*q1q3 - _2q0q2 - ax)
+             + _2q1 * (2.0f*q0q1 + _2q2q3 - ay)
+             - _2bz * q2 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2)
+             - mx) + (-_2bx * q3 + _2bz * q1) * (_2bx * (q1q2 - q0q3) + _2bz
+             * (q0q1 + q2q3) - my) + _2bx * q2 * (_2bx * (q0q2 + q1q3) + _2bz
+             * (0.5f - q1q1 - q2q2) - mz);
+    float s1 = _2q3 * (2.0f*q1q3 - _2q0q2 - ax)
+             + _2q0 * (2.0f*q0q1 + _2q2q3 - ay)
+             - 4.0f * q1 * (1 - 2.0f*q1q1 - 2.0f*q2q2 - az) + _2bz * q3 * (_2bx
+             * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * q2
+             + _2bz * q0) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my)
+             + (_2bx * q3 - _4bz * q1) * (_2bx * (q0q2 + q1q3) + _2bz
+             * (0.5f - q1q1 - q2q2) - mz);
+    float s2 = -_2q0 * (2.0f*q1q3 - _2q0q2 - ax)
+             + _2q3 * (2.0f*q0q1 + _2q2q3 - ay)
+             - 4.0f * q2 * (1 - 2.0f*q1q1 - 2.0f*q2q2 - az) + (-_4bx * q2
+             - _2bz * q0) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2)
+             - mx) + (_2bx * q1 + _2bz * q3) * (_2bx * (q1q2 - q0q3) + _2bz
+             * (q0q1 + q2q3) - my) + (_2bx * q0 - _4bz * q2) * (_2bx * (q0q2
+             + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+    float s3 = _2q1 * (2.0f*q1q3 - _2q0q2 - ax)
+             + _2q2 * (2.0f*q0q1 + _2q2q3 - ay)
+             + (-_4bx * q3 + _2bz * q1) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz
+             * (q1q3 - q0q2) - mx) + (-_2bx * q0 + _2bz * q2) * (_2bx * (q1q2
+             - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * q1 * (_2bx * (q0q2
+             + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+
+    // Apply feedback step for the whole time since the last correction.
+    float lag = b->lag[j] + dt;
+    recip_norm = valid * b->beta[j] * lag * rsqrt(s0*s0 + s1*s1 + s2*s2
+                                                  + s3*s3);
+    q0 += qdot1 * dt - s0 * recip_norm;
+    q1 += qdot2 * dt - s1 * recip_norm;
+    q2 += qdot3 * dt - s2 * recip_norm;
+    q3 += qdot4 * dt - s3 * recip_norm;
+    b->lag[j] = !valid * lag;
+
+    recip_norm = rsqrt(q0*q0 + q1*q1 + q2*q2 + q3*q3);
+    b->q[0][j] = q0 * recip_norm;
+    b->q[1][j] = q1 * recip_norm;
+    b->q[2][j] = q2 * recip_norm;
+    b->q[3][j] = q3 * recip_norm;
+  }
+}
+
+
+static void load(block_t* b, const madgwick_batch_t* batch, int lo, int n,
+                 const input_t* in) {
+  for (int j = 0; j < n; ++j) {
+    int i = lo + j;
+
+    for (int k = 0; k < 4; ++k)
+      b->q[k][j] = batch->attitude[k][i];
+
+    b->beta[j] = batch->beta[i];
+    b->lag[j] = batch->lag[i];
+
+    for (int k = 0; k < 3; ++k) {
+      b->g[k][j] = in->g[k][i*in->stride];
+      if (in->a) b->a[k][j] = in->a[k][i*in->stride];
+      if (in->m) b->m[k][j] = in->m[k][i*in->stride];
+    }
+  }
+
+  // Missing lanes of the last block are at rest without measurements.
+  for (int j = n; j < LANES; ++j) {
+    b->q[0][j] = 1.0f;
+    b->q[1][j] = b->q[2][j] = b->q[3][j] = 0.0f;
+    b->beta[j] = b->lag[j] = 0.0f;
+
+    for (int k = 0; k < 3; ++k)
+      b->g[k][j] = b->a[k][j] = b->m[k][j] = 0.0f;
+  }
+}
+
+
+static void store(const block_t* b, madgwick_batch_t* batch, int lo, int n) {
+  for (int j = 0; j < n; ++j) {
+    for (int k = 0; k < 4; ++k)
+      batch->attitude[k][lo + j] = b->q[k][j];
+
+    batch->lag[lo + j] = b->lag[j];
+  }
+}
+
+
+// Update filters [lo, hi).
+static void update_range(madgwick_batch_t* batch, int lo, int hi,
+                         const input_t* in, float dt) {
+  block_t block;
+
+  for (int i = lo; i < hi; i += LANES) {
+    int n = hi - i < LANES ? hi - i : LANES;
+    load(&block, batch, i, n, in);
+
+    if (!in->a)
+      propagate_block(&block, dt);
+    else if (!in->m)
+      update_imu_block(&block, dt);
+    else
+      update_block(&block, dt);
+
+    store(&block, batch, i, n);
+  }
+}
+
+
+static void run_part(void* arg) {
+  part_t* part = arg;
+
+  for (size_t k = 0; k < part->count; ++k) {
+    const madgwick_batch_sample_t* s = &part->samples[k];
+    const float* g[3] = {&s->g[0], &s->g[1], &s->g[2]};
+    const float* a[3] = {&s->a[0], &s->a[1], &s->a[2]};
+    const float* m[3] = {&s->m[0], &s->m[1], &s->m[2]};
+    input_t in = {g, a, m, 0};
+
+    update_range(part->batch, part->lo, part->hi, &in, s->dt);
+  }
+}
+
+
+madgwick_batch_t* madgwick_batch_start(int size, const float* beta) {
+  assert(size > 0);
+
+  madgwick_batch_t* batch = malloc(sizeof(madgwick_batch_t));
+  float* data = malloc(6 * size * sizeof(float));
+
+  batch->size = size;
+  for (int k = 0; k < 4; ++k)
+    batch->attitude[k] = data + k*size;
+  batch->beta = data + 4*size;
+  batch->lag = data + 5*size;
+
+  for (int i = 0; i < size; ++i) {
+    assert(!beta || (0 <= beta[i] && beta[i] <= 1));
+    batch->attitude[0][i] = 1.0f;
+    batch->attitude[1][i] = batch->attitude[2][i] = 0.0f;
+    batch->attitude[3][i] = 0.0f;
+    batch->beta[i] = beta ? beta[i] : MADGWICK_FILTER_BETA;
+    batch->lag[i] = 0.0f;
+  }
+
+  return batch;
+}
+
+
+void madgwick_batch_update(madgwick_batch_t* batch, const float* const g[3],
+                           const float* const a[3], const float* const m[3],
+                           float dt) {
+  assert(batch && g);
+
+  input_t in = {g, a, a ? m : NULL, 1};
+  update_range(batch, 0, batch->size, &in, dt);
+}
+
+
+void madgwick_batch_update_shared(madgwick_batch_t* batch, const float g[3],
+                                  const float a[3], const float m[3],
+                                  float dt) {
+  assert(batch && g);
+
+  const float* gs[3] = {&g[0], &g[1], &g[2]};
+  const float* as[3];
+  const float* ms[3];
+  input_t in = {gs, NULL, NULL, 0};
+
+  if (a) {
+    as[0] = &a[0], as[1] = &a[1], as[2] = &a[2];
+    in.a = as;
+  }
+
+  if (a && m) {
+    ms[0] = &m[0], ms[1] = &m[1], ms[2] = &m[2];
+    in.m = ms;
+  }
+
+  update_range(batch, 0, batch->size, &in, dt);
+}
+
+
+void madgwick_batch_run(madgwick_batch_t* batch,
+                        const madgwick_batch_sample_t* samples, size_t count,
+                        int threads) {
+  assert(batch && (samples || count == 0));
+  assert(threads > 0);
+
+  // Don't split less than a vector per thread.
+  int chunks = (batch->size + LANES - 1) / LANES;
+  threads = threads < chunks ? threads : chunks;
+  threads = threads < MAX_THREADS ? threads : MAX_THREADS;
+
+  part_t parts[MAX_THREADS] = {{NULL}};
+  uv_thread_t workers[MAX_THREADS];
+  bool spawned[MAX_THREADS];
+
+  for (int t = 0; t < threads; ++t) {
+    int lo = chunks * t / threads * LANES;
+    int hi = chunks * (t + 1) / threads * LANES;
+    parts[t] = (part_t){
+      batch, lo, hi < batch->size ? hi : batch->size, samples, count
+    };
+  }
+
+  // The caller runs the first part itself.
+  for (int t = 1; t < threads; ++t) {
+    spawned[t] = uv_thread_create(&workers[t], run_part, &parts[t]) == 0;
+    if (!spawned[t])
+      log_warning("Cannot create the thread, the part is run in the caller.");
+  }
+
+  run_part(&parts[0]);
+
+  for (int t = 1; t < threads; ++t) {
+    if (spawned[t])
+      uv_thread_join(&workers[t]);
+    else
+      run_part(&parts[t]);
+  }
+}
+
+
+void madgwick_batch_attitude(const madgwick_batch_t* batch, int i,
+                             float q[4]) {
+  assert(batch && 0 <= i && i < batch->size);
+
+  for (int k = 0; k < 4; ++k)
+    q[k] = batch->attitude[k][i];
+}
+
+
+void madgwick_batch_stop(madgwick_batch_t* batch) {
+  assert(batch);
+
+  free(batch->attitude[0]);
+  free(batch);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+
+
+/*!
+ * Independent madgwick filters with own gains in the structure-of-arrays
+ * layout: one call advances all of them, the loop over filters is vectorized.
+ * Used for several IMUs on one board and sweeps of gains over recordings.
+ *
+ * Results are the same as of `madgwick_filter_t` up to rounding. Zero samples
+ * of the accelerometer (magnetometer) skip the correction (the magnetometer)
+ * of the filter as `madgwick_filter_update()` does.
+ */
+typedef struct {
+  int size;            //!< Number of filters.
+  float* attitude[4];  //!< Components of normalized quaternions by filters.
+  float* beta;         //!< Twice proportional gains.
+  float* lag;          //!< Time since the last correction [s].
+} madgwick_batch_t;
+
+
+/*! The sample of the recording passed to all filters. */
+typedef struct {
+  float g[3];  //!< Gyroscope data [rad/s].
+  float a[3];  //!< Accelerometer data [g], zeros to propagate.
+  float m[3];  //!< Magnetometer data [T] or [G], zeros for the IMU-only mode.
+  float dt;    //!< Time since the previous sample [s].
+} madgwick_batch_sample_t;
+
+
+/*!
+ * Start `size` filters.
+ * @param beta  gains of filters, NULL for `MADGWICK_FILTER_BETA`
+ */
+extern madgwick_batch_t* madgwick_batch_start(int size, const float* beta);
+
+/*!
+ * Update every filter with its own measurements, arrays are of `size`.
+ * @param g   gyroscope data [rad/s]
+ * @param a   accelerometer data [g], NULL to propagate all filters
+ * @param m   magnetometer data [T] or [G], NULL for the IMU-only mode
+ * @param dt  time since the last update [s]
+ */
+extern void madgwick_batch_update(madgwick_batch_t* batch,
+                                  const float* const g[3],
+                                  const float* const a[3],
+                                  const float* const m[3], float dt);
+
+/*! Update all filters with the same measurements, e.g. to compare gains. */
+extern void madgwick_batch_update_shared(madgwick_batch_t* batch,
+                                         const float g[3], const float a[3],
+                                         const float m[3], float dt);
+
+/*!
+ * Pass the recording through all filters. Filters are split between
+ * `threads` threads, every thread runs the whole recording for its part,
+ * so threads don't wait each other.
+ */
+extern void madgwick_batch_run(madgwick_batch_t* batch,
+                               const madgwick_batch_sample_t* samples,
+                               size_t count, int threads);
+
+/*! Copy the normalized quaternion of the filter `i`. */
+extern void madgwick_batch_attitude(const madgwick_batch_t* batch, int i,
+                                    float q[4]);
+
+extern void madgwick_batch_stop(madgwick_batch_t* batch);
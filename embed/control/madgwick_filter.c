@@ -15,6 +15,7 @@ madgwick_filter_t* madgwick_filter_start(float beta) {
   assert(0 <= beta && beta <= 1);
   madgwick_filter_t* filter = malloc(sizeof(madgwick_filter_t));
   filter->beta = beta;
+  filter->lag = 0.0f;
   filter->attitude[0] = 1.0f;
   filter->attitude[1] = filter->attitude[2] = filter->attitude[3] = 0.0f;
 
@@ -27,6 +28,12 @@ void madgwick_filter_update(madgwick_filter_t* filter,
                             float ax, float ay, float az,
                             float mx, float my, float mz,
                             float dt) {
+  // Use the IMU algorithm if the magnetometer measurement is invalid.
+  if ((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) {
+    madgwick_filter_update_imu(filter, gx, gy, gz, ax, ay, az, dt);
+    return;
+  }
+
   float beta = filter->beta;
   float q0 = filter->attitude[0];
   float q1 = filter->attitude[1];
@@ -48,6 +55,7 @@ void madgwick_filter_update(madgwick_filter_t* filter,
   qdot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
 
   // Compute feedback only if accelerometer measurement valid.
+  filter->lag += dt;
   if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
     // Normalize accelerometer measurement.
     recip_norm = inv_sqrt(ax*ax + ay*ay + az*az);
@@ -121,11 +129,95 @@ void madgwick_filter_update(madgwick_filter_t* filter,
     s2 *= recip_norm;
     s3 *= recip_norm;
 
-    // Apply feedback step.
-    qdot1 -= beta * s0;
-    qdot2 -= beta * s1;
-    qdot3 -= beta * s2;
-    qdot4 -= beta * s3;
+    // Apply feedback step for the whole time since the last correction.
+    q0 -= beta * s0 * filter->lag;
+    q1 -= beta * s1 * filter->lag;
+    q2 -= beta * s2 * filter->lag;
+    q3 -= beta * s3 * filter->lag;
+    filter->lag = 0.0f;
+  }
+
+  // Integrate rate of change of quaternion to yield quaternion.
+  q0 += qdot1 * dt;
+  q1 += qdot2 * dt;
+  q2 += qdot3 * dt;
+  q3 += qdot4 * dt;
+
+  // Normalize quaternion.
+  recip_norm = inv_sqrt(q0*q0 + q1*q1 + q2*q2 + q3*q3);
+  filter->attitude[0] = q0 * recip_norm;
+  filter->attitude[1] = q1 * recip_norm;
+  filter->attitude[2] = q2 * recip_norm;
+  filter->attitude[3] = q3 * recip_norm;
+}
+
+
+void madgwick_filter_update_imu(madgwick_filter_t* filter,
+                                float gx, float gy, float gz,
+                                float ax, float ay, float az,
+                                float dt) {
+  float beta = filter->beta;
+  float q0 = filter->attitude[0];
+  float q1 = filter->attitude[1];
+  float q2 = filter->attitude[2];
+  float q3 = filter->attitude[3];
+
+  float recip_norm;
+  float s0, s1, s2, s3;
+  float qdot1, qdot2, qdot3, qdot4;
+  float _2q0, _2q1, _2q2, _2q3, _4q0, _4q1, _4q2, _8q1, _8q2,
+        q0q0, q1q1, q2q2, q3q3;
+
+  // Rate of change of quaternion from gyroscope.
+  qdot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+  qdot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+  qdot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+  qdot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+  // Compute feedback only if accelerometer measurement valid.
+  filter->lag += dt;
+  if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+    // Normalize accelerometer measurement.
+    recip_norm = inv_sqrt(ax*ax + ay*ay + az*az);
+    ax *= recip_norm;
+    ay *= recip_norm;
+    az *= recip_norm;
+
+    // Auxiliary variables to avoid repeated arithmetic.
+    _2q0 = 2.0f * q0;
+    _2q1 = 2.0f * q1;
+    _2q2 = 2.0f * q2;
+    _2q3 = 2.0f * q3;
+    _4q0 = 4.0f * q0;
+    _4q1 = 4.0f * q1;
+    _4q2 = 4.0f * q2;
+    _8q1 = 8.0f * q1;
+    _8q2 = 8.0f * q2;
+    q0q0 = q0 * q0;
+    q1q1 = q1 * q1;
+    q2q2 = q2 * q2;
+    q3q3 = q3 * q3;
+
+    // Gradient decent algorithm corrective step.
+    s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+    s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - _4q1
+       + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+    s2 = 4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2
+       + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+    s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+
+    recip_norm = inv_sqrt(s0*s0 + s1*s1 + s2*s2 + s3*s3);
+    s0 *= recip_norm;
+    s1 *= recip_norm;
+    s2 *= recip_norm;
+    s3 *= recip_norm;
+
+    // Apply feedback step for the whole time since the last correction.
+    q0 -= beta * s0 * filter->lag;
+    q1 -= beta * s1 * filter->lag;
+    q2 -= beta * s2 * filter->lag;
+    q3 -= beta * s3 * filter->lag;
+    filter->lag = 0.0f;
   }
 
   // Integrate rate of change of quaternion to yield quaternion.
@@ -143,6 +235,71 @@ void madgwick_filter_update(madgwick_filter_t* filter,
 }
 
 
+void madgwick_filter_propagate(madgwick_filter_t* filter,
+                               float gx, float gy, float gz, float dt) {
+  float q0 = filter->attitude[0];
+  float q1 = filter->attitude[1];
+  float q2 = filter->attitude[2];
+  float q3 = filter->attitude[3];
+  float recip_norm;
+
+  // Rate of change of quaternion from gyroscope.
+  float qdot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+  float qdot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+  float qdot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+  float qdot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+  // Integrate rate of change of quaternion to yield quaternion.
+  q0 += qdot1 * dt;
+  q1 += qdot2 * dt;
+  q2 += qdot3 * dt;
+  q3 += qdot4 * dt;
+
+  // Normalize quaternion.
+  recip_norm = inv_sqrt(q0*q0 + q1*q1 + q2*q2 + q3*q3);
+  filter->attitude[0] = q0 * recip_norm;
+  filter->attitude[1] = q1 * recip_norm;
+  filter->attitude[2] = q2 * recip_norm;
+  filter->attitude[3] = q3 * recip_norm;
+
+  filter->lag += dt;
+}
+
+
 void madgwick_filter_stop(madgwick_filter_t* filter) {
   free(filter);
 }
+
+
+static void propagate(void* state, float gx, float gy, float gz, float dt) {
+  madgwick_filter_propagate(state, gx, gy, gz, dt);
+}
+
+
+static void update(void* state, float gx, float gy, float gz,
+                                float ax, float ay, float az,
+                                float mx, float my, float mz, float dt) {
+  madgwick_filter_update(state, gx, gy, gz, ax, ay, az, mx, my, mz, dt);
+}
+
+
+static void update_imu(void* state, float gx, float gy, float gz,
+                                    float ax, float ay, float az, float dt) {
+  madgwick_filter_update_imu(state, gx, gy, gz, ax, ay, az, dt);
+}
+
+
+static float* attitude(void* state) {
+  madgwick_filter_t* filter = state;
+  return filter->attitude;
+}
+
+
+static void stop(void* state) {
+  madgwick_filter_stop(state);
+}
+
+
+const attitude_filter_ops_t madgwick_filter_ops = {
+  "madgwick", propagate, update, update_imu, attitude, stop
+};
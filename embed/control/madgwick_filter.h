@@ -1,9 +1,12 @@
 #pragma once
 
+#include "control/attitude_filter.h"
+
 
 typedef struct {
   float attitude[4];  //!< The тormalized quaternion of sensor frame.
   float beta;         //!< Twice proportional gain.
+  float lag;          //!< Time since the last correction [s].
 } madgwick_filter_t;
 
 
@@ -28,4 +31,21 @@ extern void madgwick_filter_update(madgwick_filter_t* filter,
                                    float mx, float my, float mz,
                                    float dt);
 
+/*!
+ * Integrate only the gyroscope:
+ *   + 10    - 5    * 28    √ 1
+ * The next update applies the feedback for all propagated time.
+ */
+extern void madgwick_filter_propagate(madgwick_filter_t* filter,
+                                      float gx, float gy, float gz, float dt);
+
+/*! Update current state without the magnetometer (6-DOF), the yaw drifts. */
+extern void madgwick_filter_update_imu(madgwick_filter_t* filter,
+                                       float gx, float gy, float gz,
+                                       float ax, float ay, float az,
+                                       float dt);
+
 extern void madgwick_filter_stop(madgwick_filter_t* filter);
+
+/*! Operations for `attitude_filter_t`, the state is `madgwick_filter_t`. */
+extern const attitude_filter_ops_t madgwick_filter_ops;
@@ -0,0 +1,222 @@
+#include "control/mahony_filter.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "base/aux_math.h"
+#include "control/attitude_filter.h"
+
+
+const float MAHONY_FILTER_KP = 0.5f;
+const float MAHONY_FILTER_KI = 0.05f;
+
+
+mahony_filter_t* mahony_filter_start(float kp, float ki) {
+  assert(kp >= 0 && ki >= 0);
+  mahony_filter_t* filter = malloc(sizeof(mahony_filter_t));
+  filter->kp = kp;
+  filter->ki = ki;
+  filter->attitude[0] = 1.0f;
+  filter->attitude[1] = filter->attitude[2] = filter->attitude[3] = 0.0f;
+  filter->bias[0] = filter->bias[1] = filter->bias[2] = 0.0f;
+  filter->lag = 0.0f;
+
+  return filter;
+}
+
+
+// Apply PI feedback of the error accumulated for `span` and integrate rate
+// of change of quaternion for `dt`.
+static void integrate(mahony_filter_t* filter,
+                      float gx, float gy, float gz,
+                      float ex, float ey, float ez, float dt, float span) {
+  float q0 = filter->attitude[0];
+  float q1 = filter->attitude[1];
+  float q2 = filter->attitude[2];
+  float q3 = filter->attitude[3];
+  float recip_norm;
+
+  if (filter->ki > 0.0f) {
+    filter->bias[0] += 2.0f * filter->ki * ex * span;
+    filter->bias[1] += 2.0f * filter->ki * ey * span;
+    filter->bias[2] += 2.0f * filter->ki * ez * span;
+    gx += filter->bias[0];
+    gy += filter->bias[1];
+    gz += filter->bias[2];
+  }
+
+  // Integrate rate of change of quaternion.
+  gx = 0.5f * gx * dt + filter->kp * ex * span;
+  gy = 0.5f * gy * dt + filter->kp * ey * span;
+  gz = 0.5f * gz * dt + filter->kp * ez * span;
+
+  float qa = q0, qb = q1, qc = q2;
+  q0 += -qb * gx - qc * gy - q3 * gz;
+  q1 += qa * gx + qc * gz - q3 * gy;
+  q2 += qa * gy - qb * gz + q3 * gx;
+  q3 += qa * gz + qb * gy - qc * gx;
+
+  // Normalize quaternion.
+  recip_norm = inv_sqrt(q0*q0 + q1*q1 + q2*q2 + q3*q3);
+  filter->attitude[0] = q0 * recip_norm;
+  filter->attitude[1] = q1 * recip_norm;
+  filter->attitude[2] = q2 * recip_norm;
+  filter->attitude[3] = q3 * recip_norm;
+}
+
+
+void mahony_filter_propagate(mahony_filter_t* filter,
+                             float gx, float gy, float gz, float dt) {
+  integrate(filter, gx, gy, gz, 0.0f, 0.0f, 0.0f, dt, 0.0f);
+  filter->lag += dt;
+}
+
+
+void mahony_filter_update(mahony_filter_t* filter,
+                          float gx, float gy, float gz,
+                          float ax, float ay, float az,
+                          float mx, float my, float mz,
+                          float dt) {
+  // Use the IMU algorithm if the magnetometer measurement is invalid.
+  if ((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) {
+    mahony_filter_update_imu(filter, gx, gy, gz, ax, ay, az, dt);
+    return;
+  }
+
+  // Compute feedback only if accelerometer measurement valid.
+  if ((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)) {
+    mahony_filter_propagate(filter, gx, gy, gz, dt);
+    return;
+  }
+
+  float q0 = filter->attitude[0];
+  float q1 = filter->attitude[1];
+  float q2 = filter->attitude[2];
+  float q3 = filter->attitude[3];
+  float recip_norm;
+
+  // Normalize accelerometer measurement.
+  recip_norm = inv_sqrt(ax*ax + ay*ay + az*az);
+  ax *= recip_norm;
+  ay *= recip_norm;
+  az *= recip_norm;
+
+  // Normalize magnetometer measurement.
+  recip_norm = inv_sqrt(mx*mx + my*my + mz*mz);
+  mx *= recip_norm;
+  my *= recip_norm;
+  mz *= recip_norm;
+
+  // Auxiliary variables to avoid repeated arithmetic.
+  float q0q0 = q0 * q0;
+  float q0q1 = q0 * q1;
+  float q0q2 = q0 * q2;
+  float q0q3 = q0 * q3;
+  float q1q1 = q1 * q1;
+  float q1q2 = q1 * q2;
+  float q1q3 = q1 * q3;
+  float q2q2 = q2 * q2;
+  float q2q3 = q2 * q3;
+  float q3q3 = q3 * q3;
+
+  // Reference direction of Earth's magnetic field.
+  float hx = 2.0f * (mx * (0.5f - q2q2 - q3q3) + my * (q1q2 - q0q3)
+                     + mz * (q1q3 + q0q2));
+  float hy = 2.0f * (mx * (q1q2 + q0q3) + my * (0.5f - q1q1 - q3q3)
+                     + mz * (q2q3 - q0q1));
+  float bx = sqrt(hx * hx + hy * hy);
+  float bz = 2.0f * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1)
+                     + mz * (0.5f - q1q1 - q2q2));
+
+  // Estimated direction of gravity and magnetic field.
+  float vx = q1q3 - q0q2;
+  float vy = q0q1 + q2q3;
+  float vz = q0q0 - 0.5f + q3q3;
+  float wx = bx * (0.5f - q2q2 - q3q3) + bz * (q1q3 - q0q2);
+  float wy = bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3);
+  float wz = bx * (q0q2 + q1q3) + bz * (0.5f - q1q1 - q2q2);
+
+  // Error is sum of cross product between estimated and measured directions.
+  float ex = (ay * vz - az * vy) + (my * wz - mz * wy);
+  float ey = (az * vx - ax * vz) + (mz * wx - mx * wz);
+  float ez = (ax * vy - ay * vx) + (mx * wy - my * wx);
+
+  integrate(filter, gx, gy, gz, ex, ey, ez, dt, filter->lag + dt);
+  filter->lag = 0.0f;
+}
+
+
+void mahony_filter_update_imu(mahony_filter_t* filter,
+                              float gx, float gy, float gz,
+                              float ax, float ay, float az,
+                              float dt) {
+  // Compute feedback only if accelerometer measurement valid.
+  if ((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)) {
+    mahony_filter_propagate(filter, gx, gy, gz, dt);
+    return;
+  }
+
+  float q0 = filter->attitude[0];
+  float q1 = filter->attitude[1];
+  float q2 = filter->attitude[2];
+  float q3 = filter->attitude[3];
+
+  // Normalize accelerometer measurement.
+  float recip_norm = inv_sqrt(ax*ax + ay*ay + az*az);
+  ax *= recip_norm;
+  ay *= recip_norm;
+  az *= recip_norm;
+
+  // Estimated direction of gravity.
+  float vx = q1 * q3 - q0 * q2;
+  float vy = q0 * q1 + q2 * q3;
+  float vz = q0 * q0 - 0.5f + q3 * q3;
+
+  // Error is cross product between estimated and measured direction.
+  float ex = ay * vz - az * vy;
+  float ey = az * vx - ax * vz;
+  float ez = ax * vy - ay * vx;
+
+  integrate(filter, gx, gy, gz, ex, ey, ez, dt, filter->lag + dt);
+  filter->lag = 0.0f;
+}
+
+
+void mahony_filter_stop(mahony_filter_t* filter) {
+  free(filter);
+}
+
+
+static void propagate(void* state, float gx, float gy, float gz, float dt) {
+  mahony_filter_propagate(state, gx, gy, gz, dt);
+}
+
+
+static void update(void* state, float gx, float gy, float gz,
+                                float ax, float ay, float az,
+                                float mx, float my, float mz, float dt) {
+  mahony_filter_update(state, gx, gy, gz, ax, ay, az, mx, my, mz, dt);
+}
+
+
+static void update_imu(void* state, float gx, float gy, float gz,
+                                    float ax, float ay, float az, float dt) {
+  mahony_filter_update_imu(state, gx, gy, gz, ax, ay, az, dt);
+}
+
+
+static float* attitude(void* state) {
+  mahony_filter_t* filter = state;
+  return filter->attitude;
+}
+
+
+static void stop(void* state) {
+  mahony_filter_stop(state);
+}
+
+
+const attitude_filter_ops_t mahony_filter_ops = {
+  "mahony", propagate, update, update_imu, attitude, stop
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "control/attitude_filter.h"
+
+
+/*!
+ * The complementary filter with PI feedback of the attitude error,
+ * the integral term estimates the gyroscope bias. It's cheaper than madgwick:
+ * the error is a cross product of directions, no gradient is computed.
+ */
+typedef struct {
+  float attitude[4];  //!< The normalized quaternion of sensor frame.
+  float kp;           //!< Proportional gain.
+  float ki;           //!< Integral gain, 0 to disable the bias estimation.
+  float bias[3];      //!< Integral feedback (negated gyroscope bias) [rad/s].
+  float lag;          //!< Time since the last correction [s].
+} mahony_filter_t;
+
+
+/*! Default values of `kp` and `ki`. */
+extern const float MAHONY_FILTER_KP;
+extern const float MAHONY_FILTER_KI;
+
+extern mahony_filter_t* mahony_filter_start(float kp, float ki);
+
+/*!
+ * Update current state using measurements of sensors and delta of time.
+ * @param filter   current data
+ * @param gx,gy,gz gyroscope data [rad/s]
+ * @param ax,ay,az accelerometer data [g]
+ * @param mx,my,mz magnetometer data [T] or [G]
+ * @param dt       time since the last update [s]
+ */
+extern void mahony_filter_update(mahony_filter_t* filter,
+                                 float gx, float gy, float gz,
+                                 float ax, float ay, float az,
+                                 float mx, float my, float mz,
+                                 float dt);
+
+/*!
+ * Integrate only the gyroscope corrected by the estimated bias.
+ * The next update applies the feedback for all propagated time.
+ */
+extern void mahony_filter_propagate(mahony_filter_t* filter,
+                                    float gx, float gy, float gz, float dt);
+
+/*! Update current state without the magnetometer (6-DOF), the yaw drifts. */
+extern void mahony_filter_update_imu(mahony_filter_t* filter,
+                                     float gx, float gy, float gz,
+                                     float ax, float ay, float az,
+                                     float dt);
+
+extern void mahony_filter_stop(mahony_filter_t* filter);
+
+/*! Operations for `attitude_filter_t`, the state is `mahony_filter_t`. */
+extern const attitude_filter_ops_t mahony_filter_ops;
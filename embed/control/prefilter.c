@@ -0,0 +1,416 @@
+#include "control/prefilter.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "base/logging.h"
+#include "devices/sensor_batch.h"
+
+
+/*
+ * Kernels run over samples of one axis. FIR taps and medians are computed for
+ * all outputs of the batch at once from the history followed by the batch, so
+ * loops over samples have no dependencies and are vectorized. The biquad and
+ * integrators are recursive in time and go sample by sample.
+ */
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Order the pair, so `a <= b`.
+#define SORT(a, b) do {                                                       \
+  float lo = MIN(a, b), hi = MAX(a, b);                                       \
+  a = lo; b = hi;                                                             \
+} while (0)
+
+#define SQRT1_2 0.70710678f
+
+
+// Inputs before the batch needed by the stage.
+static int history_size(const prefilter_stage_t* st) {
+  switch (st->kind) {
+    case PREFILTER_MEDIAN:
+    case PREFILTER_FIR:
+      return st->size - 1;
+
+    case PREFILTER_BOXCAR:
+    case PREFILTER_CIC:
+    case PREFILTER_BIQUAD:
+    default:
+      return 0;
+  }
+}
+
+
+// Append the batch to the history, the result is the extended history.
+static float* extend(prefilter_stage_t* st, int axis, const float* in,
+                     int count) {
+  float* ext = st->history[axis];
+  memcpy(ext + history_size(st), in, count * sizeof(float));
+  return ext;
+}
+
+
+// Keep the last inputs for the next batch.
+static void shift(prefilter_stage_t* st, int axis, int count) {
+  float* ext = st->history[axis];
+  memmove(ext, ext + count, history_size(st) * sizeof(float));
+}
+
+
+/*
+ * Filters.
+ */
+
+static void median(prefilter_stage_t* st, int axis, float* v, int count) {
+  const float* ext = extend(st, axis, v, count);
+
+  if (st->size == 3) {
+    for (int i = 0; i < count; ++i) {
+      float a = ext[i], b = ext[i+1], c = ext[i+2];
+      v[i] = MAX(MIN(a, b), MIN(MAX(a, b), c));
+    }
+  } else {
+    for (int i = 0; i < count; ++i) {
+      float p0 = ext[i], p1 = ext[i+1], p2 = ext[i+2], p3 = ext[i+3];
+      float p4 = ext[i+4];
+
+      SORT(p0, p1); SORT(p3, p4); SORT(p0, p3);
+      SORT(p1, p4); SORT(p1, p2); SORT(p2, p3);
+      SORT(p1, p2);
+      v[i] = p2;
+    }
+  }
+
+  shift(st, axis, count);
+}
+
+
+// Taps are symmetric, so the convolution is the correlation.
+static void fir(prefilter_stage_t* st, int axis, float* v, int count) {
+  const float* ext = extend(st, axis, v, count);
+
+  for (int i = 0; i < count; ++i)
+    v[i] = 0;
+
+  for (int k = 0; k < st->size; ++k) {
+    float tap = st->coef[k];
+    const float* x = ext + k;
+
+    for (int i = 0; i < count; ++i)
+      v[i] += tap * x[i];
+  }
+
+  shift(st, axis, count);
+}
+
+
+// The transposed direct form II.
+static void biquad(prefilter_stage_t* st, int axis, float* v, int count) {
+  const float* c = st->coef;
+  float z0 = st->z[axis][0], z1 = st->z[axis][1];
+
+  for (int i = 0; i < count; ++i) {
+    float x = v[i];
+    float y = c[0] * x + z0;
+    z0 = c[1] * x - c[3] * y + z1;
+    z1 = c[2] * x - c[4] * y;
+    v[i] = y;
+  }
+
+  st->z[axis][0] = z0;
+  st->z[axis][1] = z1;
+}
+
+
+/*
+ * Decimators, outputs are written over inputs.
+ */
+
+static int boxcar(prefilter_stage_t* st, int axis, float* v, int count) {
+  float sum = st->sum[axis];
+  int phase = st->phase;
+  int out = 0;
+
+  for (int i = 0; i < count; ++i) {
+    sum += v[i];
+
+    if (++phase == st->factor) {
+      v[out++] = sum / st->factor;
+      sum = 0;
+      phase = 0;
+    }
+  }
+
+  st->sum[axis] = sum;
+  return out;
+}
+
+
+// Unsigned integers wrap around, so integrators overflow harmlessly.
+static int cic(prefilter_stage_t* st, int axis, float* v, int count) {
+  uint32_t* integ = st->integ[axis];
+  uint32_t* comb = st->comb[axis];
+  float lsb = st->coef[0], scale = st->coef[1];
+  int order = st->size;
+  int phase = st->phase;
+  int out = 0;
+
+  for (int i = 0; i < count; ++i) {
+    integ[0] += (uint32_t)(int32_t)lrintf(v[i] * lsb);
+    for (int k = 1; k < order; ++k)
+      integ[k] += integ[k-1];
+
+    if (++phase < st->factor) continue;
+
+    uint32_t y = integ[order-1];
+    for (int k = 0; k < order; ++k) {
+      uint32_t delayed = comb[k];
+      comb[k] = y;
+      y -= delayed;
+    }
+
+    v[out++] = (int32_t)y * scale;
+    phase = 0;
+  }
+
+  return out;
+}
+
+
+static int run_stage(prefilter_stage_t* st, float* const v[3], int count) {
+  int out = count;
+
+  for (int axis = 0; axis < 3; ++axis) {
+    switch (st->kind) {
+      case PREFILTER_MEDIAN: median(st, axis, v[axis], count); break;
+      case PREFILTER_FIR: fir(st, axis, v[axis], count); break;
+      case PREFILTER_BIQUAD: biquad(st, axis, v[axis], count); break;
+      case PREFILTER_BOXCAR: out = boxcar(st, axis, v[axis], count); break;
+      case PREFILTER_CIC: out = cic(st, axis, v[axis], count); break;
+
+      default:
+        assert(0);
+    }
+  }
+
+  // Decimators share the phase between axes.
+  if (st->factor > 1)
+    st->phase = (st->phase + count) % st->factor;
+
+  return out;
+}
+
+
+/*
+ * The state settles on the first sample, so there is no transient.
+ */
+
+static void prime_stage(prefilter_stage_t* st, const float x[3]) {
+  int size = history_size(st);
+  const float* c = st->coef;
+
+  for (int axis = 0; axis < 3; ++axis) {
+    for (int i = 0; i < size; ++i)
+      st->history[axis][i] = x[axis];
+
+    // DC gain of the biquad is 1: the output equals the input.
+    st->z[axis][1] = (c[2] - c[4]) * x[axis];
+    st->z[axis][0] = (c[1] - c[3]) * x[axis] + st->z[axis][1];
+  }
+
+  if (st->kind != PREFILTER_CIC) return;
+
+  // The comb delays are filled after `order` outputs.
+  float buf[3][SENSOR_BATCH_CAPACITY];
+  float* v[3] = {buf[0], buf[1], buf[2]};
+
+  for (int k = 0; k < st->size; ++k) {
+    for (int axis = 0; axis < 3; ++axis)
+      for (int i = 0; i < st->factor; ++i)
+        buf[axis][i] = x[axis];
+
+    run_stage(st, v, st->factor);
+  }
+}
+
+
+static void prime(prefilter_t* pf, float* const v[3]) {
+  float x[3] = {v[0][0], v[1][0], v[2][0]};
+
+  for (int s = 0; s < pf->size; ++s)
+    prime_stage(&pf->stages[s], x);
+
+  pf->primed = true;
+}
+
+
+void prefilter_run(prefilter_t* pf, sensor_batch_t* batch) {
+  assert(pf && batch);
+  assert(batch->count <= SENSOR_BATCH_CAPACITY);
+
+  if (pf->size == 0 || batch->count == 0) return;
+
+  float* const v[3] = {batch->x, batch->y, batch->z};
+  if (!pf->primed) prime(pf, v);
+
+  // Output `j` of the stage is made from the input `first + j*step` of
+  // the batch, it gives stamps of outputs.
+  int count = batch->count;
+  int first = 0, step = 1;
+
+  for (int s = 0; s < pf->size && count > 0; ++s) {
+    prefilter_stage_t* st = &pf->stages[s];
+
+    first += (st->factor - 1 - st->phase) * step;
+    step *= st->factor;
+    count = run_stage(st, v, count);
+  }
+
+  if (count > 0) {
+    int last = first + (count-1) * step;
+    batch->stamp -= (uint64_t)(batch->count-1 - last) * batch->period;
+  }
+
+  batch->count = count;
+  batch->period *= step;
+
+  for (int i = 0; i < count; ++i)
+    for (int k = 0; k < 3; ++k) {
+      long raw = lrintf(v[k][i] / pf->gain);
+      batch->raw[k][i] = raw > INT16_MAX ? INT16_MAX
+                       : raw < INT16_MIN ? INT16_MIN : raw;
+    }
+}
+
+
+/*
+ * Design.
+ */
+
+// The Hamming window, taps are normalized to the unit DC gain.
+static void design_fir(prefilter_stage_t* st, float cutoff, float rate) {
+  float fc = cutoff / rate;
+  float middle = (st->size - 1) / 2.f;
+  float sum = 0;
+
+  for (int k = 0; k < st->size; ++k) {
+    float t = k - middle;
+    float sinc = t == 0 ? 2*fc : sinf(2*M_PI*fc * t) / (M_PI * t);
+    float window = st->size > 1 ? 0.54f - 0.46f*cosf(2*M_PI*k/(st->size-1))
+                                : 1;
+    st->coef[k] = sinc * window;
+    sum += st->coef[k];
+  }
+
+  for (int k = 0; k < st->size; ++k)
+    st->coef[k] /= sum;
+}
+
+
+// The low-pass of the RBJ cookbook with Q = 1/√2.
+static void design_biquad(prefilter_stage_t* st, float cutoff, float rate) {
+  float w0 = 2*M_PI * cutoff / rate;
+  float cosw = cosf(w0);
+  float alpha = sinf(w0) / (2*SQRT1_2);
+  float a0 = 1 + alpha;
+
+  st->coef[0] = (1 - cosw) / 2 / a0;
+  st->coef[1] = (1 - cosw) / a0;
+  st->coef[2] = st->coef[0];
+  st->coef[3] = -2*cosw / a0;
+  st->coef[4] = (1 - alpha) / a0;
+}
+
+
+static bool parse_stage(prefilter_t* pf, prefilter_stage_t* st, char* token) {
+  char* args = strchr(token, ':');
+  if (!args) return log_error("No parameters of the prefilter %s.", token);
+  *args++ = '\0';
+
+  float cutoff = 0;
+  memset(st, 0, sizeof(*st));
+  st->factor = 1;
+
+  if (!strcmp(token, "median")) {
+    st->kind = PREFILTER_MEDIAN;
+    if (sscanf(args, "%d", &st->size) != 1
+        || (st->size != 3 && st->size != 5))
+      return log_error("The median window must be 3 or 5, not %s.", args);
+  } else if (!strcmp(token, "boxcar")) {
+    st->kind = PREFILTER_BOXCAR;
+    if (sscanf(args, "%d", &st->factor) != 1
+        || st->factor < 2 || st->factor > SENSOR_BATCH_CAPACITY)
+      return log_error("The boxcar factor must be 2..%d, not %s.",
+                       SENSOR_BATCH_CAPACITY, args);
+  } else if (!strcmp(token, "cic")) {
+    st->kind = PREFILTER_CIC;
+    if (sscanf(args, "%d:%d", &st->factor, &st->size) != 2
+        || st->factor < 2 || st->factor > SENSOR_BATCH_CAPACITY
+        || st->size < 1 || st->size > PREFILTER_MAX_ORDER)
+      return log_error("Bad CIC factor or order %s.", args);
+
+    // Raw values are 16-bit, the gain of the CIC must fit the rest.
+    float growth = powf(st->factor, st->size);
+    if (growth > 65536)
+      return log_error("The CIC gain %g exceeds 2^16.", growth);
+
+    st->coef[0] = 1 / pf->gain;
+    st->coef[1] = pf->gain / growth;
+  } else if (!strcmp(token, "fir")) {
+    st->kind = PREFILTER_FIR;
+    if (sscanf(args, "%d:%f", &st->size, &cutoff) != 2
+        || st->size < 1 || st->size > PREFILTER_MAX_TAPS)
+      return log_error("Bad FIR taps or cutoff %s.", args);
+  } else if (!strcmp(token, "biquad")) {
+    st->kind = PREFILTER_BIQUAD;
+    if (sscanf(args, "%f", &cutoff) != 1)
+      return log_error("Bad biquad cutoff %s.", args);
+  } else {
+    return log_error("Unknown prefilter %s.", token);
+  }
+
+  if (st->kind == PREFILTER_FIR || st->kind == PREFILTER_BIQUAD) {
+    if (!(cutoff > 0 && cutoff < pf->rate/2))
+      return log_error("The cutoff %g Hz is out of (0, %g) Hz.", cutoff,
+                       pf->rate/2);
+
+    if (st->kind == PREFILTER_FIR) design_fir(st, cutoff, pf->rate);
+    else design_biquad(st, cutoff, pf->rate);
+  }
+
+  pf->rate /= st->factor;
+  return true;
+}
+
+
+bool prefilter_start(prefilter_t* pf, const char* spec, float rate,
+                     float gain) {
+  assert(pf && spec);
+  assert(rate > 0 && gain > 0);
+
+  pf->size = 0;
+  pf->gain = gain;
+  pf->rate = rate;
+  pf->primed = false;
+
+  char stages[128];
+  snprintf(stages, sizeof(stages), "%s", spec);
+
+  char* saveptr;
+  for (char* token = strtok_r(stages, " ,", &saveptr); token;
+       token = strtok_r(NULL, " ,", &saveptr)) {
+    if (pf->size == PREFILTER_MAX_STAGES)
+      return log_error("Too many prefilters, the maximum is %d.",
+                       PREFILTER_MAX_STAGES);
+
+    if (!parse_stage(pf, &pf->stages[pf->size++], token))
+      return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "devices/sensor_batch.h"
+
+
+/*
+ * The pre-filter conditions batches of a 3-axis sensor before the fusion:
+ * sensors are oversampled, stages reject spikes, cut vibrations and decimate
+ * samples to the fusion rate. Batches are filtered in place by stages in turn,
+ * the state lives in the structure, so nothing is allocated after the start.
+ *
+ * Stages are listed in the spec separated by spaces:
+ *   median:<n>            median of the last n (3 or 5) samples
+ *   boxcar:<r>            average of every r samples, decimates by r
+ *   cic:<r>:<order>       CIC decimator by r of the order 1..4
+ *   fir:<taps>:<cutoff>   windowed-sinc low-pass of up to 32 taps
+ *   biquad:<cutoff>       2nd-order Butterworth low-pass
+ * Cutoffs are in [Hz] at the input rate of the stage. Stages delay samples,
+ * while stamps are kept of the last input sample of the output one.
+ *
+ * CIC integrates raw LSBs in wrapping 32-bit arithmetic, so it's exact, but
+ * inputs are rounded to LSBs: put it before fractional stages.
+ */
+
+#define PREFILTER_MAX_STAGES 4
+#define PREFILTER_MAX_TAPS 32
+#define PREFILTER_MAX_ORDER 4
+
+
+typedef enum {
+  PREFILTER_MEDIAN,
+  PREFILTER_BOXCAR,
+  PREFILTER_CIC,
+  PREFILTER_FIR,
+  PREFILTER_BIQUAD
+} prefilter_kind_t;
+
+typedef struct {
+  prefilter_kind_t kind;
+  int factor;  //!< Of decimation, 1 for filters.
+  int size;    //!< Number of taps, the median window or the CIC order.
+
+  // Decimators: input samples accumulated for the next output one.
+  int phase;
+
+  // Of inputs: the newest ones are the last, followed by the batch.
+  float history[3][PREFILTER_MAX_TAPS - 1 + SENSOR_BATCH_CAPACITY];
+
+  float coef[PREFILTER_MAX_TAPS];  // FIR taps or biquad b0, b1, b2, a1, a2.
+  float sum[3];
+  float z[3][2];
+  uint32_t integ[3][PREFILTER_MAX_ORDER];
+  uint32_t comb[3][PREFILTER_MAX_ORDER];
+} prefilter_stage_t;
+
+typedef struct {
+  int size;          //!< Number of stages, 0 passes batches as is.
+  float gain;        //!< Of raw measurements.
+  float rate;        //!< Output rate [Hz].
+  bool primed;       //!< Histories are filled by the first sample.
+  prefilter_stage_t stages[PREFILTER_MAX_STAGES];
+} prefilter_t;
+
+
+/*!
+ * Parse stages and reset the state.
+ * @param spec  stages, see above, empty to pass batches as is
+ * @param rate  sampling frequency of the sensor [Hz]
+ * @param gain  of raw measurements of the sensor
+ */
+extern bool prefilter_start(prefilter_t* pf, const char* spec, float rate,
+                            float gain);
+
+/*!
+ * Filter the batch in place: `count`, `stamp` and `period` are updated,
+ * `raw` is rounded from the filtered values for the flight log. Fuse `x`,
+ * `y`, `z`: they keep the resolution gained by oversampling.
+ */
+extern void prefilter_run(prefilter_t* pf, sensor_batch_t* batch);
@@ -6,8 +6,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <uv.h>
+
 #include "base/logging.h"
 #include "devices/i2c.h"
+#include "devices/i2c_async.h"
+#include "devices/sensor_batch.h"
 
 
 const int8_t ADXL345_ADDR = 0x53;
@@ -33,6 +37,8 @@ adxl345_t* adxl345_open(const char* bus, int8_t addr) {
   adxl345_t* dev = malloc(sizeof(adxl345_t));
   dev->underline = underline;
   dev->gain = NAN;
+  dev->status = 0;
+  dev->rate = NAN;
 
   return dev;
 }
@@ -54,7 +60,7 @@ bool adxl345_tune(adxl345_t* dev, float rate, float range) {
   if (rate > 3200) log_warning("Too high update rate for adxl345.");
   int rate_ctl = 0;
   while (rate_ctl < 15 && rates[rate_ctl] < rate) ++rate_ctl;
-  rate = rates[rate_ctl];
+  rate = dev->rate = rates[rate_ctl];
   if (12.5 <= rate && rate <= 400) rate_ctl |= 0x10;  // Low power mode.
 
   dev->buf[0] = 0x2c;
@@ -86,16 +92,138 @@ bool adxl345_tune(adxl345_t* dev, float rate, float range) {
 }
 
 
-bool adxl345_update(adxl345_t* dev) {
+void adxl345_prepare_read(adxl345_t* dev, i2c_read_t* rd) {
+  assert(dev && rd);
+
+  rd->dev = dev->underline;
+  rd->reg = 0x32;
+  rd->buf = dev->buf;
+  rd->size = 6;
+}
+
+
+void adxl345_decode(adxl345_t* dev) {
   assert(dev);
   assert(!isnan(dev->gain));
 
+  dev->raw[0] = dev->buf[1] << 8 | dev->buf[0];
+  dev->raw[1] = dev->buf[3] << 8 | dev->buf[2];
+  dev->raw[2] = dev->buf[5] << 8 | dev->buf[4];
+
+  dev->x = dev->raw[0] * dev->gain;
+  dev->y = dev->raw[1] * dev->gain;
+  dev->z = dev->raw[2] * dev->gain;
+}
+
+
+void adxl345_prepare_status(adxl345_t* dev, i2c_read_t* rd) {
+  assert(dev && rd);
+
+  rd->dev = dev->underline;
+  rd->reg = 0x30;
+  rd->buf = &dev->status;
+  rd->size = 1;
+}
+
+
+bool adxl345_ready(const adxl345_t* dev) {
+  assert(dev);
+  return dev->status & 0x80;
+}
+
+
+bool adxl345_update(adxl345_t* dev) {
+  assert(dev);
+
   if (!i2c_read(dev->underline, 0x32, dev->buf, 6))
     return log_error("Cannot read data from adxl345.");
 
-  dev->x = (int16_t)(dev->buf[1] << 8 | dev->buf[0]) * dev->gain;
-  dev->y = (int16_t)(dev->buf[3] << 8 | dev->buf[2]) * dev->gain;
-  dev->z = (int16_t)(dev->buf[5] << 8 | dev->buf[4]) * dev->gain;
+  adxl345_decode(dev);
+  return true;
+}
+
+
+static void on_update(void* ctx, bool ok) {
+  adxl345_t* dev = ctx;
+  if (ok) adxl345_decode(dev);
+  else log_error("Cannot read data from adxl345.");
+
+  if (dev->cb) dev->cb(dev->ctx, ok);
+}
+
+
+bool adxl345_update_async(adxl345_t* dev, i2c_cb cb, void* ctx) {
+  assert(dev);
+
+  dev->cb = cb;
+  dev->ctx = ctx;
+  return i2c_read_async(dev->underline, 0x32, dev->buf, 6, on_update, dev);
+}
+
+
+static bool set_fifo_mode(adxl345_t* dev, uint8_t mode) {
+  dev->buf[0] = 0x38;
+  dev->buf[1] = mode;
+  return i2c_write(dev->underline, dev->buf, 2);
+}
+
+
+bool adxl345_stream_start(adxl345_t* dev) {
+  assert(dev);
+  assert(!isnan(dev->rate));
+
+  if (!set_fifo_mode(dev, 0x80 | 0x10))
+    return log_error("Cannot switch adxl345 to the stream mode.");
+
+  return true;
+}
+
+
+bool adxl345_drain(adxl345_t* dev, sensor_batch_t* batch) {
+  assert(dev && batch);
+  assert(!isnan(dev->gain));
+
+  uint8_t status;
+  if (!i2c_read(dev->underline, 0x39, &status, 1))
+    return log_error("Cannot read FIFO status of adxl345.");
+
+  uint64_t stamp = uv_hrtime();
+  int count = status & 0x3f;
+  if (count > SENSOR_BATCH_CAPACITY) count = SENSOR_BATCH_CAPACITY;
+
+  // Every entry is popped by a separate read of the data registers.
+  uint8_t data[SENSOR_BATCH_CAPACITY][6];
+  i2c_read_t reads[SENSOR_BATCH_CAPACITY];
+
+  for (int i = 0; i < count; ++i)
+    reads[i] = (i2c_read_t){dev->underline, 0x32, data[i], 6};
+
+  if (count > 0 && !i2c_read_many(reads, count))
+    return log_error("Cannot read FIFO of adxl345.");
+
+  for (int i = 0; i < count; ++i) {
+    batch->raw[0][i] = data[i][1] << 8 | data[i][0];
+    batch->raw[1][i] = data[i][3] << 8 | data[i][2];
+    batch->raw[2][i] = data[i][5] << 8 | data[i][4];
+
+    batch->x[i] = batch->raw[0][i] * dev->gain;
+    batch->y[i] = batch->raw[1][i] * dev->gain;
+    batch->z[i] = batch->raw[2][i] * dev->gain;
+  }
+
+  batch->count = count;
+  batch->stamp = stamp;
+  batch->period = 1e9f/dev->rate;
+
+  return true;
+}
+
+
+bool adxl345_stream_stop(adxl345_t* dev) {
+  assert(dev);
+
+  if (!set_fifo_mode(dev, 0x00))
+    return log_error("Cannot switch adxl345 to the bypass mode.");
 
   return true;
 }
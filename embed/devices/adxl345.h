@@ -4,13 +4,21 @@
 #include <stdint.h>
 
 #include "devices/i2c.h"
+#include "devices/i2c_async.h"
+#include "devices/sensor_batch.h"
 
 
 typedef struct {
   i2c_dev_t* underline;
   float gain;
+  float rate;  //!< Output data rate [Hz].
+  int16_t raw[3];  //!< Raw measurements in order x, y, z.
+  uint8_t status;  //!< Fetched by the prepared status read.
   float x, y, z;
   uint8_t buf[6];
+
+  i2c_cb cb;  //!< Of the asynchronous update.
+  void* ctx;
 } adxl345_t;
 
 
@@ -19,4 +27,34 @@ extern const int8_t ADXL345_ADDR;
 extern adxl345_t* adxl345_open(const char* bus, int8_t addr);
 extern bool adxl345_tune(adxl345_t* dev, float rate, float range);
 extern bool adxl345_update(adxl345_t* dev);
+
+/*!
+ * The update through the queue of the bus, see "devices/i2c_async.h".
+ * Measurements are decoded before `cb`.
+ */
+extern bool adxl345_update_async(adxl345_t* dev, i2c_cb cb, void* ctx);
+
+/*! Describe the data read of `adxl345_update()` for `i2c_read_many()`. */
+extern void adxl345_prepare_read(adxl345_t* dev, i2c_read_t* rd);
+
+/*! Convert the data fetched by the prepared read to measurements. */
+extern void adxl345_decode(adxl345_t* dev);
+
+/*! Describe the read of the status register for `i2c_read_many()`. */
+extern void adxl345_prepare_status(adxl345_t* dev, i2c_read_t* rd);
+
+/*! Check DATA_READY of INT_SOURCE fetched by the prepared status read. */
+extern bool adxl345_ready(const adxl345_t* dev);
+
+/*!
+ * Switch to the stream mode: the chip keeps the last 32 samples in the FIFO.
+ * Call `adxl345_drain()` before the FIFO overflows (32/rate seconds).
+ */
+extern bool adxl345_stream_start(adxl345_t* dev);
+
+/*! Fetch all samples stored in the FIFO by one combined transaction. */
+extern bool adxl345_drain(adxl345_t* dev, sensor_batch_t* batch);
+
+extern bool adxl345_stream_stop(adxl345_t* dev);
+
 extern bool adxl345_close(adxl345_t* dev);
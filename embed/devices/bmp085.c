@@ -7,9 +7,14 @@
 
 #include "base/logging.h"
 #include "devices/i2c.h"
+#include "devices/i2c_async.h"
 
 
 const int8_t BMP085_ADDR = 0x77;
+const uint32_t BMP085_TEMP_TIME = 4500;
+
+// Maximal conversion time of pressure by oss [µs].
+static const uint32_t press_time[] = {4500, 7500, 13500, 25500};
 
 
 static bool read_calibration(bmp085_t* dev) {
@@ -56,7 +61,7 @@ bmp085_t* bmp085_open(const char* bus, int8_t addr) {
 }
 
 
-static bool request_ut(bmp085_t* dev) {
+bool bmp085_request_ut(bmp085_t* dev) {
   assert(dev);
 
   dev->buf[0] = 0xf4;
@@ -68,8 +73,9 @@ static bool request_ut(bmp085_t* dev) {
 }
 
 
-static bool request_up(bmp085_t* dev) {
+bool bmp085_request_up(bmp085_t* dev) {
   assert(dev);
+  assert(dev->oss > -1);
 
   dev->buf[0] = 0xf4;
   dev->buf[1] = 0x34 + (dev->oss << 6);
@@ -93,37 +99,42 @@ bool bmp085_tune(bmp085_t* dev, float rate) {
   dev->temp_idle = round(rate) - 1;
   dev->temp_count = 0;
 
-  return request_ut(dev);
+  return bmp085_request_ut(dev);
 }
 
 
-static bool update_temperature(bmp085_t* dev) {
+void bmp085_set_oss(bmp085_t* dev, int8_t oss) {
   assert(dev);
+  assert(0 <= oss && oss <= 3);
+  dev->oss = oss;
+}
 
-  if (!i2c_read(dev->underline, 0xf6, dev->buf, 2))
-    return false;
 
-  int32_t ut = dev->buf[0] << 8 | dev->buf[1];
+uint32_t bmp085_press_time(const bmp085_t* dev) {
+  assert(dev);
+  assert(dev->oss > -1);
+  return press_time[dev->oss];
+}
+
+
+void bmp085_compensate_temp(bmp085_t* dev, int32_t ut) {
+  assert(dev);
+
   int32_t x1 = ((ut - dev->ac6) * dev->ac5) >> 15;
-  int32_t x2 = (dev->mc << 11)/(x1 + dev->md);
+  int32_t x2 = (dev->mc * (1 << 11))/(x1 + dev->md);
 
   dev->b5 = x1 + x2;
   dev->temperature = ((dev->b5 + 8) >> 4) * 0.1f;
-
-  return true;
 }
 
 
-static bool update_pressure(bmp085_t* dev) {
+void bmp085_compensate_press(bmp085_t* dev, int32_t up) {
   assert(dev);
+  assert(dev->oss > -1);
 
-  if (!i2c_read(dev->underline, 0xf6, dev->buf, 3))
-    return false;
-
-  int32_t up, x1, x2, x3, b3, b6, p;
+  int32_t x1, x2, x3, b3, b6, p;
   uint32_t b4, b7;
 
-  up = (dev->buf[0] << 16 | dev->buf[1] << 8 | dev->buf[2]) >> (8-dev->oss);
   b6 = dev->b5 - 4000;
 
   x1 = (dev->b2 * (b6*b6 >> 12)) >> 11;
@@ -144,23 +155,105 @@ static bool update_pressure(bmp085_t* dev) {
   x2 = (-7357 * p) >> 16;
   p += (x1 + x2 + 3791) >> 4;
   dev->pressure = p;
+}
+
+
+static void decode_temp(bmp085_t* dev) {
+  bmp085_compensate_temp(dev, dev->buf[0] << 8 | dev->buf[1]);
+}
+
 
+static void decode_press(bmp085_t* dev) {
+  bmp085_compensate_press(dev,
+    (dev->buf[0] << 16 | dev->buf[1] << 8 | dev->buf[2]) >> (8-dev->oss));
+}
+
+
+bool bmp085_read_temp(bmp085_t* dev) {
+  assert(dev);
+
+  if (!i2c_read(dev->underline, 0xf6, dev->buf, 2))
+    return false;
+
+  decode_temp(dev);
   return true;
 }
 
 
+bool bmp085_read_press(bmp085_t* dev) {
+  assert(dev);
+  assert(dev->oss > -1);
+
+  if (!i2c_read(dev->underline, 0xf6, dev->buf, 3))
+    return false;
+
+  decode_press(dev);
+  return true;
+}
+
+
+bool bmp085_request_ut_async(bmp085_t* dev, i2c_cb cb, void* ctx) {
+  assert(dev);
+
+  uint8_t cmd[2] = {0xf4, 0x2e};
+  return i2c_write_async(dev->underline, cmd, 2, cb, ctx);
+}
+
+
+bool bmp085_request_up_async(bmp085_t* dev, i2c_cb cb, void* ctx) {
+  assert(dev);
+  assert(dev->oss > -1);
+
+  uint8_t cmd[2] = {0xf4, 0x34 + (dev->oss << 6)};
+  return i2c_write_async(dev->underline, cmd, 2, cb, ctx);
+}
+
+
+static void on_temp(void* ctx, bool ok) {
+  bmp085_t* dev = ctx;
+  if (ok) decode_temp(dev);
+  if (dev->cb) dev->cb(dev->ctx, ok);
+}
+
+
+static void on_press(void* ctx, bool ok) {
+  bmp085_t* dev = ctx;
+  if (ok) decode_press(dev);
+  if (dev->cb) dev->cb(dev->ctx, ok);
+}
+
+
+bool bmp085_read_temp_async(bmp085_t* dev, i2c_cb cb, void* ctx) {
+  assert(dev);
+
+  dev->cb = cb;
+  dev->ctx = ctx;
+  return i2c_read_async(dev->underline, 0xf6, dev->buf, 2, on_temp, dev);
+}
+
+
+bool bmp085_read_press_async(bmp085_t* dev, i2c_cb cb, void* ctx) {
+  assert(dev);
+  assert(dev->oss > -1);
+
+  dev->cb = cb;
+  dev->ctx = ctx;
+  return i2c_read_async(dev->underline, 0xf6, dev->buf, 3, on_press, dev);
+}
+
+
 bool bmp085_update(bmp085_t* dev) {
   assert(dev);
   assert(dev->oss > -1);
 
   if (dev->temp_count == 0) {
-    if (!(update_temperature(dev) && request_up(dev))) goto error;
+    if (!(bmp085_read_temp(dev) && bmp085_request_up(dev))) goto error;
     ++dev->temp_count;
   } else if (dev->temp_count == dev->temp_idle) {
-    if (!(update_pressure(dev) && request_ut(dev))) goto error;
+    if (!(bmp085_read_press(dev) && bmp085_request_ut(dev))) goto error;
     dev->temp_count = 0;
   } else {
-    if (!(update_pressure(dev) && request_up(dev))) goto error;
+    if (!(bmp085_read_press(dev) && bmp085_request_up(dev))) goto error;
     ++dev->temp_count;
   }
 
@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #include "devices/i2c.h"
+#include "devices/i2c_async.h"
 
 
 typedef struct {
@@ -20,12 +21,46 @@ typedef struct {
   int32_t b5;
 
   uint8_t buf[3];
+
+  i2c_cb cb;  //!< Of the asynchronous read.
+  void* ctx;
 } bmp085_t;
 
 
 extern const int8_t BMP085_ADDR;
 
+/*! Maximal conversion time of temperature [µs]. */
+extern const uint32_t BMP085_TEMP_TIME;
+
 extern bmp085_t* bmp085_open(const char* bus, int8_t addr);
 extern bool bmp085_tune(bmp085_t* dev, float rate);
 extern bool bmp085_update(bmp085_t* dev);
+
+/*!
+ * Step by step measurements for callers which wait conversions themselves:
+ * a request starts the conversion, the read must go after its time passes.
+ */
+extern void bmp085_set_oss(bmp085_t* dev, int8_t oss);
+extern bool bmp085_request_ut(bmp085_t* dev);
+extern bool bmp085_request_up(bmp085_t* dev);
+extern bool bmp085_read_temp(bmp085_t* dev);
+extern bool bmp085_read_press(bmp085_t* dev);
+
+/*!
+ * The same steps through the queue of the bus, see "devices/i2c_async.h".
+ * Reads are compensated before `cb`.
+ */
+extern bool bmp085_request_ut_async(bmp085_t* dev, i2c_cb cb, void* ctx);
+extern bool bmp085_request_up_async(bmp085_t* dev, i2c_cb cb, void* ctx);
+extern bool bmp085_read_temp_async(bmp085_t* dev, i2c_cb cb, void* ctx);
+extern bool bmp085_read_press_async(bmp085_t* dev, i2c_cb cb, void* ctx);
+
+/*! Maximal conversion time of pressure with the current oss [µs]. */
+extern uint32_t bmp085_press_time(const bmp085_t* dev);
+
+/*! Calculate temperature by the raw value, required for pressure. */
+extern void bmp085_compensate_temp(bmp085_t* dev, int32_t ut);
+
+/*! Calculate pressure by the raw value (shifted by `8 - oss`). */
+extern void bmp085_compensate_press(bmp085_t* dev, int32_t up);
 extern bool bmp085_close(bmp085_t* dev);
@@ -8,6 +8,7 @@
 
 #include "base/logging.h"
 #include "devices/i2c.h"
+#include "devices/i2c_async.h"
 
 
 const int8_t HMC5883L_ADDR = 0x1e;
@@ -34,6 +35,7 @@ hmc5883l_t* hmc5883l_open(const char* bus, int8_t addr) {
   hmc5883l_t* dev = malloc(sizeof(hmc5883l_t));
   dev->underline = underline;
   dev->gain = NAN;
+  dev->status = 0;
 
   return dev;
 }
@@ -83,21 +85,88 @@ bool hmc5883l_tune(hmc5883l_t* dev, float rate, float range) {
 }
 
 
-bool hmc5883l_update(hmc5883l_t* dev) {
+void hmc5883l_prepare_read(hmc5883l_t* dev, i2c_read_t* rd) {
+  assert(dev && rd);
+
+  rd->dev = dev->underline;
+  rd->reg = 0x03;
+  rd->buf = dev->buf;
+  rd->size = 6;
+}
+
+
+void hmc5883l_decode(hmc5883l_t* dev) {
   assert(dev);
   assert(!isnan(dev->gain));
 
+  // Registers go in order X, Z, Y.
+  dev->raw[0] = dev->buf[0] << 8 | dev->buf[1];
+  dev->raw[2] = dev->buf[2] << 8 | dev->buf[3];
+  dev->raw[1] = dev->buf[4] << 8 | dev->buf[5];
+
+  dev->x = dev->raw[0] * dev->gain;
+  dev->y = dev->raw[1] * dev->gain;
+  dev->z = dev->raw[2] * dev->gain;
+}
+
+
+void hmc5883l_prepare_status(hmc5883l_t* dev, i2c_read_t* rd) {
+  assert(dev && rd);
+
+  rd->dev = dev->underline;
+  rd->reg = 0x09;
+  rd->buf = &dev->status;
+  rd->size = 1;
+}
+
+
+bool hmc5883l_ready(const hmc5883l_t* dev) {
+  assert(dev);
+  return dev->status & 0x01;
+}
+
+
+bool hmc5883l_trigger(hmc5883l_t* dev) {
+  assert(dev);
+
+  dev->buf[0] = 0x02;
+  dev->buf[1] = 0x01;
+  if (!i2c_write(dev->underline, dev->buf, 2))
+    return log_error("Cannot start measurement of hmc5883l.");
+
+  return true;
+}
+
+
+bool hmc5883l_update(hmc5883l_t* dev) {
+  assert(dev);
+
   if (!i2c_read(dev->underline, 0x03, dev->buf, 6))
     return log_error("Cannot read data from hmc5883l.");
 
-  dev->x = (int16_t)(dev->buf[0] << 8 | dev->buf[1]) * dev->gain;
-  dev->y = (int16_t)(dev->buf[2] << 8 | dev->buf[3]) * dev->gain;
-  dev->z = (int16_t)(dev->buf[4] << 8 | dev->buf[5]) * dev->gain;
-
+  hmc5883l_decode(dev);
   return true;
 }
 
 
+static void on_update(void* ctx, bool ok) {
+  hmc5883l_t* dev = ctx;
+  if (ok) hmc5883l_decode(dev);
+  else log_error("Cannot read data from hmc5883l.");
+
+  if (dev->cb) dev->cb(dev->ctx, ok);
+}
+
+
+bool hmc5883l_update_async(hmc5883l_t* dev, i2c_cb cb, void* ctx) {
+  assert(dev);
+
+  dev->cb = cb;
+  dev->ctx = ctx;
+  return i2c_read_async(dev->underline, 0x03, dev->buf, 6, on_update, dev);
+}
+
+
 bool hmc5883l_close(hmc5883l_t* dev) {
   assert(dev);
   bool res = true;
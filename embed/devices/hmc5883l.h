@@ -4,13 +4,19 @@
 #include <stdint.h>
 
 #include "devices/i2c.h"
+#include "devices/i2c_async.h"
 
 
 typedef struct {
   i2c_dev_t* underline;
   float gain;
+  int16_t raw[3];  //!< Raw measurements in order x, y, z.
+  uint8_t status;  //!< Fetched by the prepared status read.
   float x, y, z;
   uint8_t buf[6];
+
+  i2c_cb cb;  //!< Of the asynchronous update.
+  void* ctx;
 } hmc5883l_t;
 
 
@@ -19,4 +25,30 @@ extern const int8_t HMC5883L_ADDR;
 extern hmc5883l_t* hmc5883l_open(const char* bus, int8_t addr);
 extern bool hmc5883l_tune(hmc5883l_t* dev, float rate, float range);
 extern bool hmc5883l_update(hmc5883l_t* dev);
+
+/*!
+ * The update through the queue of the bus, see "devices/i2c_async.h".
+ * Measurements are decoded before `cb`.
+ */
+extern bool hmc5883l_update_async(hmc5883l_t* dev, i2c_cb cb, void* ctx);
+
+/*! Describe the data read of `hmc5883l_update()` for `i2c_read_many()`. */
+extern void hmc5883l_prepare_read(hmc5883l_t* dev, i2c_read_t* rd);
+
+/*! Convert the data fetched by the prepared read to measurements. */
+extern void hmc5883l_decode(hmc5883l_t* dev);
+
+/*! Describe the read of the status register for `i2c_read_many()`. */
+extern void hmc5883l_prepare_status(hmc5883l_t* dev, i2c_read_t* rd);
+
+/*! Check RDY of the status register fetched by the prepared status read. */
+extern bool hmc5883l_ready(const hmc5883l_t* dev);
+
+/*!
+ * Start the single measurement, it takes ~6 ms. RDY is cleared only when
+ * the chip begins to write new data, so check it after that time.
+ * In the continuous mode RDY stays set, so it doesn't tell about new data.
+ */
+extern bool hmc5883l_trigger(hmc5883l_t* dev);
+
 extern bool hmc5883l_close(hmc5883l_t* dev);
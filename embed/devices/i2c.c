@@ -4,43 +4,152 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/i2c-dev.h>
+#include <linux/i2c.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 
 #include "base/logging.h"
+#include "base/trace.h"
+#include "devices/i2c_async.h"
+#include "devices/i2c_sim.h"
+
+
+/*
+ * Transport of i2c-dev.
+ */
+
+static bool dev_open(i2c_dev_t* dev) {
+  if ((dev->fd = open(dev->bus, O_RDWR)) < 0)
+    return false;
+
+  if (ioctl(dev->fd, I2C_SLAVE, dev->addr) < 0) {
+    int err = errno;
+    close(dev->fd);
+    errno = err;
+    return false;
+  }
+
+  return true;
+}
+
+
+static bool dev_write(i2c_dev_t* dev, const void* buf, uint8_t size) {
+  return write(dev->fd, buf, size) == (int)size;
+}
+
+
+static bool dev_read_many(i2c_read_t* reads, int count) {
+  // Each read takes two messages: the register address and the data.
+  const int MAX_READS = I2C_RDWR_IOCTL_MAX_MSGS/2;
+  struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+
+  while (count > 0) {
+    int chunk = count < MAX_READS ? count : MAX_READS;
+
+    for (int i = 0; i < chunk; ++i) {
+      i2c_read_t* rd = &reads[i];
+      msgs[2*i]   = (struct i2c_msg){rd->dev->addr, 0, 1, &rd->reg};
+      msgs[2*i+1] = (struct i2c_msg){rd->dev->addr, I2C_M_RD, rd->size,
+                                     rd->buf};
+    }
+
+    struct i2c_rdwr_ioctl_data data = {msgs, 2*chunk};
+    if (ioctl(reads[0].dev->fd, I2C_RDWR, &data) != 2*chunk)
+      return false;
+
+    reads += chunk;
+    count -= chunk;
+  }
+
+  return true;
+}
+
+
+static bool dev_close(i2c_dev_t* dev) {
+  return close(dev->fd) == 0;
+}
+
+
+static const i2c_transport_t i2c_dev_transport = {
+  dev_open, dev_write, dev_read_many, dev_close
+};
+
+
+/*
+ * Common interface.
+ */
+
+static const i2c_transport_t* choose_transport(const char* bus) {
+  if (strncmp(bus, "sim", 3) == 0 && (bus[3] == '\0' || bus[3] == ':'))
+    return &i2c_sim_transport;
+
+  return &i2c_dev_transport;
+}
 
 
 i2c_dev_t* i2c_open(const char* bus, int8_t addr) {
   assert(bus);
   assert(1 < addr >> 2 && addr >> 2 < 0x1e);
 
-  int fd = open(bus, O_RDWR);
-  if (fd < 0)
-    return log_error("Cannot open %s:%#x: %s.", bus, addr, strerror(errno));
-
-  if (ioctl(fd, I2C_SLAVE, addr) < 0)
-    return log_error("Cannot setup %s:%#x as slave: %s.",
-                     bus, addr, strerror(errno));
-
   i2c_dev_t* dev = malloc(sizeof(i2c_dev_t));
   dev->bus = strdup(bus);
   dev->addr = addr;
-  dev->fd = fd;
+  dev->fd = -1;
+  dev->transport = choose_transport(bus);
+  dev->data = NULL;
+  dev->queue = NULL;
+  dev->priority = I2C_PRIORITY_NORMAL;
+
+  if (!dev->transport->open(dev)) {
+    log_error("Cannot open %s:%#x: %s.", bus, addr, strerror(errno));
+    free(dev->bus);
+    free(dev);
+    return NULL;
+  }
+
+  histogram_register(&dev->latency, "i2c.%s:%#x.latency", bus, addr);
+  counter_register(&dev->transactions, "i2c.%s:%#x.transactions", bus, addr);
+  counter_register(&dev->bytes, "i2c.%s:%#x.bytes", bus, addr);
+  counter_register(&dev->errors, "i2c.%s:%#x.errors", bus, addr);
 
   return dev;
 }
 
 
+static void account(i2c_dev_t* dev, uint64_t start, uint8_t size, bool ok) {
+  histogram_record(&dev->latency, metrics_now() - start);
+  counter_add(&dev->transactions, 1);
+
+  if (ok) counter_add(&dev->bytes, size);
+  else counter_add(&dev->errors, 1);
+}
+
+
+static void trace_dev(uint64_t span, const char* name, const i2c_dev_t* dev) {
+  if (!span) return;
+
+  char detail[24];
+  snprintf(detail, sizeof(detail), "%s:%#x", dev->bus, dev->addr);
+  trace_end(span, name, detail);
+}
+
+
 bool i2c_write(i2c_dev_t* dev, void* buf, uint8_t size) {
   assert(dev && buf);
   assert(size > 0);
 
-  return (write(dev->fd, buf, size) == (int)size) ||
-    log_error("Cannot write to %s:%#x: %s.",
-              dev->bus, dev->addr, strerror(errno));
+  uint64_t span = trace_begin();
+  uint64_t start = metrics_now();
+  bool ok = dev->transport->write(dev, buf, size);
+  account(dev, start, size, ok);
+  trace_dev(span, "i2c_write", dev);
+
+  return ok || log_error("Cannot write to %s:%#x: %s.",
+                         dev->bus, dev->addr, strerror(errno));
 }
 
 
@@ -48,7 +157,15 @@ bool i2c_read(i2c_dev_t* dev, uint8_t reg, void* buf, uint8_t size) {
   assert(dev && buf);
   assert(size > 0);
 
-  if (!(write(dev->fd, &reg, 1) == 1 && read(dev->fd, buf, size) == (int)size))
+  i2c_read_t rd = {dev, reg, buf, size};
+
+  uint64_t span = trace_begin();
+  uint64_t start = metrics_now();
+  bool ok = dev->transport->read_many(&rd, 1);
+  account(dev, start, size, ok);
+  trace_dev(span, "i2c_read", dev);
+
+  if (!ok)
     return log_error("Cannot read from %s:%#x: %s.",
                      dev->bus, dev->addr, strerror(errno));
 
@@ -56,10 +173,51 @@ bool i2c_read(i2c_dev_t* dev, uint8_t reg, void* buf, uint8_t size) {
 }
 
 
+bool i2c_read_many(i2c_read_t* reads, int count) {
+  assert(reads);
+  assert(count > 0);
+
+#ifndef NDEBUG
+  for (int i = 0; i < count; ++i) {
+    assert(reads[i].dev && reads[i].buf);
+    assert(reads[i].size > 0);
+    assert(reads[i].dev->transport == reads[0].dev->transport);
+    assert(strcmp(reads[i].dev->bus, reads[0].dev->bus) == 0);
+  }
+#endif
+
+  uint64_t span = trace_begin();
+  uint64_t start = metrics_now();
+  bool ok = reads[0].dev->transport->read_many(reads, count);
+
+  for (int i = 0; i < count; ++i)
+    account(reads[i].dev, start, reads[i].size, ok);
+
+  if (span) {
+    char detail[24];
+    snprintf(detail, sizeof(detail), "%s, %d reads", reads[0].dev->bus, count);
+    trace_end(span, "i2c_read_many", detail);
+  }
+
+  if (!ok)
+    return log_error("Cannot read from %s: %s.",
+                     reads[0].dev->bus, strerror(errno));
+
+  return true;
+}
+
+
 bool i2c_close(i2c_dev_t* dev) {
   assert(dev);
 
-  bool res = close(dev->fd) == 0;
+  if (dev->queue) i2c_async_detach(dev);
+
+  histogram_unregister(&dev->latency);
+  counter_unregister(&dev->transactions);
+  counter_unregister(&dev->bytes);
+  counter_unregister(&dev->errors);
+
+  bool res = dev->transport->close(dev);
   if (!res) log_error("Cannot close %s:%#x: %s.",
                       dev->bus, dev->addr, strerror(errno));
 
@@ -3,15 +3,68 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "base/metrics.h"
+
+
+typedef struct i2c_transport_s i2c_transport_t;
 
 typedef struct {
   char* bus;
   int8_t addr;
   int fd;
+  const i2c_transport_t* transport;
+  void* data;        //!< Private data of the transport.
+  void* queue;       //!< Of asynchronous transactions, see "i2c_async.h".
+  int8_t priority;   //!< Of asynchronous transactions.
+
+  // "i2c.<bus>:<addr>.*", a batched read is accounted to every its device.
+  histogram_t latency;     //!< Of transactions [ns].
+  counter_t transactions;
+  counter_t bytes;         //!< Read and written.
+  counter_t errors;
 } i2c_dev_t;
 
+/*! A register read of `i2c_read_many()`. */
+typedef struct {
+  i2c_dev_t* dev;
+  uint8_t reg;
+  void* buf;
+  uint8_t size;
+} i2c_read_t;
+
+/*!
+ * The backend which executes transactions of devices.
+ * Operations set `errno` on failure.
+ */
+struct i2c_transport_s {
+  bool (*open)(i2c_dev_t* dev);
+  bool (*write)(i2c_dev_t* dev, const void* buf, uint8_t size);
+  bool (*read_many)(i2c_read_t* reads, int count);
+  bool (*close)(i2c_dev_t* dev);
+};
 
+
+/*!
+ * Open the device on the bus.
+ * @param bus   path to i2c-dev (e.g. "/dev/i2c-1") or the simulated bus
+ *              ("sim" or "sim:<recording>", see "devices/i2c_sim.h")
+ * @param addr  7-bit address of the device
+ */
 extern i2c_dev_t* i2c_open(const char* bus, int8_t addr);
 extern bool i2c_write(i2c_dev_t* dev, void* buf, uint8_t size);
+
+/*!
+ * Read `size` bytes starting at `reg` using the repeated start condition
+ * (one combined transaction, one syscall).
+ */
 extern bool i2c_read(i2c_dev_t* dev, uint8_t reg, void* buf, uint8_t size);
+
+/*!
+ * Perform several register reads as one combined transaction.
+ * All devices must be attached to the same bus.
+ * @param reads  reads in order of execution
+ * @param count  number of reads
+ */
+extern bool i2c_read_many(i2c_read_t* reads, int count);
+
 extern bool i2c_close(i2c_dev_t* dev);
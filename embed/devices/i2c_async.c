@@ -0,0 +1,357 @@
+#include "devices/i2c_async.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include "base/logging.h"
+#include "devices/i2c.h"
+
+
+// The maximal number of reads combined into one transaction.
+#define MAX_BATCH 16
+
+
+typedef struct request_s request_t;
+
+struct request_s {
+  i2c_dev_t* dev;
+  bool write;
+  bool ok;
+  uint8_t reg;
+  uint8_t size;
+  void* buf;
+  uint8_t data[I2C_ASYNC_WRITE_MAX];  // Of the write.
+  i2c_cb cb;
+  void* ctx;
+  request_t* next;
+};
+
+typedef struct {
+  request_t* head;
+  request_t* tail;
+} list_t;
+
+typedef struct queue_s queue_t;
+
+struct queue_s {
+  char* bus;
+  int refs;  // Attached devices.
+
+  uv_thread_t thread;
+  uv_async_t async;
+  uv_mutex_t lock;
+  uv_cond_t wake;  // The worker: new requests or the stop.
+  uv_cond_t idle;  // Detaching devices: the batch is executed.
+
+  // Guarded by the lock.
+  list_t pending[I2C_PRIORITIES];
+  list_t done;
+  request_t* batch[MAX_BATCH];  // Executed by the worker.
+  int batch_size;
+  bool stopping;
+
+  queue_t* next;
+};
+
+
+// Owned by the loop thread.
+static queue_t* queues;
+static request_t* spare;
+
+
+static void push(list_t* list, request_t* req) {
+  req->next = NULL;
+  if (list->tail) list->tail->next = req;
+  else list->head = req;
+  list->tail = req;
+}
+
+
+static request_t* pop(list_t* list) {
+  request_t* req = list->head;
+  if (!req) return NULL;
+
+  list->head = req->next;
+  if (!list->head) list->tail = NULL;
+  return req;
+}
+
+
+static void recycle(request_t* req) {
+  req->next = spare;
+  spare = req;
+}
+
+
+// Recycle requests of the device.
+static void remove_dev(list_t* list, const i2c_dev_t* dev) {
+  list_t kept = {NULL, NULL};
+  request_t* req;
+
+  while ((req = pop(list)))
+    if (req->dev == dev) recycle(req);
+    else push(&kept, req);
+
+  *list = kept;
+}
+
+
+static bool in_batch(const queue_t* q, const i2c_dev_t* dev) {
+  for (int i = 0; i < q->batch_size; ++i)
+    if (q->batch[i]->dev == dev)
+      return true;
+
+  return false;
+}
+
+
+static request_t* next_pending(queue_t* q) {
+  for (int i = 0; i < I2C_PRIORITIES; ++i)
+    if (q->pending[i].head)
+      return q->pending[i].head;
+
+  return NULL;
+}
+
+
+// Take the write or the run of reads.
+static void take_batch(queue_t* q) {
+  request_t* req = next_pending(q);
+  assert(req);
+
+  q->batch_size = 0;
+
+  do {
+    pop(&q->pending[req->dev->priority]);
+    q->batch[q->batch_size++] = req;
+  } while (!req->write && q->batch_size < MAX_BATCH
+           && (req = next_pending(q)) && !req->write);
+}
+
+
+static void execute(queue_t* q) {
+  bool ok;
+
+  if (q->batch[0]->write) {
+    request_t* req = q->batch[0];
+    ok = i2c_write(req->dev, req->data, req->size);
+  } else {
+    i2c_read_t reads[MAX_BATCH];
+
+    for (int i = 0; i < q->batch_size; ++i) {
+      request_t* req = q->batch[i];
+      reads[i] = (i2c_read_t){req->dev, req->reg, req->buf, req->size};
+    }
+
+    ok = i2c_read_many(reads, q->batch_size);
+  }
+
+  for (int i = 0; i < q->batch_size; ++i)
+    q->batch[i]->ok = ok;
+}
+
+
+static void work(void* arg) {
+  queue_t* q = arg;
+
+  uv_mutex_lock(&q->lock);
+
+  for (;;) {
+    while (!q->stopping && !next_pending(q))
+      uv_cond_wait(&q->wake, &q->lock);
+
+    if (q->stopping) break;
+
+    take_batch(q);
+    uv_mutex_unlock(&q->lock);
+
+    execute(q);
+
+    uv_mutex_lock(&q->lock);
+    for (int i = 0; i < q->batch_size; ++i)
+      push(&q->done, q->batch[i]);
+
+    q->batch_size = 0;
+    uv_cond_broadcast(&q->idle);
+    uv_async_send(&q->async);
+  }
+
+  uv_mutex_unlock(&q->lock);
+}
+
+
+// Requests are completed one by one, callbacks may close devices.
+static void complete(uv_async_t* handle) {
+  queue_t* q = handle->data;
+
+  for (;;) {
+    uv_mutex_lock(&q->lock);
+    request_t* req = pop(&q->done);
+    uv_mutex_unlock(&q->lock);
+
+    if (!req) return;
+
+    i2c_cb cb = req->cb;
+    void* ctx = req->ctx;
+    bool ok = req->ok;
+    recycle(req);
+
+    if (cb) cb(ctx, ok);
+  }
+}
+
+
+static void free_queue(uv_handle_t* handle) {
+  queue_t* q = handle->data;
+
+  uv_mutex_destroy(&q->lock);
+  uv_cond_destroy(&q->wake);
+  uv_cond_destroy(&q->idle);
+  free(q->bus);
+  free(q);
+}
+
+
+static queue_t* start_queue(const char* bus) {
+  queue_t* q = calloc(1, sizeof(queue_t));
+  q->bus = strdup(bus);
+
+  uv_mutex_init(&q->lock);
+  uv_cond_init(&q->wake);
+  uv_cond_init(&q->idle);
+  uv_async_init(uv_default_loop(), &q->async, complete);
+  q->async.data = q;
+
+  if (uv_thread_create(&q->thread, work, q) < 0) {
+    uv_close((uv_handle_t*)&q->async, free_queue);
+    return log_error("Cannot create the worker of %s.", bus);
+  }
+
+  q->next = queues;
+  queues = q;
+  return q;
+}
+
+
+static void stop_queue(queue_t* q) {
+  uv_mutex_lock(&q->lock);
+  q->stopping = true;
+  uv_cond_signal(&q->wake);
+  uv_mutex_unlock(&q->lock);
+
+  uv_thread_join(&q->thread);
+
+  queue_t** link = &queues;
+  while (*link != q) link = &(*link)->next;
+  *link = q->next;
+
+  uv_close((uv_handle_t*)&q->async, free_queue);
+}
+
+
+static bool attach(i2c_dev_t* dev) {
+  if (dev->queue) return true;
+
+  queue_t* q = queues;
+  while (q && strcmp(q->bus, dev->bus) != 0) q = q->next;
+
+  if (!q && !(q = start_queue(dev->bus)))
+    return false;
+
+  ++q->refs;
+  dev->queue = q;
+  return true;
+}
+
+
+static request_t* make_request(i2c_dev_t* dev, i2c_cb cb, void* ctx) {
+  if (!attach(dev)) return NULL;
+
+  request_t* req = spare;
+  if (req) spare = req->next;
+  else req = malloc(sizeof(request_t));
+
+  req->dev = dev;
+  req->cb = cb;
+  req->ctx = ctx;
+  return req;
+}
+
+
+static void submit(request_t* req) {
+  queue_t* q = req->dev->queue;
+
+  uv_mutex_lock(&q->lock);
+  push(&q->pending[req->dev->priority], req);
+  uv_cond_signal(&q->wake);
+  uv_mutex_unlock(&q->lock);
+}
+
+
+void i2c_set_priority(i2c_dev_t* dev, i2c_priority_t priority) {
+  assert(dev);
+  assert(!dev->queue);
+  assert(priority <= I2C_PRIORITY_LOW);
+
+  dev->priority = priority;
+}
+
+
+bool i2c_read_async(i2c_dev_t* dev, uint8_t reg, void* buf, uint8_t size,
+                    i2c_cb cb, void* ctx) {
+  assert(dev && buf);
+  assert(size > 0);
+
+  request_t* req = make_request(dev, cb, ctx);
+  if (!req) return false;
+
+  req->write = false;
+  req->reg = reg;
+  req->buf = buf;
+  req->size = size;
+
+  submit(req);
+  return true;
+}
+
+
+bool i2c_write_async(i2c_dev_t* dev, const void* buf, uint8_t size,
+                     i2c_cb cb, void* ctx) {
+  assert(dev && buf);
+  assert(0 < size && size <= I2C_ASYNC_WRITE_MAX);
+
+  request_t* req = make_request(dev, cb, ctx);
+  if (!req) return false;
+
+  req->write = true;
+  memcpy(req->data, buf, size);
+  req->size = size;
+
+  submit(req);
+  return true;
+}
+
+
+void i2c_async_detach(i2c_dev_t* dev) {
+  assert(dev && dev->queue);
+
+  queue_t* q = dev->queue;
+
+  uv_mutex_lock(&q->lock);
+
+  for (int i = 0; i < I2C_PRIORITIES; ++i)
+    remove_dev(&q->pending[i], dev);
+
+  while (in_batch(q, dev))
+    uv_cond_wait(&q->idle, &q->lock);
+
+  remove_dev(&q->done, dev);
+  uv_mutex_unlock(&q->lock);
+
+  dev->queue = NULL;
+  if (--q->refs == 0) stop_queue(q);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "devices/i2c.h"
+
+
+/*
+ * Transactions which don't block the loop. Every bus gets the worker thread on
+ * the first asynchronous call. The worker executes queued transactions in
+ * order of priorities of devices, FIFO for the same priority, and combines
+ * reads which go back-to-back into one transaction (if it fails, every read of
+ * it fails). Callbacks are called on the loop, they may be NULL.
+ *
+ * The API is used from the loop thread only. Closing a device cancels its
+ * queued transactions, their callbacks aren't called.
+ */
+
+typedef void (*i2c_cb)(void* ctx, bool ok);
+
+typedef enum {
+  I2C_PRIORITY_HIGH,
+  I2C_PRIORITY_NORMAL,  //!< The default one.
+  I2C_PRIORITY_LOW
+} i2c_priority_t;
+
+#define I2C_PRIORITIES 3
+
+/*! The maximal size of the asynchronous write: all channels of pca9685. */
+#define I2C_ASYNC_WRITE_MAX 65
+
+
+extern void i2c_set_priority(i2c_dev_t* dev, i2c_priority_t priority);
+
+/*! Read `size` bytes starting at `reg`, `buf` must live until `cb`. */
+extern bool i2c_read_async(i2c_dev_t* dev, uint8_t reg, void* buf,
+                           uint8_t size, i2c_cb cb, void* ctx);
+
+/*! Write `size` bytes, `buf` is copied. */
+extern bool i2c_write_async(i2c_dev_t* dev, const void* buf, uint8_t size,
+                            i2c_cb cb, void* ctx);
+
+/*! Cancel transactions of the device, it's called by `i2c_close()`. */
+extern void i2c_async_detach(i2c_dev_t* dev);
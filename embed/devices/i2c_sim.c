@@ -0,0 +1,795 @@
+#include "devices/i2c_sim.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <uv.h>
+
+#include "base/logging.h"
+#include "devices/i2c.h"
+
+
+typedef struct {
+  float acc[3];   // [g]
+  float mag[3];   // [Ga]
+  float gyro[3];  // [°/s]
+  float alt;      // [m]
+} motion_t;
+
+// GY-80 and two pca9685.
+#define MODELS 6
+
+typedef struct chip_s chip_t;
+typedef struct bus_s bus_t;
+
+typedef struct {
+  int8_t addr;
+  uint8_t mask;  //!< Bits of the subaddress selecting a register.
+  void (*reset)(chip_t* chip);
+  void (*sample)(chip_t* chip, uint8_t reg, const motion_t* motion,
+                 uint64_t now);
+  void (*write)(chip_t* chip, uint8_t reg, uint8_t value, uint64_t now);
+  void (*access)(chip_t* chip, uint8_t reg, uint64_t now);  //!< Optional.
+  uint8_t (*next)(chip_t* chip, uint8_t reg);  //!< Auto-increment policy.
+} model_t;
+
+struct chip_s {
+  const model_t* model;
+  bus_t* bus;
+  uint8_t regs[256];
+
+  // Times of samples stored in the FIFO (adxl345, l3g4200d).
+  uint64_t fifo[32];
+  int fifo_head;
+  int fifo_count;
+  uint64_t fifo_next;  // Of the next sample, also without the FIFO [ns].
+
+  // The conversion in progress (bmp085, the single measurement of hmc5883l).
+  enum {CONV_NONE, CONV_TEMPERATURE, CONV_PRESSURE} conv;
+  uint64_t ready_at;  // [ns]
+};
+
+struct bus_s {
+  char* name;
+  int refs;
+  uv_mutex_t lock;
+  uint64_t epoch;  // [ns]
+
+  motion_t* frames;
+  double* stamps;
+  int frame_count;
+
+  chip_t chips[MODELS];
+  bus_t* next;
+};
+
+
+// Nodes open devices from the threadpool concurrently.
+static bus_t* buses;
+static uv_mutex_t buses_lock;
+static uv_once_t buses_once = UV_ONCE_INIT;
+
+
+static void motion_at(bus_t* bus, uint64_t time, motion_t* motion);
+
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static int16_t saturate(float value) {
+  return value >= INT16_MAX ? INT16_MAX
+       : value <= INT16_MIN ? INT16_MIN
+       : (int16_t)value;
+}
+
+
+static void put_le(uint8_t* regs, uint8_t reg, float value) {
+  int16_t raw = saturate(value);
+  regs[reg] = raw & 0xff;
+  regs[reg+1] = (raw >> 8) & 0xff;
+}
+
+
+static void put_be(uint8_t* regs, uint8_t reg, float value) {
+  int16_t raw = saturate(value);
+  regs[reg] = (raw >> 8) & 0xff;
+  regs[reg+1] = raw & 0xff;
+}
+
+
+static uint8_t next_reg(chip_t* chip, uint8_t reg) {
+  return reg + 1;
+}
+
+
+static void fifo_reset(chip_t* chip, uint64_t now, uint64_t period) {
+  chip->fifo_head = chip->fifo_count = 0;
+  chip->fifo_next = now + period;
+}
+
+
+// Store samples taken since the last filling, the oldest ones are dropped.
+static void fifo_fill(chip_t* chip, uint64_t now, uint64_t period) {
+  if (now > chip->fifo_next + 32*period)
+    chip->fifo_next += (now - chip->fifo_next)/period*period - 32*period;
+
+  for (; chip->fifo_next <= now; chip->fifo_next += period) {
+    chip->fifo[(chip->fifo_head + chip->fifo_count) % 32] = chip->fifo_next;
+
+    if (chip->fifo_count == 32) chip->fifo_head = (chip->fifo_head + 1) % 32;
+    else ++chip->fifo_count;
+  }
+}
+
+
+// Advance the schedule of samples without the FIFO. Return the time of
+// the latest sample taken since the last call or 0 if there are no ones.
+static uint64_t sample_due(chip_t* chip, uint64_t now, uint64_t period) {
+  if (now < chip->fifo_next) return 0;
+
+  uint64_t latest = chip->fifo_next + (now - chip->fifo_next)/period*period;
+  chip->fifo_next = latest + period;
+  return latest;
+}
+
+
+static bool fifo_pop(chip_t* chip, motion_t* motion) {
+  if (chip->fifo_count == 0) return false;
+
+  motion_at(chip->bus, chip->fifo[chip->fifo_head], motion);
+  chip->fifo_head = (chip->fifo_head + 1) % 32;
+  --chip->fifo_count;
+
+  return true;
+}
+
+
+/*
+ * ADXL345: full resolution or 10-bit data at 0x32, little-endian.
+ * Every read of 0x32 in the FIFO mode pops an entry.
+ * DATA_READY (and Overrun) of INT_SOURCE are cleared by reading the data.
+ */
+
+static void adxl345_reset(chip_t* chip) {
+  chip->regs[0x00] = 0xe5;
+  chip->regs[0x2c] = 0x0a;
+  chip->regs[0x30] = 0x02;
+}
+
+
+static uint64_t adxl345_period(chip_t* chip) {
+  return 312500ull << (15 - (chip->regs[0x2c] & 0x0f));  // 3200 Hz >> code.
+}
+
+
+static void adxl345_put(chip_t* chip, const motion_t* m) {
+  uint8_t* regs = chip->regs;
+
+  int range = regs[0x31] & 0x03;
+  float lsb = regs[0x31] & 0x08 ? 256 : 256 >> range;  // [LSB/g]
+
+  put_le(regs, 0x32, m->acc[0] * lsb);
+  put_le(regs, 0x34, m->acc[1] * lsb);
+  put_le(regs, 0x36, m->acc[2] * lsb);
+}
+
+
+static void adxl345_sample(chip_t* chip, uint8_t reg, const motion_t* m,
+                           uint64_t now) {
+  uint8_t* regs = chip->regs;
+  if (!(regs[0x2d] & 0x08)) return;  // Standby.
+
+  if (regs[0x38] & 0xc0) {
+    fifo_fill(chip, now, adxl345_period(chip));
+    regs[0x39] = chip->fifo_count;
+    if (chip->fifo_count > 0) regs[0x30] |= 0x80;  // DATA_READY.
+    return;
+  }
+
+  uint64_t at = sample_due(chip, now, adxl345_period(chip));
+  if (!at) return;
+
+  motion_t sampled;
+  motion_at(chip->bus, at, &sampled);
+  adxl345_put(chip, &sampled);
+
+  if (regs[0x30] & 0x80) regs[0x30] |= 0x01;  // Overrun.
+  regs[0x30] |= 0x80;  // DATA_READY.
+}
+
+
+static void adxl345_write(chip_t* chip, uint8_t reg, uint8_t value,
+                          uint64_t now) {
+  chip->regs[reg] = value;
+  if (reg == 0x2c || reg == 0x38)
+    fifo_reset(chip, now, adxl345_period(chip));
+}
+
+
+static void adxl345_access(chip_t* chip, uint8_t reg, uint64_t now) {
+  motion_t m;
+  if (reg == 0x32 && chip->regs[0x38] & 0xc0 && fifo_pop(chip, &m))
+    adxl345_put(chip, &m);
+
+  if (0x32 <= reg && reg <= 0x37)
+    chip->regs[0x30] &= ~0x81;
+}
+
+
+/*
+ * HMC5883L: data at 0x03 in order X, Z, Y, big-endian.
+ * RDY of the status register stays set in the continuous mode and is cleared
+ * by starting the single measurement.
+ */
+
+static const float hmc5883l_lsb[] = {1370, 1090, 820, 660, 440, 390, 330, 230};
+
+// Periods of the continuous mode (0.75 .. 75 Hz) and the single measurement.
+static const uint64_t hmc5883l_period[] = {1333333333, 666666667, 333333333,
+                                           133333333, 66666667, 33333333,
+                                           13333333, 13333333};
+static const uint64_t HMC5883L_SINGLE = 6000000;
+
+static void hmc5883l_reset(chip_t* chip) {
+  chip->regs[0x00] = 0x10;
+  chip->regs[0x01] = 0x20;
+  chip->regs[0x02] = 0x01;
+  chip->regs[0x0a] = 'H';
+  chip->regs[0x0b] = '4';
+  chip->regs[0x0c] = '3';
+}
+
+
+static void hmc5883l_sample(chip_t* chip, uint8_t reg, const motion_t* m,
+                            uint64_t now) {
+  uint8_t* regs = chip->regs;
+  uint64_t at;
+
+  switch (regs[0x02] & 0x03) {
+    case 0x00:  // Continuous mode.
+      at = sample_due(chip, now, hmc5883l_period[(regs[0x00] >> 2) & 0x07]);
+      if (!at) return;
+      break;
+
+    case 0x01:  // Single measurement, then idle.
+      if (now < chip->ready_at) return;
+      at = chip->ready_at;
+      regs[0x02] |= 0x03;
+      break;
+
+    default:  // Idle.
+      return;
+  }
+
+  motion_t sampled;
+  motion_at(chip->bus, at, &sampled);
+  float lsb = hmc5883l_lsb[regs[0x01] >> 5];  // [LSB/Ga]
+
+  put_be(regs, 0x03, sampled.mag[0] * lsb);
+  put_be(regs, 0x05, sampled.mag[2] * lsb);
+  put_be(regs, 0x07, sampled.mag[1] * lsb);
+  regs[0x09] |= 0x01;  // RDY.
+}
+
+
+static void hmc5883l_write(chip_t* chip, uint8_t reg, uint8_t value,
+                           uint64_t now) {
+  chip->regs[reg] = value;
+  if (reg != 0x02) return;
+
+  if ((value & 0x03) == 0x00) {
+    chip->fifo_next = now + hmc5883l_period[(chip->regs[0x00] >> 2) & 0x07];
+  } else if ((value & 0x03) == 0x01) {
+    chip->ready_at = now + HMC5883L_SINGLE;
+    chip->regs[0x09] &= ~0x01;
+  }
+}
+
+
+static uint8_t hmc5883l_next(chip_t* chip, uint8_t reg) {
+  return reg >= 0x0c ? 0x00 : reg + 1;
+}
+
+
+/*
+ * L3G4200D: data at 0x28, little-endian, auto-increment by the MSB.
+ * In the FIFO mode the address wraps around to 0x28 after 0x2d and every
+ * read of 0x28 pops an entry.
+ * ZYXDA (and ZYXOR) of STATUS_REG are cleared by reading the data.
+ */
+
+static const float l3g4200d_sens[] = {8.75e-3, 17.5e-3, 70e-3, 70e-3};
+
+static void l3g4200d_reset(chip_t* chip) {
+  chip->regs[0x0f] = 0xd3;
+  chip->regs[0x20] = 0x07;
+}
+
+
+static uint64_t l3g4200d_period(chip_t* chip) {
+  return 1e7/(1 << (chip->regs[0x20] >> 6));
+}
+
+
+static bool l3g4200d_fifo(chip_t* chip) {
+  return chip->regs[0x24] & 0x40 && chip->regs[0x2e] & 0xe0;
+}
+
+
+static void l3g4200d_put(chip_t* chip, const motion_t* m) {
+  uint8_t* regs = chip->regs;
+  float sens = l3g4200d_sens[(regs[0x23] >> 4) & 0x03];  // [°/s per LSB]
+
+  put_le(regs, 0x28, m->gyro[0] / sens);
+  put_le(regs, 0x2a, m->gyro[1] / sens);
+  put_le(regs, 0x2c, m->gyro[2] / sens);
+}
+
+
+static void l3g4200d_sample(chip_t* chip, uint8_t reg, const motion_t* m,
+                            uint64_t now) {
+  uint8_t* regs = chip->regs;
+  if (!(regs[0x20] & 0x08)) return;  // Power down.
+
+  if (l3g4200d_fifo(chip)) {
+    fifo_fill(chip, now, l3g4200d_period(chip));
+
+    int count = chip->fifo_count;
+    regs[0x2f] = (count >= (regs[0x2e] & 0x1f) ? 0x80 : 0)  // WTM.
+               | (count == 32 ? 0x40 | 0x1f : count)        // OVRN, FSS.
+               | (count == 0 ? 0x20 : 0);                   // EMPTY.
+    if (count > 0) regs[0x27] |= 0x0f;                      // ZYXDA.
+    return;
+  }
+
+  uint64_t at = sample_due(chip, now, l3g4200d_period(chip));
+  if (!at) return;
+
+  motion_t sampled;
+  motion_at(chip->bus, at, &sampled);
+  l3g4200d_put(chip, &sampled);
+
+  if (regs[0x27] & 0x08) regs[0x27] |= 0xf0;  // ZYXOR.
+  regs[0x27] |= 0x0f;  // ZYXDA.
+}
+
+
+static void l3g4200d_write(chip_t* chip, uint8_t reg, uint8_t value,
+                           uint64_t now) {
+  chip->regs[reg] = value;
+  if (reg == 0x20 || reg == 0x24 || reg == 0x2e)
+    fifo_reset(chip, now, l3g4200d_period(chip));
+}
+
+
+static void l3g4200d_access(chip_t* chip, uint8_t reg, uint64_t now) {
+  motion_t m;
+  if (reg == 0x28 && l3g4200d_fifo(chip) && fifo_pop(chip, &m))
+    l3g4200d_put(chip, &m);
+
+  if (0x28 <= reg && reg <= 0x2d)
+    chip->regs[0x27] = 0x00;
+}
+
+
+static uint8_t l3g4200d_next(chip_t* chip, uint8_t reg) {
+  if (!(reg & 0x80)) return reg;
+  if (reg == (0x80 | 0x2d) && l3g4200d_fifo(chip)) return 0x80 | 0x28;
+  return reg + 1;
+}
+
+
+/*
+ * BMP085: the datasheet's calibration, conversions via 0xf4/0xf6.
+ */
+
+static const int16_t AC1 = 408, AC2 = -72, AC3 = -14383, B1 = 6190, B2 = 4,
+                     MB = -32768, MC = -8711, MD = 2868;
+static const uint16_t AC4 = 32741, AC5 = 32757, AC6 = 23153;
+static const int32_t UT = 27898;  // 15 °C.
+
+// Conversion time of temperature and pressure with oss = 0..3 [µs].
+static const int bmp085_conv[] = {4500, 4500, 7500, 13500, 25500};
+
+
+static void bmp085_reset(chip_t* chip) {
+  const int16_t calibration[] = {AC1, AC2, AC3, AC4, AC5, AC6,
+                                 B1, B2, MB, MC, MD};
+
+  for (int i = 0; i < 11; ++i) {
+    chip->regs[0xaa + 2*i] = (calibration[i] >> 8) & 0xff;
+    chip->regs[0xab + 2*i] = calibration[i] & 0xff;
+  }
+
+  chip->regs[0xd0] = 0x55;
+}
+
+
+static int32_t bmp085_pressure(int32_t up, int oss) {
+  int32_t x1, x2, x3, b3, b5, b6, p;
+  uint32_t b4, b7;
+
+  x1 = ((UT - AC6) * AC5) >> 15;
+  x2 = (MC * (1 << 11))/(x1 + MD);
+  b5 = x1 + x2;
+  b6 = b5 - 4000;
+
+  x1 = (B2 * (b6*b6 >> 12)) >> 11;
+  x2 = (AC2 * b6) >> 11;
+  x3 = x1 + x2;
+  b3 = (((AC1*4 + x3) << oss) + 2) >> 2;
+
+  x1 = (AC3 * b6) >> 13;
+  x2 = (B1 * (b6*b6 >> 12)) >> 16;
+  x3 = (x1 + x2 + 2) >> 2;
+  b4 = (AC4 * (uint32_t)(x3 + 32768)) >> 15;
+
+  b7 = ((uint32_t)up - b3) * (50000 >> oss);
+  p = b7 < 0x80000000 ? (b7 << 1)/b4 : (b7/b4) << 1;
+
+  x1 = (p >> 8) * (p >> 8);
+  x1 = (x1 * 3038) >> 16;
+  x2 = (-7357 * p) >> 16;
+  return p + ((x1 + x2 + 3791) >> 4);
+}
+
+
+static void bmp085_write(chip_t* chip, uint8_t reg, uint8_t value,
+                         uint64_t now) {
+  chip->regs[reg] = value;
+  if (reg != 0xf4) return;
+
+  if (value == 0x2e) {
+    chip->conv = CONV_TEMPERATURE;
+    chip->ready_at = now + bmp085_conv[0] * 1000ull;
+  } else if ((value & 0x3f) == 0x34) {
+    chip->conv = CONV_PRESSURE;
+    chip->ready_at = now + bmp085_conv[1 + (value >> 6)] * 1000ull;
+  }
+}
+
+
+static void bmp085_sample(chip_t* chip, uint8_t reg, const motion_t* m,
+                          uint64_t now) {
+  uint8_t* regs = chip->regs;
+  if (chip->conv == CONV_NONE || reg < 0xf6) return;
+
+  if (now < chip->ready_at) {
+    log_warning("Reading of simulated bmp085 before the end of conversion.");
+    return;
+  }
+
+  regs[0xf4] &= ~0x20;  // SCO.
+
+  if (chip->conv == CONV_TEMPERATURE) {
+    chip->conv = CONV_NONE;
+    regs[0xf6] = (UT >> 8) & 0xff;
+    regs[0xf7] = UT & 0xff;
+    return;
+  }
+
+  chip->conv = CONV_NONE;
+
+  // Find the uncompensated pressure giving the target one.
+  int oss = regs[0xf4] >> 6;
+  int32_t target = 101325 * pow(1 - m->alt/44330, 1/0.19029496);
+  int32_t lo = 0, hi = (1 << (16 + oss)) - 1;
+
+  while (lo < hi) {
+    int32_t mid = (lo + hi)/2;
+    if (bmp085_pressure(mid, oss) < target) lo = mid + 1;
+    else hi = mid;
+  }
+
+  uint32_t raw = (uint32_t)lo << (8 - oss);
+  regs[0xf6] = (raw >> 16) & 0xff;
+  regs[0xf7] = (raw >> 8) & 0xff;
+  regs[0xf8] = raw & 0xff;
+}
+
+
+/*
+ * PCA9685: outputs aren't simulated, only registers. MODE1.AI enables
+ * the auto-increment which wraps around to MODE1 after LED15_OFF_H. Writes to
+ * ALL_LED_* load registers of all channels, PRE_SCALE is written in the sleep
+ * mode only.
+ */
+
+static void pca9685_reset(chip_t* chip) {
+  chip->regs[0x00] = 0x11;
+  chip->regs[0x01] = 0x04;
+  chip->regs[0xfe] = 0x1e;
+
+  for (int i = 0; i < 16; ++i)
+    chip->regs[0x09 + 4*i] = 0x10;
+}
+
+
+static void pca9685_sample(chip_t* chip, uint8_t reg, const motion_t* motion,
+                           uint64_t now) {}
+
+
+static void pca9685_write(chip_t* chip, uint8_t reg, uint8_t value,
+                          uint64_t now) {
+  if (reg == 0xfe && !(chip->regs[0x00] & 0x10)) return;
+
+  if (0xfa <= reg && reg <= 0xfd)
+    for (int i = 0; i < 16; ++i)
+      chip->regs[0x06 + 4*i + reg - 0xfa] = value;
+  else if (reg == 0x00)
+    chip->regs[reg] = value & ~0x80;
+  else
+    chip->regs[reg] = value;
+}
+
+
+static uint8_t pca9685_next(chip_t* chip, uint8_t reg) {
+  if (!(chip->regs[0x00] & 0x20)) return reg;
+  return reg == 0x45 ? 0x00 : reg + 1;
+}
+
+
+static const model_t models[MODELS] = {
+  {0x53, 0xff, adxl345_reset, adxl345_sample, adxl345_write, adxl345_access,
+   next_reg},
+  {0x1e, 0xff, hmc5883l_reset, hmc5883l_sample, hmc5883l_write, NULL,
+   hmc5883l_next},
+  {0x69, 0x7f, l3g4200d_reset, l3g4200d_sample, l3g4200d_write,
+   l3g4200d_access, l3g4200d_next},
+  {0x77, 0xff, bmp085_reset, bmp085_sample, bmp085_write, NULL, next_reg},
+  {0x40, 0xff, pca9685_reset, pca9685_sample, pca9685_write, NULL,
+   pca9685_next},
+  {0x41, 0xff, pca9685_reset, pca9685_sample, pca9685_write, NULL,
+   pca9685_next}
+};
+
+
+/*
+ * Motion.
+ */
+
+static void synthetic_motion(double t, motion_t* m) {
+  const double YAW_RATE = 30;     // [°/s]
+  const double ROLL_AMPL = 20;    // [°]
+  const double ROLL_FREQ = 0.5;   // [Hz]
+  const double FIELD_N = 0.22;    // [Ga]
+  const double FIELD_D = 0.42;    // [Ga]
+
+  double w = 2*M_PI * ROLL_FREQ;
+  double yaw = YAW_RATE*M_PI/180 * t;
+  double roll = ROLL_AMPL*M_PI/180 * sin(w*t);
+  double roll_rate = ROLL_AMPL * w * cos(w*t);
+  double sr = sin(roll), cr = cos(roll);
+
+  // Body frame is the world frame rotated by yaw, then by roll.
+  double nx = FIELD_N * cos(yaw), ny = -FIELD_N * sin(yaw);
+
+  m->acc[0] = 0;
+  m->acc[1] = sr;
+  m->acc[2] = cr;
+  m->mag[0] = nx;
+  m->mag[1] = cr*ny + sr*FIELD_D;
+  m->mag[2] = -sr*ny + cr*FIELD_D;
+  m->gyro[0] = roll_rate;
+  m->gyro[1] = YAW_RATE * sr;
+  m->gyro[2] = YAW_RATE * cr;
+  m->alt = 100 + 0.5*sin(2*M_PI * 0.1 * t);
+}
+
+
+static void recorded_motion(bus_t* bus, double t, motion_t* m) {
+  double duration = bus->stamps[bus->frame_count-1];
+  if (duration > 0) t = fmod(t, duration);
+
+  // The last frame taken not later than `t`.
+  int lo = 0, hi = bus->frame_count - 1;
+  while (lo < hi) {
+    int mid = hi - (hi - lo)/2;
+    if (bus->stamps[mid] <= t) lo = mid;
+    else hi = mid - 1;
+  }
+
+  *m = bus->frames[lo];
+}
+
+
+static void motion_at(bus_t* bus, uint64_t time, motion_t* motion) {
+  double t = (time - bus->epoch)/1e9;
+
+  if (bus->frames) recorded_motion(bus, t, motion);
+  else synthetic_motion(t, motion);
+}
+
+
+static bool load_recording(bus_t* bus, const char* path) {
+  FILE* file = fopen(path, "r");
+  if (!file) return false;
+
+  int capacity = 0;
+  double first = 0;
+  char line[256];
+
+  while (fgets(line, sizeof(line), file)) {
+    motion_t m;
+    double t;
+
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%lf %f %f %f %f %f %f %f %f %f %f", &t,
+               &m.acc[0], &m.acc[1], &m.acc[2], &m.mag[0], &m.mag[1],
+               &m.mag[2], &m.gyro[0], &m.gyro[1], &m.gyro[2], &m.alt) != 11)
+      continue;
+
+    if (bus->frame_count == capacity) {
+      capacity = capacity ? 2*capacity : 1024;
+      bus->frames = realloc(bus->frames, capacity * sizeof(motion_t));
+      bus->stamps = realloc(bus->stamps, capacity * sizeof(double));
+    }
+
+    if (bus->frame_count == 0) first = t;
+    bus->stamps[bus->frame_count] = t - first;
+    bus->frames[bus->frame_count++] = m;
+  }
+
+  fclose(file);
+
+  if (bus->frame_count == 0) {
+    errno = EINVAL;
+    return false;
+  }
+
+  return true;
+}
+
+
+/*
+ * Transport.
+ */
+
+static void init_buses_lock(void) {
+  uv_mutex_init(&buses_lock);
+}
+
+
+static bus_t* acquire_bus(const char* name) {
+  for (bus_t* bus = buses; bus; bus = bus->next)
+    if (strcmp(bus->name, name) == 0) {
+      ++bus->refs;
+      return bus;
+    }
+
+  bus_t* bus = calloc(1, sizeof(bus_t));
+  bus->name = strdup(name);
+
+  if (name[3] == ':' && !load_recording(bus, name + 4)) {
+    int err = errno;
+    free(bus->frames);
+    free(bus->stamps);
+    free(bus->name);
+    free(bus);
+    errno = err;
+    return NULL;
+  }
+
+  for (int i = 0; i < MODELS; ++i) {
+    bus->chips[i].model = &models[i];
+    bus->chips[i].bus = bus;
+    models[i].reset(&bus->chips[i]);
+  }
+
+  uv_mutex_init(&bus->lock);
+  bus->epoch = now_ns();
+  bus->refs = 1;
+  bus->next = buses;
+  buses = bus;
+
+  return bus;
+}
+
+
+static void release_bus(bus_t* bus) {
+  if (--bus->refs != 0) return;
+
+  bus_t** link = &buses;
+  while (*link != bus) link = &(*link)->next;
+  *link = bus->next;
+
+  uv_mutex_destroy(&bus->lock);
+  free(bus->frames);
+  free(bus->stamps);
+  free(bus->name);
+  free(bus);
+}
+
+
+static bool sim_open(i2c_dev_t* dev) {
+  int i = 0;
+  while (i < MODELS && models[i].addr != dev->addr) ++i;
+
+  if (i == MODELS) {
+    errno = ENXIO;
+    return false;
+  }
+
+  uv_once(&buses_once, init_buses_lock);
+  uv_mutex_lock(&buses_lock);
+  bus_t* bus = acquire_bus(dev->bus);
+  uv_mutex_unlock(&buses_lock);
+
+  if (!bus) return false;
+
+  dev->data = &bus->chips[i];
+  return true;
+}
+
+
+static bool sim_write(i2c_dev_t* dev, const void* buf, uint8_t size) {
+  chip_t* chip = dev->data;
+  bus_t* bus = chip->bus;
+  const uint8_t* bytes = buf;
+  uint64_t now = now_ns();
+
+  uv_mutex_lock(&bus->lock);
+
+  uint8_t reg = bytes[0];
+  for (int i = 1; i < size; ++i, reg = chip->model->next(chip, reg))
+    chip->model->write(chip, reg & chip->model->mask, bytes[i], now);
+
+  uv_mutex_unlock(&bus->lock);
+  return true;
+}
+
+
+static bool sim_read_many(i2c_read_t* reads, int count) {
+  chip_t* first = reads[0].dev->data;
+  bus_t* bus = first->bus;
+  uint64_t now = now_ns();
+  motion_t motion;
+
+  uv_mutex_lock(&bus->lock);
+  motion_at(bus, now, &motion);
+
+  for (int i = 0; i < count; ++i) {
+    chip_t* chip = reads[i].dev->data;
+    uint8_t* buf = reads[i].buf;
+
+    uint8_t reg = reads[i].reg;
+    chip->model->sample(chip, reg & chip->model->mask, &motion, now);
+
+    for (int j = 0; j < reads[i].size; ++j) {
+      if (chip->model->access)
+        chip->model->access(chip, reg & chip->model->mask, now);
+
+      buf[j] = chip->regs[reg & chip->model->mask];
+      reg = chip->model->next(chip, reg);
+    }
+  }
+
+  uv_mutex_unlock(&bus->lock);
+  return true;
+}
+
+
+static bool sim_close(i2c_dev_t* dev) {
+  chip_t* chip = dev->data;
+
+  uv_mutex_lock(&buses_lock);
+  release_bus(chip->bus);
+  uv_mutex_unlock(&buses_lock);
+
+  return true;
+}
+
+
+const i2c_transport_t i2c_sim_transport = {
+  sim_open, sim_write, sim_read_many, sim_close
+};
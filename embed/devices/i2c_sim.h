@@ -0,0 +1,22 @@
+#pragma once
+
+#include "devices/i2c.h"
+
+
+/*!
+ * The simulated bus with register-level models of the GY-80 sensors:
+ *   adxl345 (0x53), hmc5883l (0x1e), l3g4200d (0x69) and bmp085 (0x77),
+ * and two servo controllers pca9685 (0x40, 0x41).
+ *
+ * The bus "sim" serves synthetic motion: constant yaw rotation with
+ * swinging roll and slowly oscillating altitude.
+ *
+ * The bus "sim:<path>" serves motion recorded in the text file, one sample
+ * per line (the recording is looped, lines starting with '#' are skipped):
+ *   t [s]  ax ay az [g]  mx my mz [Ga]  gx gy gz [°/s]  altitude [m]
+ *
+ * Data registers are updated by output data rates of the chips, data-ready
+ * bits of status registers are set by new samples and cleared by reading.
+ * Devices opened on the same bus name share the motion.
+ */
+extern const i2c_transport_t i2c_sim_transport;
@@ -0,0 +1,395 @@
+#include "devices/iio.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "base/logging.h"
+#include "devices/sensor_batch.h"
+
+
+static const char* const PREFIXES[] = {"accel", "anglvel", "magn"};
+static const char* const AXES = "xyz";
+
+// Of the kernel buffer, so the capture survives late drains.
+static const char* const BUFFER_LENGTH = "128";
+
+static const float STANDARD_GRAVITY = 9.80665;
+
+
+/*
+ * Sysfs.
+ */
+
+static bool read_attr(const char* dir, const char* name, char* buf, int size) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  int len = read(fd, buf, size - 1);
+  close(fd);
+  if (len < 0) return false;
+
+  while (len > 0 && (buf[len-1] == '\n' || buf[len-1] == ' ')) --len;
+  buf[len] = '\0';
+  return true;
+}
+
+
+static bool write_attr(const char* dir, const char* name, const char* value) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+  int fd = open(path, O_WRONLY | O_TRUNC);
+  if (fd < 0) return false;
+
+  int len = strlen(value);
+  bool ok = write(fd, value, len) == len;
+  return close(fd) == 0 && ok;
+}
+
+
+// The directory of the device named `device` or "iio:deviceN".
+static char* find_dir(const char* root, const char* device) {
+  char base[PATH_MAX];
+  char* dir;
+  snprintf(base, sizeof(base), "%s/sys/bus/iio/devices", root);
+
+  if (strncmp(device, "iio:device", 10) == 0)
+    return asprintf(&dir, "%s/%s", base, device) < 0 ? NULL : dir;
+
+  DIR* devices = opendir(base);
+  if (!devices) return log_error("Cannot list %s: %s.", base, strerror(errno));
+
+  char* found = NULL;
+  struct dirent* entry;
+
+  while (!found && (entry = readdir(devices))) {
+    if (strncmp(entry->d_name, "iio:device", 10) != 0) continue;
+    if (asprintf(&dir, "%s/%s", base, entry->d_name) < 0) break;
+
+    char name[64];
+    if (read_attr(dir, "name", name, sizeof(name)) && !strcmp(name, device))
+      found = dir;
+    else
+      free(dir);
+  }
+
+  closedir(devices);
+  return found ? found : log_error("No IIO device %s.", device);
+}
+
+
+/*
+ * Scan elements.
+ */
+
+// "le:s12/16>>4": the byte order, the sign, significant and storage bits.
+static bool read_channel(const char* dir, const char* channel,
+                         iio_channel_t* ch, int* index) {
+  char name[64], value[64];
+  char order, sign;
+  int storage;
+
+  snprintf(name, sizeof(name), "scan_elements/%s_index", channel);
+  if (!read_attr(dir, name, value, sizeof(value))) return false;
+  *index = atoi(value);
+
+  snprintf(name, sizeof(name), "scan_elements/%s_type", channel);
+  if (!read_attr(dir, name, value, sizeof(value))) return false;
+
+  if (sscanf(value, "%ce:%c%d/%d>>%d", &order, &sign, &ch->bits, &storage,
+             &ch->shift) != 5 || storage % 8 != 0 || storage > 64)
+    return log_error("Unsupported type %s of %s.", value, channel);
+
+  ch->be = order == 'b';
+  ch->sign = sign == 's';
+  ch->bytes = storage / 8;
+  return true;
+}
+
+
+static bool enable_channel(const char* dir, const char* channel) {
+  char name[64];
+  snprintf(name, sizeof(name), "scan_elements/%s_en", channel);
+  return write_attr(dir, name, "1");
+}
+
+
+// Only the used channels are captured.
+static bool disable_channels(const char* dir) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/scan_elements", dir);
+
+  DIR* elements = opendir(path);
+  if (!elements) return false;
+
+  bool ok = true;
+  struct dirent* entry;
+
+  while ((entry = readdir(elements))) {
+    size_t len = strlen(entry->d_name);
+    if (len < 3 || strcmp(entry->d_name + len - 3, "_en") != 0) continue;
+
+    char name[300];
+    snprintf(name, sizeof(name), "scan_elements/%s", entry->d_name);
+    ok = write_attr(dir, name, "0") && ok;
+  }
+
+  closedir(elements);
+  return ok;
+}
+
+
+// Elements go in order of indices, each one is aligned to its size.
+static void lay_out(iio_dev_t* dev, iio_channel_t* channels[4],
+                    const int indices[4]) {
+  int offset = 0, align = 1;
+
+  for (int placed = 0; placed < 4; ++placed) {
+    int next = -1;
+    for (int i = 0; i < 4; ++i)
+      if (channels[i]->offset < 0
+          && (next < 0 || indices[i] < indices[next]))
+        next = i;
+
+    iio_channel_t* ch = channels[next];
+    offset = (offset + ch->bytes - 1) / ch->bytes * ch->bytes;
+    ch->offset = offset;
+    offset += ch->bytes;
+    if (ch->bytes > align) align = ch->bytes;
+  }
+
+  dev->scan_size = (offset + align - 1) / align * align;
+}
+
+
+static bool setup_scan(iio_dev_t* dev, const char* prefix) {
+  char channel[32];
+  iio_channel_t* channels[4];
+  int indices[4];
+
+  if (!disable_channels(dev->dir))
+    return log_error("Cannot disable scan elements of %s.", dev->dir);
+
+  for (int i = 0; i < 4; ++i) {
+    if (i < 3) snprintf(channel, sizeof(channel), "in_%s_%c", prefix, AXES[i]);
+    else snprintf(channel, sizeof(channel), "in_timestamp");
+
+    channels[i] = i < 3 ? &dev->axes[i] : &dev->timestamp;
+    channels[i]->offset = -1;
+
+    if (!(enable_channel(dev->dir, channel)
+          && read_channel(dev->dir, channel, channels[i], &indices[i])))
+      return log_error("Cannot enable %s of %s.", channel, dev->dir);
+
+    if (i < 3 && channels[i]->bits > 16)
+      return log_error("%s of %s has more than 16 bits.", channel, dev->dir);
+  }
+
+  lay_out(dev, channels, indices);
+  return true;
+}
+
+
+/*
+ * Settings.
+ */
+
+static bool read_gain(iio_dev_t* dev, iio_kind_t kind) {
+  const char* prefix = PREFIXES[kind];
+  char name[64], value[32];
+
+  snprintf(name, sizeof(name), "in_%s_scale", prefix);
+  if (!read_attr(dev->dir, name, value, sizeof(value))) {
+    snprintf(name, sizeof(name), "in_%s_x_scale", prefix);
+    if (!read_attr(dev->dir, name, value, sizeof(value)))
+      return log_error("Cannot read the scale of %s.", dev->dir);
+  }
+
+  // IIO uses [m/s²], [rad/s] and [Ga].
+  float scale = atof(value);
+
+  switch (kind) {
+    case IIO_ACCEL: dev->gain = scale / STANDARD_GRAVITY; break;
+    case IIO_ANGLVEL: dev->gain = scale * 180 / M_PI; break;
+    case IIO_MAGN: dev->gain = scale; break;
+
+    default:
+      assert(0);
+  }
+
+  return true;
+}
+
+
+static void set_rate(iio_dev_t* dev, iio_kind_t kind, float rate) {
+  char name[64], value[32];
+  snprintf(name, sizeof(name), "in_%s_sampling_frequency", PREFIXES[kind]);
+
+  // The frequency is either own or shared by channels.
+  if (!read_attr(dev->dir, name, value, sizeof(value)))
+    snprintf(name, sizeof(name), "sampling_frequency");
+
+  if (rate > 0) {
+    snprintf(value, sizeof(value), "%g", rate);
+    if (!write_attr(dev->dir, name, value))
+      log_warning("Cannot set sampling frequency of %s.", dev->dir);
+  }
+
+  dev->rate = read_attr(dev->dir, name, value, sizeof(value)) ? atof(value)
+                                                              : rate;
+}
+
+
+// Drivers with the data-ready interrupt provide the trigger "<name>-devN".
+static void set_trigger(iio_dev_t* dev) {
+  char trigger[64], name[48];
+
+  if (!read_attr(dev->dir, "trigger/current_trigger", trigger,
+                 sizeof(trigger)) || trigger[0])
+    return;
+
+  const char* number = strrchr(dev->dir, 'e') + 1;  // Of "iio:deviceN".
+
+  if (!read_attr(dev->dir, "name", name, sizeof(name)))
+    return;
+
+  snprintf(trigger, sizeof(trigger), "%s-dev%s", name, number);
+  if (!write_attr(dev->dir, "trigger/current_trigger", trigger))
+    log_warning("Cannot set the trigger %s of %s.", trigger, dev->dir);
+}
+
+
+static bool start(iio_dev_t* dev, const char* root) {
+  // Stamps must be comparable with `uv_hrtime()`.
+  if (!write_attr(dev->dir, "current_timestamp_clock", "monotonic"))
+    log_warning("Cannot set the monotonic clock of %s.", dev->dir);
+
+  set_trigger(dev);
+
+  if (!(write_attr(dev->dir, "buffer/length", BUFFER_LENGTH)
+        && write_attr(dev->dir, "buffer/enable", "1")))
+    return log_error("Cannot enable the buffer of %s.", dev->dir);
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/dev/%s", root, strrchr(dev->dir, '/') + 1);
+
+  if ((dev->fd = open(path, O_RDONLY | O_NONBLOCK)) < 0)
+    return log_error("Cannot open %s: %s.", path, strerror(errno));
+
+  return true;
+}
+
+
+/*
+ * Interface.
+ */
+
+iio_dev_t* iio_open(const char* root, const char* device, iio_kind_t kind,
+                    float rate) {
+  assert(root && device);
+  assert(kind <= IIO_MAGN);
+
+  char* dir = find_dir(root, device);
+  if (!dir) return NULL;
+
+  iio_dev_t* dev = calloc(1, sizeof(iio_dev_t));
+  dev->dir = dir;
+  dev->fd = -1;
+
+  // The buffer can't be reconfigured while it's enabled.
+  write_attr(dir, "buffer/enable", "0");
+
+  bool ok = setup_scan(dev, PREFIXES[kind]) && read_gain(dev, kind);
+  if (ok) set_rate(dev, kind, rate);
+  if (ok) dev->buf = malloc(SENSOR_BATCH_CAPACITY * dev->scan_size);
+
+  if (!(ok && start(dev, root))) {
+    iio_close(dev);
+    return log_error("Cannot open IIO device %s.", device);
+  }
+
+  return dev;
+}
+
+
+static uint64_t decode(const iio_channel_t* ch, const uint8_t* scan) {
+  const uint8_t* p = scan + ch->offset;
+  uint64_t value = 0;
+
+  for (int i = 0; i < ch->bytes; ++i)
+    value |= (uint64_t)p[ch->be ? i : ch->bytes-1 - i] << 8*(ch->bytes-1 - i);
+
+  value >>= ch->shift;
+  if (ch->bits < 64) value &= (1ull << ch->bits) - 1;
+
+  // Sign extension.
+  if (ch->sign && ch->bits < 64 && value >> (ch->bits - 1))
+    value |= ~0ull << ch->bits;
+
+  return value;
+}
+
+
+bool iio_drain(iio_dev_t* dev, sensor_batch_t* batch) {
+  assert(dev && batch);
+
+  int len = read(dev->fd, dev->buf, SENSOR_BATCH_CAPACITY * dev->scan_size);
+  if (len < 0 && errno != EAGAIN)
+    return log_error("Cannot read %s: %s.", dev->dir, strerror(errno));
+
+  int count = len > 0 ? len / dev->scan_size : 0;
+  uint64_t first = 0;
+
+  for (int i = 0; i < count; ++i) {
+    const uint8_t* scan = dev->buf + i * dev->scan_size;
+
+    for (int j = 0; j < 3; ++j)
+      batch->raw[j][i] = (int16_t)decode(&dev->axes[j], scan);
+
+    batch->x[i] = batch->raw[0][i] * dev->gain;
+    batch->y[i] = batch->raw[1][i] * dev->gain;
+    batch->z[i] = batch->raw[2][i] * dev->gain;
+
+    uint64_t stamp = decode(&dev->timestamp, scan);
+    if (i == 0) first = stamp;
+    batch->stamp = stamp;
+  }
+
+  // Kernel stamps are taken by interrupts, so the period is measured.
+  batch->count = count;
+  if (count > 1) batch->period = (batch->stamp - first) / (count - 1);
+  else if (dev->rate > 0) batch->period = 1e9f / dev->rate;
+
+  return true;
+}
+
+
+bool iio_close(iio_dev_t* dev) {
+  assert(dev);
+
+  bool ok = true;
+  if (dev->fd >= 0) {
+    ok = write_attr(dev->dir, "buffer/enable", "0");
+    ok = close(dev->fd) == 0 && ok;
+  }
+
+  if (!ok) log_error("Cannot close %s.", dev->dir);
+
+  free(dev->buf);
+  free(dev->dir);
+  free(dev);
+  return ok;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "devices/sensor_batch.h"
+
+
+/*
+ * 3-axis sensors driven by kernel IIO drivers (adxl345, l3g4200d, hmc5843).
+ * The driver samples into the triggered buffer along with kernel timestamps
+ * of the monotonic clock, so whole blocks of samples are fetched by one
+ * `read()` of /dev/iio:deviceN. The device is set up through sysfs.
+ *
+ * `root` prefixes /sys and /dev paths, so a directory tree with regular files
+ * stands in for the kernel ("" for the system).
+ */
+
+typedef enum {
+  IIO_ACCEL,    //!< in_accel_*, [g]
+  IIO_ANGLVEL,  //!< in_anglvel_*, [°/s]
+  IIO_MAGN      //!< in_magn_*, [Ga]
+} iio_kind_t;
+
+/*! Position and format of the channel in the scan. */
+typedef struct {
+  int offset;
+  int bytes;  //!< Storage size.
+  int bits;   //!< Significant bits.
+  int shift;
+  bool be;
+  bool sign;
+} iio_channel_t;
+
+typedef struct {
+  char* dir;   //!< In sysfs.
+  int fd;
+  float gain;  //!< Of raw measurements.
+  float rate;  //!< Sampling frequency [Hz].
+  iio_channel_t axes[3];
+  iio_channel_t timestamp;
+  int scan_size;
+  uint8_t* buf;  //!< Of `SENSOR_BATCH_CAPACITY` scans.
+} iio_dev_t;
+
+
+/*!
+ * Enable x, y, z and the timestamp and start buffered capture.
+ * @param device  the name of the device (e.g. "adxl345") or "iio:deviceN"
+ * @param rate    sampling frequency to set [Hz], 0 to keep
+ */
+extern iio_dev_t* iio_open(const char* root, const char* device,
+                           iio_kind_t kind, float rate);
+
+/*! Fetch samples captured since the previous call, the oldest first. */
+extern bool iio_drain(iio_dev_t* dev, sensor_batch_t* batch);
+
+extern bool iio_close(iio_dev_t* dev);
@@ -6,8 +6,12 @@
 #include <stdlib.h>
 #include <tgmath.h>
 
+#include <uv.h>
+
 #include "base/logging.h"
 #include "devices/i2c.h"
+#include "devices/i2c_async.h"
+#include "devices/sensor_batch.h"
 
 
 const int8_t L3G4200D_ADDR = 0x69;
@@ -34,6 +38,8 @@ l3g4200d_t* l3g4200d_open(const char* bus, int8_t addr) {
   l3g4200d_t* dev = malloc(sizeof(l3g4200d_t));
   dev->underline = underline;
   dev->gain = NAN;
+  dev->status = 0;
+  dev->rate = NAN;
 
   return dev;
 }
@@ -55,6 +61,8 @@ bool l3g4200d_tune(l3g4200d_t* dev, float rate, float range) {
   if (!(i2c_write(dev->underline, dev->buf, 2)))
     return log_error("Cannot setup l3g4200d (rate = %f).", rate);
 
+  dev->rate = rate;
+
   // Setup range.
   if (range > 2000) log_warning("Too wide range for l3g4200d.");
   dev->buf[0] = 0x23;
@@ -65,21 +73,144 @@ bool l3g4200d_tune(l3g4200d_t* dev, float rate, float range) {
   if (!(i2c_write(dev->underline, dev->buf, 2)))
     return log_error("Cannot setup l3g4200d (range = %f).", range);
 
-  dev->gain = range/32768;
+  // Sensitivity [°/s per digit] from the datasheet.
+  dev->gain = range == 250 ? 8.75e-3f : range == 500 ? 17.5e-3f : 70e-3f;
   return true;
 }
 
 
-bool l3g4200d_update(l3g4200d_t* dev) {
+void l3g4200d_prepare_read(l3g4200d_t* dev, i2c_read_t* rd) {
+  assert(dev && rd);
+
+  rd->dev = dev->underline;
+  rd->reg = 0x80 | 0x28;
+  rd->buf = dev->buf;
+  rd->size = 6;
+}
+
+
+void l3g4200d_decode(l3g4200d_t* dev) {
   assert(dev);
   assert(!isnan(dev->gain));
 
+  dev->raw[0] = dev->buf[1] << 8 | dev->buf[0];
+  dev->raw[1] = dev->buf[3] << 8 | dev->buf[2];
+  dev->raw[2] = dev->buf[5] << 8 | dev->buf[4];
+
+  dev->x = dev->raw[0] * dev->gain;
+  dev->y = dev->raw[1] * dev->gain;
+  dev->z = dev->raw[2] * dev->gain;
+}
+
+
+void l3g4200d_prepare_status(l3g4200d_t* dev, i2c_read_t* rd) {
+  assert(dev && rd);
+
+  rd->dev = dev->underline;
+  rd->reg = 0x27;
+  rd->buf = &dev->status;
+  rd->size = 1;
+}
+
+
+bool l3g4200d_ready(const l3g4200d_t* dev) {
+  assert(dev);
+  return dev->status & 0x08;
+}
+
+
+bool l3g4200d_update(l3g4200d_t* dev) {
+  assert(dev);
+
   if (!i2c_read(dev->underline, 0x80 | 0x28, dev->buf, 6))
     return log_error("Cannot read data from l3g4200d.");
 
-  dev->x = (int16_t)(dev->buf[1] << 8 | dev->buf[0]) * dev->gain;
-  dev->y = (int16_t)(dev->buf[3] << 8 | dev->buf[2]) * dev->gain;
-  dev->z = (int16_t)(dev->buf[5] << 8 | dev->buf[4]) * dev->gain;
+  l3g4200d_decode(dev);
+  return true;
+}
+
+
+static void on_update(void* ctx, bool ok) {
+  l3g4200d_t* dev = ctx;
+  if (ok) l3g4200d_decode(dev);
+  else log_error("Cannot read data from l3g4200d.");
+
+  if (dev->cb) dev->cb(dev->ctx, ok);
+}
+
+
+bool l3g4200d_update_async(l3g4200d_t* dev, i2c_cb cb, void* ctx) {
+  assert(dev);
+
+  dev->cb = cb;
+  dev->ctx = ctx;
+  return i2c_read_async(dev->underline, 0x80 | 0x28, dev->buf, 6, on_update,
+                        dev);
+}
+
+
+static bool write_reg(l3g4200d_t* dev, uint8_t reg, uint8_t value) {
+  dev->buf[0] = reg;
+  dev->buf[1] = value;
+  return i2c_write(dev->underline, dev->buf, 2);
+}
+
+
+bool l3g4200d_stream_start(l3g4200d_t* dev) {
+  assert(dev);
+  assert(!isnan(dev->rate));
+
+  // Stream mode with the watermark at the half and enabled FIFO.
+  if (!(write_reg(dev, 0x2e, 0x40 | 0x10) && write_reg(dev, 0x24, 0x40)))
+    return log_error("Cannot switch l3g4200d to the stream mode.");
+
+  return true;
+}
+
+
+bool l3g4200d_drain(l3g4200d_t* dev, sensor_batch_t* batch) {
+  assert(dev && batch);
+  assert(!isnan(dev->gain));
+
+  uint8_t src;
+  if (!i2c_read(dev->underline, 0x2f, &src, 1))
+    return log_error("Cannot read FIFO status of l3g4200d.");
+
+  uint64_t stamp = uv_hrtime();
+  int count = src & 0x40 ? SENSOR_BATCH_CAPACITY  // Overrun.
+            : src & 0x20 ? 0                      // Empty.
+            : src & 0x1f;
+
+  // The address wraps around to OUT_X_L after OUT_Z_H in the FIFO mode,
+  // so the whole FIFO is drained by one auto-incremented read.
+  uint8_t data[SENSOR_BATCH_CAPACITY][6];
+
+  if (count > 0 && !i2c_read(dev->underline, 0x80 | 0x28, data, 6*count))
+    return log_error("Cannot read FIFO of l3g4200d.");
+
+  for (int i = 0; i < count; ++i) {
+    batch->raw[0][i] = data[i][1] << 8 | data[i][0];
+    batch->raw[1][i] = data[i][3] << 8 | data[i][2];
+    batch->raw[2][i] = data[i][5] << 8 | data[i][4];
+
+    batch->x[i] = batch->raw[0][i] * dev->gain;
+    batch->y[i] = batch->raw[1][i] * dev->gain;
+    batch->z[i] = batch->raw[2][i] * dev->gain;
+  }
+
+  batch->count = count;
+  batch->stamp = stamp;
+  batch->period = 1e9f/dev->rate;
+
+  return true;
+}
+
+
+bool l3g4200d_stream_stop(l3g4200d_t* dev) {
+  assert(dev);
+
+  if (!(write_reg(dev, 0x24, 0x00) && write_reg(dev, 0x2e, 0x00)))
+    return log_error("Cannot switch l3g4200d to the bypass mode.");
 
   return true;
 }
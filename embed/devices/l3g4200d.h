@@ -1,15 +1,24 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "devices/i2c.h"
+#include "devices/i2c_async.h"
+#include "devices/sensor_batch.h"
 
 
 typedef struct {
   i2c_dev_t* underline;
   float gain;
+  float rate;  //!< Output data rate [Hz].
+  int16_t raw[3];  //!< Raw measurements in order x, y, z.
+  uint8_t status;  //!< Fetched by the prepared status read.
   float x, y, z;
   uint8_t buf[6];
+
+  i2c_cb cb;  //!< Of the asynchronous update.
+  void* ctx;
 } l3g4200d_t;
 
 
@@ -18,4 +27,34 @@ extern const int8_t L3G4200D_ADDR;
 extern l3g4200d_t* l3g4200d_open(const char* bus, int8_t addr);
 extern bool l3g4200d_tune(l3g4200d_t* dev, float rate, float range);
 extern bool l3g4200d_update(l3g4200d_t* dev);
+
+/*!
+ * The update through the queue of the bus, see "devices/i2c_async.h".
+ * Measurements are decoded before `cb`.
+ */
+extern bool l3g4200d_update_async(l3g4200d_t* dev, i2c_cb cb, void* ctx);
+
+/*! Describe the data read of `l3g4200d_update()` for `i2c_read_many()`. */
+extern void l3g4200d_prepare_read(l3g4200d_t* dev, i2c_read_t* rd);
+
+/*! Convert the data fetched by the prepared read to measurements. */
+extern void l3g4200d_decode(l3g4200d_t* dev);
+
+/*! Describe the read of the status register for `i2c_read_many()`. */
+extern void l3g4200d_prepare_status(l3g4200d_t* dev, i2c_read_t* rd);
+
+/*! Check ZYXDA of STATUS_REG fetched by the prepared status read. */
+extern bool l3g4200d_ready(const l3g4200d_t* dev);
+
+/*!
+ * Switch to the stream mode: the chip keeps the last 32 samples in the FIFO.
+ * Call `l3g4200d_drain()` before the FIFO overflows (32/rate seconds).
+ */
+extern bool l3g4200d_stream_start(l3g4200d_t* dev);
+
+/*! Fetch all samples stored in the FIFO by one burst read. */
+extern bool l3g4200d_drain(l3g4200d_t* dev, sensor_batch_t* batch);
+
+extern bool l3g4200d_stream_stop(l3g4200d_t* dev);
+
 extern bool l3g4200d_close(l3g4200d_t* dev);
@@ -0,0 +1,216 @@
+#include "devices/pca9685.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "base/logging.h"
+#include "devices/i2c.h"
+#include "devices/i2c_async.h"
+
+
+const int8_t PCA9685_ADDR = 0x40;
+
+// Registers.
+enum {
+  MODE1 = 0x00, MODE2 = 0x01, LED0_ON_L = 0x06, ALL_LED_OFF_H = 0xfd,
+  PRE_SCALE = 0xfe
+};
+
+// Bits of MODE1, LEDn_OFF_H.
+enum {RESTART = 0x80, AI = 0x20, SLEEP = 0x10, FULL_OFF = 0x10};
+
+static const float OSCILLATOR = 25e6;  // [Hz]
+
+#define STAGGER (4096 / PCA9685_CHANNELS)
+
+
+// The chip has no identification register, reserved bits of MODE2 are zero.
+static bool identify(i2c_dev_t* dev) {
+  uint8_t check;
+  return i2c_read(dev, MODE2, &check, 1) && (check & 0xe0) == 0;
+}
+
+
+pca9685_t* pca9685_open(const char* bus, int8_t addr) {
+  assert(bus);
+
+  i2c_dev_t* underline = i2c_open(bus, addr);
+  if (!underline)
+    return log_error("Cannot open pca9685 on %s:%#x.", bus, addr);
+
+  if (!identify(underline))
+    return i2c_close(underline)
+      ? log_error("Device on %s:%#x doesn't pca9685.", bus, addr)
+      : log_error("Cannot close pca9685 on %s:%#x.", bus, addr);
+
+  pca9685_t* dev = malloc(sizeof(pca9685_t));
+  dev->underline = underline;
+  dev->rate = NAN;
+  dev->dirty_lo = PCA9685_CHANNELS;
+  dev->dirty_hi = -1;
+  dev->busy = false;
+
+  for (int i = 0; i < PCA9685_CHANNELS; ++i)
+    dev->ticks[i] = 0;
+
+  return dev;
+}
+
+
+static bool write_reg(pca9685_t* dev, uint8_t reg, uint8_t value) {
+  dev->buf[0] = reg;
+  dev->buf[1] = value;
+  return i2c_write(dev->underline, dev->buf, 2);
+}
+
+
+bool pca9685_tune(pca9685_t* dev, float rate) {
+  assert(dev);
+  assert(rate > 0);
+
+  // The prescaler is written only in the sleep mode.
+  long prescale = lround(OSCILLATOR / (4096 * rate)) - 1;
+  if (prescale < 3 || prescale > 255)
+    log_warning("Unsupported PWM frequency %g Hz for pca9685.", rate);
+
+  prescale = prescale < 3 ? 3 : prescale > 255 ? 255 : prescale;
+
+  if (!(write_reg(dev, MODE1, AI | SLEEP) &&
+        write_reg(dev, ALL_LED_OFF_H, FULL_OFF) &&
+        write_reg(dev, PRE_SCALE, prescale)))
+    return log_error("Cannot setup pca9685 (rate = %f).", rate);
+
+  if (!write_reg(dev, MODE1, AI))
+    return log_error("Cannot wake pca9685 up.");
+
+  // The oscillator is stable in 500 µs, then PWM restarts.
+  struct timespec delay = {0, 500000};
+  nanosleep(&delay, NULL);
+
+  if (!write_reg(dev, MODE1, AI | RESTART))
+    return log_error("Cannot restart pca9685.");
+
+  dev->rate = OSCILLATOR / (4096 * (prescale + 1));
+
+  for (int i = 0; i < PCA9685_CHANNELS; ++i)
+    dev->ticks[i] = 0;
+
+  dev->dirty_lo = PCA9685_CHANNELS;
+  dev->dirty_hi = -1;
+  return true;
+}
+
+
+void pca9685_set(pca9685_t* dev, int channel, uint16_t ticks) {
+  assert(dev);
+  assert(0 <= channel && channel < PCA9685_CHANNELS);
+  assert(ticks < 4096);
+
+  if (dev->ticks[channel] == ticks) return;
+
+  dev->ticks[channel] = ticks;
+  if (channel < dev->dirty_lo) dev->dirty_lo = channel;
+  if (channel > dev->dirty_hi) dev->dirty_hi = channel;
+}
+
+
+// Registers of changed channels from LEDn_ON_L, return the size of the write.
+static uint8_t make_frame(pca9685_t* dev) {
+  int lo = dev->dirty_lo, hi = dev->dirty_hi;
+  uint8_t* regs = &dev->buf[1];
+
+  dev->buf[0] = LED0_ON_L + 4*lo;
+
+  for (int i = lo; i <= hi; ++i, regs += 4) {
+    unsigned on = i * STAGGER;
+    unsigned off = (on + dev->ticks[i]) & 0xfff;
+
+    regs[0] = on & 0xff;
+    regs[1] = on >> 8;
+    regs[2] = off & 0xff;
+    regs[3] = dev->ticks[i] ? off >> 8 : FULL_OFF;
+  }
+
+  dev->dirty_lo = PCA9685_CHANNELS;
+  dev->dirty_hi = -1;
+  return 1 + 4*(hi - lo + 1);
+}
+
+
+// The state of outputs is unknown, the next flush sends all channels.
+static void mark_failed(pca9685_t* dev) {
+  dev->dirty_lo = 0;
+  dev->dirty_hi = PCA9685_CHANNELS - 1;
+}
+
+
+bool pca9685_flush(pca9685_t* dev) {
+  assert(dev);
+  assert(!dev->busy);
+
+  if (dev->dirty_lo > dev->dirty_hi) return true;
+
+  if (!i2c_write(dev->underline, dev->buf, make_frame(dev))) {
+    mark_failed(dev);
+    return log_error("Cannot write channels of pca9685.");
+  }
+
+  return true;
+}
+
+
+static void on_flush(void* ctx, bool ok) {
+  pca9685_t* dev = ctx;
+  dev->busy = false;
+
+  if (!ok) {
+    mark_failed(dev);
+    log_error("Cannot write channels of pca9685.");
+  }
+
+  if (dev->cb) dev->cb(dev->ctx, ok);
+}
+
+
+bool pca9685_flush_async(pca9685_t* dev, i2c_cb cb, void* ctx) {
+  assert(dev);
+  assert(!dev->busy);
+
+  if (dev->dirty_lo > dev->dirty_hi) return true;
+
+  dev->cb = cb;
+  dev->ctx = ctx;
+
+  if (!i2c_write_async(dev->underline, dev->buf, make_frame(dev), on_flush,
+                       dev)) {
+    mark_failed(dev);
+    return false;
+  }
+
+  dev->busy = true;
+  return true;
+}
+
+
+bool pca9685_close(pca9685_t* dev) {
+  assert(dev);
+  bool res = true;
+
+  // The queued frame would be written after outputs are turned off.
+  if (dev->underline->queue) i2c_async_detach(dev->underline);
+  dev->busy = false;
+
+  if (!(write_reg(dev, ALL_LED_OFF_H, FULL_OFF) &&
+        write_reg(dev, MODE1, AI | SLEEP)))
+    res = log_error("Cannot stop pca9685.");
+
+  if (!i2c_close(dev->underline))
+    res = log_error("Cannot close pca9685.");
+
+  free(dev);
+  return res;
+}
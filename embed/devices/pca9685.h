@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "devices/i2c.h"
+#include "devices/i2c_async.h"
+
+
+/*
+ * The 16-channel 12-bit PWM controller. Pulses are staged by `pca9685_set()`
+ * and sent by `pca9685_flush()` as one auto-increment write of registers of
+ * the range of changed channels: up to 65 bytes instead of the transaction
+ * per register. Pulses of channels start 1/16 of the period one after another
+ * to spread the current drawn by servos.
+ */
+
+#define PCA9685_CHANNELS 16
+
+
+typedef struct {
+  i2c_dev_t* underline;
+  float rate;                          //!< PWM frequency [Hz].
+  uint16_t ticks[PCA9685_CHANNELS];    //!< Pulses [1/4096 of the period].
+  int dirty_lo, dirty_hi;              //!< Changed channels, empty if lo > hi.
+  bool busy;                           //!< The asynchronous flush is going.
+  uint8_t buf[1 + 4*PCA9685_CHANNELS];
+
+  i2c_cb cb;  //!< Of the asynchronous flush.
+  void* ctx;
+} pca9685_t;
+
+
+extern const int8_t PCA9685_ADDR;
+
+extern pca9685_t* pca9685_open(const char* bus, int8_t addr);
+
+/*!
+ * Set the PWM frequency (24..1526 Hz), outputs are off until the first flush.
+ * The frequency is rounded to the prescaler, see `rate`.
+ */
+extern bool pca9685_tune(pca9685_t* dev, float rate);
+
+/*! Stage the pulse of the channel, 0 is off, 4095 at most. */
+extern void pca9685_set(pca9685_t* dev, int channel, uint16_t ticks);
+
+/*! Send changed channels, nothing if there are no ones. */
+extern bool pca9685_flush(pca9685_t* dev);
+
+/*!
+ * The flush through the queue of the bus, see "devices/i2c_async.h".
+ * It's not called while `busy`, channels staged meanwhile are sent by
+ * the next flush. Without changed channels `cb` isn't called.
+ */
+extern bool pca9685_flush_async(pca9685_t* dev, i2c_cb cb, void* ctx);
+
+/*!
+ * Turn outputs off (servos are released) and put the chip to sleep. The queued
+ * flush is cancelled, the going one is waited for, `cb` isn't called.
+ */
+extern bool pca9685_close(pca9685_t* dev);
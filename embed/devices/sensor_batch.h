@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+
+#define SENSOR_BATCH_CAPACITY 32
+
+
+/*!
+ * Samples of a 3-axis sensor drained from its FIFO, the oldest first.
+ * Sample `i` is taken at `stamp - (count-1 - i)*period`.
+ */
+typedef struct {
+  int count;
+  uint64_t stamp;   //!< Time of the last sample [ns] (`uv_hrtime()`).
+  uint32_t period;  //!< Time between samples [ns].
+  float x[SENSOR_BATCH_CAPACITY];
+  float y[SENSOR_BATCH_CAPACITY];
+  float z[SENSOR_BATCH_CAPACITY];
+  int16_t raw[3][SENSOR_BATCH_CAPACITY];  //!< Raw measurements of x, y, z.
+} sensor_batch_t;
@@ -1,18 +1,17 @@
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <uv.h>
 
 #include "base/config.h"
 #include "base/logging.h"
 #include "base/node.h"
-#include "nodes/ahrs.h"
-
-static node_t* nodes[] = {&ahrs};
+#include "base/trace.h"
 
 
 static void terminate(int code) {
-  for (int i = 0, len = sizeof(nodes)/sizeof(nodes[0]); i < len; ++i)
-    node_term(nodes[i]);
+  node_term_all();
+  trace_stop();
 
   uv_stop(uv_default_loop());
   exit(code);
@@ -26,12 +25,19 @@ static void signal_handler(uv_signal_t* handle, int signum) {
 }
 
 
+static void on_started(bool ok) {
+  if (!ok) terminate(1);
+}
+
+
 int main(void) {
   cfg_init();
 
-  // Initialize nodes.
-  for (int i = 0, len = sizeof(nodes)/sizeof(nodes[0]); i < len; ++i)
-    if (!node_init(nodes[i])) terminate(1);
+  const char* trace_path = cfg_str("trace:path");
+  if (*trace_path && !trace_start(trace_path)) return 1;
+
+  // Nodes are started along with the loop.
+  if (!node_start_all(on_started)) return 1;
 
   // Add listener to SIGINT.
   uv_signal_t sigint;
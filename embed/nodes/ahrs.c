@@ -1,98 +1,1158 @@
 #include "nodes/ahrs.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <uv.h>
 
 #include "base/aux_math.h"
 #include "base/config.h"
+#include "base/flight_log.h"
 #include "base/logging.h"
+#include "base/metrics.h"
 #include "base/node.h"
 #include "base/pubsub.h"
+#include "base/spsc.h"
+#include "base/trace.h"
+#include "control/attitude_filter.h"
+#include "control/attitude_vote.h"
 #include "control/madgwick_filter.h"
+#include "control/mahony_filter.h"
+#include "control/prefilter.h"
 #include "devices/adxl345.h"
 #include "devices/hmc5883l.h"
+#include "devices/i2c.h"
+#include "devices/iio.h"
 #include "devices/l3g4200d.h"
+#include "devices/sensor_batch.h"
 
 
-event_t ev_ahrs = EVENT_INIT;
+event_t ev_ahrs = EVENT_INIT("ahrs");
+event_t ev_ahrs_raw = EVENT_INIT("ahrs_raw");
 
 
-static uv_timer_t timer_update;
-static uint64_t last_run;
+#define MAX_IMUS 4
 
+// The timer and thread modes: sensors are polled at the rate of the gyroscope.
+// The gyroscope with status registers are read by one combined transaction,
+// the accelerometer and magnetometer are read only if they have new samples.
+// The magnetometer is triggered by its own schedule.
+static const uint64_t MAG_CONVERSION = 7000000;  // [ns]
 
-static adxl345_t* adxl345;
-static hmc5883l_t* hmc5883l;
-static l3g4200d_t* l3g4200d;
-static madgwick_filter_t* filter;
+// The thread mode: sensors are read by the acquisition thread by absolute
+// deadlines, frames are passed to the loop through the ring.
+static const uint32_t RING_CAPACITY = 256;
+
+// The replay mode: frames of the flight log are fused instead of sensors
+// as fast as possible or `warp` times faster than they were recorded.
+static const int REPLAY_BATCH = 1024;
+
+
+typedef struct worker_s worker_t;
+
+/*
+ * The IMU described by the config section (e.g. [gy-80]) with own sensors
+ * and filter. In the thread mode IMUs are read by acquisition threads, one
+ * per bus, so IMUs on different buses are read in parallel. Other modes poll
+ * IMUs on the loop one after another.
+ */
+typedef struct {
+  const char* section;
+  int index;
+
+  // Settings of the section, they are read before IMUs are probed in parallel.
+  const char* replay_path;
+  const char* iio_devices;
+  const char* iio_root;
+  const char* bus;
+  const char* acc_prefilter_spec;
+  const char* gyro_prefilter_spec;
+  float rates[3];  // By FLIGHT_ACC, FLIGHT_MAG, FLIGHT_GYRO [Hz].
+  bool mlock;
+
+  bool alive;        // Not stopped by a failure.
+  bool outlier;      // Disagrees with other IMUs.
+  uint64_t updated;  // Time of the last update of the attitude [ns].
+  bool unvoted;      // Updated since the last vote.
+
+  uv_timer_t timer_update;
+
+  adxl345_t* adxl345;
+  hmc5883l_t* hmc5883l;
+  l3g4200d_t* l3g4200d;
+  attitude_filter_t filter;
+  attitude_fusion_t fusion;
+  float rate;  // Of the gyroscope and polling [Hz].
+
+  // The latest measurements of all sensors.
+  flight_frame_t frame;
+
+  i2c_read_t polls[4];
+  i2c_read_t fetches[2];
+  uint64_t mag_period;  // [ns]
+  uint64_t mag_due;     // Time to start the next measurement [ns].
+  uint64_t mag_check;   // Time to check RDY, 0 if nothing is started [ns].
+
+  // The stream mode: FIFOs of adxl345 and l3g4200d are drained by batches.
+  bool stream;
+  sensor_batch_t acc_batch, gyro_batch;
+  prefilter_t acc_prefilter, gyro_prefilter;  // Of oversampled batches.
+  float samples[3][3];  // Fused instead of `raw` of the frame, not rounded.
+
+  // The IIO mode is the stream mode with buffers of kernel drivers instead of
+  // FIFOs, samples are stamped by the kernel.
+  iio_dev_t* iio[3];  // By FLIGHT_ACC, FLIGHT_MAG, FLIGHT_GYRO.
+  sensor_batch_t mag_batch;
+
+  bool use_thread;
+  bool threaded;
+  worker_t* worker;
+  uv_async_t async_samples;
+  spsc_t ring;
+  flight_frame_t acquired;  // Owned by the thread.
+  uint64_t period;     // [ns]
+  uint64_t next;       // The deadline of polling [ns], owned by the thread.
+  int priority;        // SCHED_FIFO priority, 0 to keep.
+  int cpu;             // -1 to keep.
+  bool running;        // Accessed atomically.
+  bool failed;         // Accessed atomically.
+  uint32_t misses;     // Accessed atomically.
+  uint32_t overflows;  // Accessed atomically.
+
+  flight_log_t* replay;
+  uv_idle_t idle_replay;
+  double warp;
+  bool pending;            // `frame` is read, but isn't fused yet.
+  uint64_t replay_origin;  // Stamp of the first frame [ns].
+  uint64_t replay_start;   // [ns]
+  uint64_t replayed;
+
+  bool probed;  // By the thread of the probe.
+
+  // "ahrs.<section>.*": durations of polling (of draining in the stream mode),
+  // lateness of ticks relative to their deadlines, durations of updates of
+  // the filter and of publishing the attitude.
+  uint64_t ticked;  // Time of the previous tick of the timer [ns].
+  histogram_t tick_latency;
+  histogram_t lateness;
+  histogram_t filter_latency;
+  histogram_t publish_latency;
+  counter_t deadline_misses;
+} imu_t;
+
+
+/*
+ * The acquisition thread of IMUs on the same bus. Transactions of the bus go
+ * one after another anyway, so IMUs are polled in turn by own deadlines.
+ * The thread is set up by settings of the first IMU.
+ */
+struct worker_s {
+  const char* bus;
+  imu_t* imus[MAX_IMUS];
+  int count;
+  int polled;        // IMUs which aren't stopped by the loop.
+  bool started;
+  uv_thread_t thread;
+  uv_mutex_t lock;   // Held while the IMU is polled, so it's stopped safely.
+};
+
+
+static imu_t imus[MAX_IMUS];
+static int imu_count;
+static worker_t workers[MAX_IMUS];
+static int worker_count;
+static char sections[256];  // Names of sections of IMUs.
+
+static const char* filter_name;
+static float filter_gains[2];  // Beta of madgwick or kp, ki of mahony.
+
+static bool use_mag;      // Or fuse only the gyroscope and accelerometer.
+static float max_angle;   // Between agreeing IMUs [rad].
+static uint64_t stale;    // Age of attitudes of ignored IMUs [ns].
+
+
+/*
+ * Settings of the IMU.
+ */
+
+#define IMU_KEY(key, imu, name)                                               \
+  char key[64];                                                               \
+  snprintf(key, sizeof(key), "%s:%s", (imu)->section, name)
+
+static const char* imu_str(const imu_t* imu, const char* name) {
+  IMU_KEY(key, imu, name);
+  return cfg_str(key);
+}
+
+
+static int imu_int(const imu_t* imu, const char* name) {
+  IMU_KEY(key, imu, name);
+  return cfg_int(key);
+}
+
+
+static double imu_double(const imu_t* imu, const char* name) {
+  IMU_KEY(key, imu, name);
+  return cfg_double(key);
+}
+
+
+static bool imu_bool(const imu_t* imu, const char* name) {
+  IMU_KEY(key, imu, name);
+  return cfg_bool(key);
+}
+
+
+static void stop_thread(imu_t* imu) {
+  worker_t* worker = imu->worker;
+
+  // The thread doesn't touch the IMU after it's unlocked.
+  uv_mutex_lock(&worker->lock);
+  __atomic_store_n(&imu->running, false, __ATOMIC_RELEASE);
+  uv_mutex_unlock(&worker->lock);
+
+  if (--worker->polled == 0) {
+    if (worker->started) uv_thread_join(&worker->thread);
+    uv_mutex_destroy(&worker->lock);
+  }
+
+  uv_close((uv_handle_t*)&imu->async_samples, NULL);
+  spsc_free(&imu->ring);
+  imu->threaded = false;
+
+  if (imu->misses || imu->overflows)
+    log_warning("Acquisition thread of %s missed %u deadlines, lost %u "
+                "samples.", imu->section, imu->misses, imu->overflows);
+}
+
+
+// Release what the probe has acquired, handles are left as is.
+static void release(imu_t* imu) {
+  if (imu->replay) flight_log_close(imu->replay);
+  if (imu->filter.state) attitude_filter_stop(&imu->filter);
+  if (imu->adxl345) adxl345_close(imu->adxl345);
+  if (imu->hmc5883l) hmc5883l_close(imu->hmc5883l);
+  if (imu->l3g4200d) l3g4200d_close(imu->l3g4200d);
+
+  for (int i = 0; i < 3; ++i) {
+    if (imu->iio[i]) iio_close(imu->iio[i]);
+    imu->iio[i] = NULL;
+  }
+
+  imu->replay = NULL;
+  imu->filter.state = NULL;
+  imu->adxl345 = NULL;
+  imu->hmc5883l = NULL;
+  imu->l3g4200d = NULL;
+}
+
+
+static void stop(imu_t* imu) {
+  uv_timer_stop(&imu->timer_update);
+  uv_idle_stop(&imu->idle_replay);
+  if (imu->threaded) stop_thread(imu);
+  release(imu);
+  imu->alive = false;
+}
+
+
+static void register_metrics(imu_t* imu) {
+  const char* name = imu->section;
+
+  histogram_register(&imu->tick_latency, "ahrs.%s.tick", name);
+  histogram_register(&imu->lateness, "ahrs.%s.lateness", name);
+  histogram_register(&imu->filter_latency, "ahrs.%s.filter", name);
+  histogram_register(&imu->publish_latency, "ahrs.%s.publish", name);
+  counter_register(&imu->deadline_misses, "ahrs.%s.misses", name);
+}
+
+
+static void unregister_metrics(imu_t* imu) {
+  histogram_unregister(&imu->tick_latency);
+  histogram_unregister(&imu->lateness);
+  histogram_unregister(&imu->filter_latency);
+  histogram_unregister(&imu->publish_latency);
+  counter_unregister(&imu->deadline_misses);
+}
 
 
 static void term(void) {
-  uv_timer_stop(&timer_update);
-  if (filter) madgwick_filter_stop(filter);
-  if (adxl345) adxl345_close(adxl345);
-  if (hmc5883l) hmc5883l_close(hmc5883l);
-  if (l3g4200d) l3g4200d_close(l3g4200d);
+  for (int i = 0; i < imu_count; ++i) {
+    stop(&imus[i]);
+    unregister_metrics(&imus[i]);
+  }
+}
+
+
+// Other IMUs keep going.
+static void fail(imu_t* imu) {
+  log_error("Failure while updating %s. Stopped.", imu->section);
+  stop(imu);
+
+  bool any = false;
+  for (int i = 0; i < imu_count; ++i)
+    any = any || imus[i].alive;
+
+  if (!any) log_error("No IMU is alive, ahrs is stopped.");
+}
+
+
+// Publish the attitude combined by fresh IMUs once per round: when every
+// fresh IMU has updated since the previous vote, so the output goes at the
+// rate of the slowest one. A silent IMU delays rounds until it's stale.
+static void publish_attitude(imu_t* imu) {
+  float* attitude = attitude_filter_attitude(&imu->filter);
+
+  if (imu_count == 1) {
+    uint64_t start = metrics_now();
+    publish(&ev_ahrs, attitude);
+    histogram_record(&imu->publish_latency, metrics_now() - start);
+    return;
+  }
+
+  uint64_t now = uv_hrtime();
+  imu->updated = now;
+  imu->unvoted = true;
+
+  for (int i = 0; i < imu_count; ++i) {
+    imu_t* other = &imus[i];
+    if (other->alive && now - other->updated <= stale && !other->unvoted)
+      return;
+  }
+
+  const float* q[MAX_IMUS];
+  imu_t* voters[MAX_IMUS];
+  bool outliers[MAX_IMUS];
+  int count = 0;
+
+  for (int i = 0; i < imu_count; ++i) {
+    imu_t* other = &imus[i];
+    if (!other->alive || now - other->updated > stale) continue;
+
+    q[count] = attitude_filter_attitude(&other->filter);
+    voters[count++] = other;
+    other->unvoted = false;
+  }
+
+  float combined[4];
+  attitude_vote(q, count, max_angle, combined, outliers);
+
+  for (int i = 0; i < count; ++i) {
+    if (voters[i]->outlier == outliers[i]) continue;
+
+    voters[i]->outlier = outliers[i];
+    if (outliers[i])
+      log_warning("%s disagrees with other IMUs, it's ignored.",
+                  voters[i]->section);
+    else
+      log_info("%s agrees with other IMUs again.", voters[i]->section);
+  }
+
+  uint64_t start = metrics_now();
+  publish(&ev_ahrs, combined);
+  histogram_record(&imu->publish_latency, metrics_now() - start);
+}
+
+
+// Start the single measurement of the magnetometer when it's due, its RDY
+// is checked after the conversion.
+static bool trigger_mag(imu_t* imu, uint64_t now) {
+  if (!use_mag || imu->mag_check || now < imu->mag_due)
+    return true;
+
+  if (!hmc5883l_trigger(imu->hmc5883l))
+    return false;
+
+  imu->mag_check = now + MAG_CONVERSION;
+  imu->mag_due = imu->mag_due + imu->mag_period > now
+               ? imu->mag_due + imu->mag_period : now + imu->mag_period;
+  return true;
+}
+
+
+// Read new samples to the frame, `fresh` is set if the gyroscope has one.
+static bool poll(imu_t* imu, flight_frame_t* fr, bool* fresh) {
+  uint64_t before = uv_hrtime();
+  bool check_mag = imu->mag_check && before >= imu->mag_check;
+
+  if (!i2c_read_many(imu->polls, check_mag ? 4 : 3))
+    return false;
+
+  uint64_t after = uv_hrtime();
+  uint64_t stamp = before + (after - before)/2;
+
+  bool acc = adxl345_ready(imu->adxl345);
+  bool mag = check_mag && hmc5883l_ready(imu->hmc5883l);
+  int count = 0;
+
+  if (acc) adxl345_prepare_read(imu->adxl345, &imu->fetches[count++]);
+  if (mag) hmc5883l_prepare_read(imu->hmc5883l, &imu->fetches[count++]);
+
+  if (count > 0 && !i2c_read_many(imu->fetches, count))
+    return false;
+
+  if ((*fresh = l3g4200d_ready(imu->l3g4200d))) {
+    l3g4200d_decode(imu->l3g4200d);
+    memcpy(fr->raw[FLIGHT_GYRO], imu->l3g4200d->raw,
+           sizeof(imu->l3g4200d->raw));
+    fr->stamp[FLIGHT_GYRO] = stamp;
+  }
+
+  if (acc) {
+    adxl345_decode(imu->adxl345);
+    memcpy(fr->raw[FLIGHT_ACC], imu->adxl345->raw, sizeof(imu->adxl345->raw));
+    fr->stamp[FLIGHT_ACC] = stamp;
+  }
+
+  if (mag) {
+    hmc5883l_decode(imu->hmc5883l);
+    memcpy(fr->raw[FLIGHT_MAG], imu->hmc5883l->raw,
+           sizeof(imu->hmc5883l->raw));
+    fr->stamp[FLIGHT_MAG] = stamp;
+    imu->mag_check = 0;
+  }
+
+  return trigger_mag(imu, stamp);
+}
+
+
+// Update the filter by the frame or by `samples` stamped by the frame if they
+// are given, see `attitude_filter_fuse()`.
+static void fuse(imu_t* imu, flight_frame_t* fr, float samples[3][3]) {
+  uint64_t span = trace_begin();
+  uint64_t start = metrics_now();
+
+  if (samples)
+    attitude_filter_fuse(&imu->filter, &imu->fusion, samples, fr->stamp,
+                         use_mag);
+  else
+    attitude_filter_fuse_frame(&imu->filter, &imu->fusion, fr, use_mag);
+
+  histogram_record(&imu->filter_latency, metrics_now() - start);
+  trace_end(span, "filter", imu->section);
+
+  if (imu->index == 0) publish(&ev_ahrs_raw, fr);
+}
+
+
+// Ticks later than the next deadline are counted as misses.
+static void account_tick(imu_t* imu, uint64_t now) {
+  uint64_t interval = now - imu->ticked;
+  imu->ticked = now;
+
+  if (interval <= imu->period) {
+    histogram_record(&imu->lateness, 0);
+    return;
+  }
+
+  histogram_record(&imu->lateness, interval - imu->period);
+  if (interval >= 2 * imu->period)
+    counter_add(&imu->deadline_misses, interval/imu->period - 1);
 }
 
 
 static void update(uv_timer_t* timer) {
-  bool ok = adxl345_update(adxl345)
-         && hmc5883l_update(hmc5883l)
-         && l3g4200d_update(l3g4200d);
+  imu_t* imu = timer->data;
+  bool fresh;
+
+  uint64_t span = trace_begin();
+  uint64_t start = uv_hrtime();
+  account_tick(imu, start);
+
+  if (!poll(imu, &imu->frame, &fresh)) {
+    fail(imu);
+    return;
+  }
+
+  histogram_record(&imu->tick_latency, uv_hrtime() - start);
+
+  if (fresh) {
+    fuse(imu, &imu->frame, NULL);
+    publish_attitude(imu);
+  }
+
+  trace_end(span, "ahrs.update", imu->section);
+  uv_update_time(uv_default_loop());
+}
+
+
+// The magnetometer isn't buffered, it's measured as in the polling mode and
+// stamped only by new samples.
+static bool drain_fifos(imu_t* imu, flight_frame_t* fr) {
+  if (!(adxl345_drain(imu->adxl345, &imu->acc_batch)
+        && l3g4200d_drain(imu->l3g4200d, &imu->gyro_batch)))
+    return false;
+
+  uint64_t now = uv_hrtime();
+
+  if (imu->mag_check && now >= imu->mag_check) {
+    if (!i2c_read_many(&imu->polls[3], 1))
+      return false;
+
+    if (hmc5883l_ready(imu->hmc5883l)) {
+      if (!hmc5883l_update(imu->hmc5883l))
+        return false;
+
+      memcpy(fr->raw[FLIGHT_MAG], imu->hmc5883l->raw,
+             sizeof(imu->hmc5883l->raw));
+      fr->stamp[FLIGHT_MAG] = now;
+      imu->mag_check = 0;
+    }
+  }
+
+  return trigger_mag(imu, now);
+}
+
+
+static bool drain_iio(imu_t* imu, flight_frame_t* fr) {
+  sensor_batch_t* mag_batch = &imu->mag_batch;
+
+  if (!(iio_drain(imu->iio[FLIGHT_ACC], &imu->acc_batch)
+        && iio_drain(imu->iio[FLIGHT_GYRO], &imu->gyro_batch)
+        && iio_drain(imu->iio[FLIGHT_MAG], mag_batch)))
+    return false;
+
+  if (mag_batch->count > 0) {
+    for (int k = 0; k < 3; ++k)
+      fr->raw[FLIGHT_MAG][k] = mag_batch->raw[k][mag_batch->count-1];
+    fr->stamp[FLIGHT_MAG] = mag_batch->stamp;
+  }
+
+  return true;
+}
+
+
+static void update_stream(uv_timer_t* timer) {
+  imu_t* imu = timer->data;
+  sensor_batch_t* acc_batch = &imu->acc_batch;
+  sensor_batch_t* gyro_batch = &imu->gyro_batch;
+  flight_frame_t* fr = &imu->frame;
+
+  uint64_t span = trace_begin();
+  uint64_t start = metrics_now();
+  bool ok = imu->iio[FLIGHT_GYRO] ? drain_iio(imu, fr) : drain_fifos(imu, fr);
 
   if (!ok) {
-    log_error("Failure while updating ahrs data. Stopped.");
-    term();
+    fail(imu);
     return;
   }
 
-  uint64_t new_last_run = uv_hrtime();
+  histogram_record(&imu->tick_latency, metrics_now() - start);
+
+  prefilter_run(&imu->acc_prefilter, acc_batch);
+  prefilter_run(&imu->gyro_prefilter, gyro_batch);
+
+  // Filtered samples keep the resolution gained by decimation, the frame
+  // gets them rounded to LSBs for the flight log.
+  float (*v)[3] = imu->samples;
+  for (int k = 0; k < 3; ++k)
+    v[FLIGHT_MAG][k] = fr->raw[FLIGHT_MAG][k] * fr->gain[FLIGHT_MAG];
+
+  // Every gyroscope sample is fused with the latest accelerometer sample,
+  // the attitude is published at the rate of fusion, not of draining.
+  int j = 0;
+  for (int i = 0; i < gyro_batch->count; ++i) {
+    uint64_t t = gyro_batch->stamp
+               - (uint64_t)(gyro_batch->count-1 - i) * gyro_batch->period;
+    if (t <= imu->fusion.last_run) continue;
+
+    for (; j < acc_batch->count; ++j) {
+      uint64_t ta = acc_batch->stamp
+                  - (uint64_t)(acc_batch->count-1 - j) * acc_batch->period;
+      if (ta > t) break;
+
+      for (int k = 0; k < 3; ++k)
+        fr->raw[FLIGHT_ACC][k] = acc_batch->raw[k][j];
+      fr->stamp[FLIGHT_ACC] = ta;
 
-  madgwick_filter_update(filter,
-    deg_to_rad(l3g4200d->x), deg_to_rad(l3g4200d->y), deg_to_rad(l3g4200d->z),
-    adxl345->x, adxl345->y, adxl345->z,
-    hmc5883l->x, hmc5883l->y, hmc5883l->z,
-    (new_last_run - last_run)/1e9f);
+      v[FLIGHT_ACC][0] = acc_batch->x[j];
+      v[FLIGHT_ACC][1] = acc_batch->y[j];
+      v[FLIGHT_ACC][2] = acc_batch->z[j];
+    }
 
-  last_run = new_last_run;
-  publish(&ev_ahrs, filter->attitude);
+    for (int k = 0; k < 3; ++k)
+      fr->raw[FLIGHT_GYRO][k] = gyro_batch->raw[k][i];
+    fr->stamp[FLIGHT_GYRO] = t;
 
+    v[FLIGHT_GYRO][0] = gyro_batch->x[i];
+    v[FLIGHT_GYRO][1] = gyro_batch->y[i];
+    v[FLIGHT_GYRO][2] = gyro_batch->z[i];
+
+    fuse(imu, fr, v);
+    publish_attitude(imu);
+  }
+
+  trace_end(span, "ahrs.update_stream", imu->section);
   uv_update_time(uv_default_loop());
 }
 
 
-static bool init(void) {
-  // It's necessary to initialize the timer before the termination.
-  uv_timer_init(uv_default_loop(), &timer_update);
-  adxl345 = NULL;
-  hmc5883l = NULL;
-  l3g4200d = NULL;
-  filter = NULL;
-
-  const char* bus = cfg_str("gy-80:bus");
-  float rate = cfg_double("gy-80:rate");
-
-  bool ok = (adxl345 = adxl345_open(bus, ADXL345_ADDR))
-         && (hmc5883l = hmc5883l_open(bus, HMC5883L_ADDR))
-         && (l3g4200d = l3g4200d_open(bus, L3G4200D_ADDR))
-         && (filter = madgwick_filter_start(MADGWICK_FILTER_BETA))
-         && adxl345_tune(adxl345, rate, 4.0f)
-         && hmc5883l_tune(hmc5883l, rate, 4.0f)
-         && l3g4200d_tune(l3g4200d, rate, 250.0f);
+static void setup_thread(const imu_t* imu) {
+  if (imu->priority > 0) {
+    struct sched_param param = {.sched_priority = imu->priority};
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err) log_warning("Cannot set SCHED_FIFO priority %d: %s.",
+                         imu->priority, strerror(err));
+  }
+
+  if (imu->cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(imu->cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err) log_warning("Cannot pin acquisition thread to CPU %d: %s.",
+                         imu->cpu, strerror(err));
+  }
+}
+
+
+// Poll the IMU by its deadline, pass the fresh frame to the loop.
+static void acquire_imu(imu_t* imu) {
+  uint64_t next = imu->next;
+  uint64_t period = imu->period;
+  uint64_t start = uv_hrtime();
+  histogram_record(&imu->lateness, start > next ? start - next : 0);
+
+  bool fresh;
+
+  if (!poll(imu, &imu->acquired, &fresh)) {
+    __atomic_store_n(&imu->running, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&imu->failed, true, __ATOMIC_RELEASE);
+    uv_async_send(&imu->async_samples);
+    return;
+  }
+
+  uint64_t after = uv_hrtime();
+  histogram_record(&imu->tick_latency, after - start);
+
+  if (fresh) {
+    if (!spsc_push(&imu->ring, &imu->acquired))
+      __atomic_add_fetch(&imu->overflows, 1, __ATOMIC_RELAXED);
+
+    uv_async_send(&imu->async_samples);
+  }
+
+  // Skip the deadlines which have already passed.
+  if (after > next + period) {
+    uint64_t missed = (after - next)/period;
+    __atomic_add_fetch(&imu->misses, missed, __ATOMIC_RELAXED);
+    counter_add(&imu->deadline_misses, missed);
+    next += missed * period;
+  }
+
+  imu->next = next + period;
+}
+
+
+static void acquire(void* arg) {
+  worker_t* worker = arg;
+  setup_thread(worker->imus[0]);
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  uint64_t now = deadline.tv_sec * 1000000000ull + deadline.tv_nsec;
+
+  for (int i = 0; i < worker->count; ++i)
+    worker->imus[i]->next = now + worker->imus[i]->period;
+
+  for (;;) {
+    // The nearest deadline of running IMUs, the thread ends without them.
+    uint64_t next = UINT64_MAX;
+
+    for (int i = 0; i < worker->count; ++i) {
+      imu_t* imu = worker->imus[i];
+      if (__atomic_load_n(&imu->running, __ATOMIC_ACQUIRE) && imu->next < next)
+        next = imu->next;
+    }
+
+    if (next == UINT64_MAX) return;
+
+    // Deadlines are absolute, so periods don't drift.
+    deadline.tv_sec = next / 1000000000;
+    deadline.tv_nsec = next % 1000000000;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)
+           == EINTR);
+
+    // `uv_hrtime()` uses the monotonic clock too.
+    uint64_t woken = uv_hrtime();
+
+    for (int i = 0; i < worker->count; ++i) {
+      imu_t* imu = worker->imus[i];
+      if (imu->next > woken) continue;
+
+      uv_mutex_lock(&worker->lock);
+      if (__atomic_load_n(&imu->running, __ATOMIC_ACQUIRE)) acquire_imu(imu);
+      uv_mutex_unlock(&worker->lock);
+    }
+  }
+}
+
+
+static void consume(uv_async_t* handle) {
+  imu_t* imu = handle->data;
+
+  if (__atomic_load_n(&imu->failed, __ATOMIC_ACQUIRE)) {
+    fail(imu);
+    return;
+  }
+
+  uint64_t span = trace_begin();
+  bool any = false;
+
+  while (spsc_pop(&imu->ring, &imu->frame)) {
+    fuse(imu, &imu->frame, NULL);
+    any = true;
+  }
+
+  if (any) publish_attitude(imu);
+  trace_end(span, "ahrs.consume", imu->section);
+}
+
+
+static bool start_thread(imu_t* imu) {
+  if (imu->mlock && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+    log_warning("Cannot lock memory: %s.", strerror(errno));
+
+  if (!spsc_init(&imu->ring, sizeof(flight_frame_t), RING_CAPACITY))
+    return log_error("Cannot allocate the ring of samples.");
+
+  imu->period = 1e9/imu->rate;
+  imu->acquired = imu->frame;
+  imu->misses = imu->overflows = 0;
+  imu->failed = false;
+  imu->running = true;
+
+  uv_async_init(uv_default_loop(), &imu->async_samples, consume);
+  imu->async_samples.data = imu;
+  imu->fusion.last_run = uv_hrtime();
+
+  // IMUs on the same bus share the worker, it's started by `init()`.
+  worker_t* worker = NULL;
+  for (int i = 0; i < worker_count && !worker; ++i)
+    if (strcmp(workers[i].bus, imu->bus) == 0)
+      worker = &workers[i];
+
+  if (!worker) {
+    worker = &workers[worker_count++];
+    worker->bus = imu->bus;
+    worker->count = worker->polled = 0;
+    worker->started = false;
+    uv_mutex_init(&worker->lock);
+  }
+
+  worker->imus[worker->count++] = imu;
+  ++worker->polled;
+  imu->worker = worker;
+  imu->threaded = true;
+  return true;
+}
+
+
+static bool start_workers(void) {
+  for (int i = 0; i < worker_count; ++i) {
+    worker_t* worker = &workers[i];
+
+    if (uv_thread_create(&worker->thread, acquire, worker) < 0)
+      return log_error("Cannot create the acquisition thread of %s.",
+                       worker->bus);
+
+    worker->started = true;
+  }
+
+  return true;
+}
+
+
+static void finish_replay(imu_t* imu) {
+  uv_timer_stop(&imu->timer_update);
+  uv_idle_stop(&imu->idle_replay);
+
+  double elapsed = (uv_hrtime() - imu->replay_start)/1e9;
+  double flight = (imu->fusion.last_run - imu->replay_origin)/1e9;
+
+  log_info("Replayed %llu frames (%.1f s of flight) in %.3f s, %.0f frames/s.",
+           (unsigned long long)imu->replayed, flight, elapsed,
+           imu->replayed/elapsed);
+
+  const float* q = attitude_filter_attitude(&imu->filter);
+  log_info("Final attitude: %.6f %.6f %.6f %.6f.", q[0], q[1], q[2], q[3]);
+}
+
+
+static void replay_frames(imu_t* imu) {
+  uint64_t until = UINT64_MAX;
+  if (imu->warp > 0)
+    until = imu->replay_origin
+          + (uv_hrtime() - imu->replay_start) * imu->warp;
+
+  for (int i = 0; i < REPLAY_BATCH; ++i) {
+    if (!imu->pending
+        && !(imu->pending = flight_log_next(imu->replay, &imu->frame))) {
+      finish_replay(imu);
+      return;
+    }
+
+    if (imu->frame.stamp[FLIGHT_GYRO] > until) break;
+
+    fuse(imu, &imu->frame, NULL);
+    publish_attitude(imu);
+    imu->pending = false;
+    ++imu->replayed;
+  }
+}
+
+
+static void replay_fast(uv_idle_t* handle) {
+  uint64_t span = trace_begin();
+  replay_frames(handle->data);
+  trace_end(span, "ahrs.replay", NULL);
+}
+
+
+static void replay_warped(uv_timer_t* timer) {
+  uint64_t span = trace_begin();
+  replay_frames(timer->data);
+  trace_end(span, "ahrs.replay", NULL);
+}
+
+
+static bool open_replay(imu_t* imu, const char* path) {
+  if (!(imu->replay = flight_log_open(path)))
+    return false;
+
+  if (!(imu->pending = flight_log_next(imu->replay, &imu->frame)))
+    return log_error("The flight log %s is empty.", path);
+
+  imu->replay_origin = imu->fusion.last_run = imu->frame.stamp[FLIGHT_GYRO];
+  imu->replayed = 0;
+
+  log_info("Replaying %llu frames of %s.",
+           (unsigned long long)flight_log_frames(imu->replay), path);
+
+  return true;
+}
+
+
+static void start_replay(imu_t* imu) {
+  imu->replay_start = uv_hrtime();
+
+  if (imu->warp > 0)
+    uv_timer_start(&imu->timer_update, replay_warped, 1, 1);
+  else
+    uv_idle_start(&imu->idle_replay, replay_fast);
+}
+
+
+static bool read_filter(void) {
+  filter_name = cfg_str("ahrs:filter");
+
+  if (strcmp(filter_name, "madgwick") == 0) {
+    filter_gains[0] = cfg_double("ahrs:beta");
+  } else if (strcmp(filter_name, "mahony") == 0) {
+    filter_gains[0] = cfg_double("ahrs:kp");
+    filter_gains[1] = cfg_double("ahrs:ki");
+  } else {
+    return log_error("Unknown attitude filter '%s'.", filter_name);
+  }
+
+  return true;
+}
+
+
+static bool start_filter(imu_t* imu) {
+  attitude_filter_t* filter = &imu->filter;
+
+  if (strcmp(filter_name, "madgwick") == 0) {
+    filter->ops = &madgwick_filter_ops;
+    filter->state = madgwick_filter_start(filter_gains[0]);
+  } else {
+    filter->ops = &mahony_filter_ops;
+    filter->state = mahony_filter_start(filter_gains[0], filter_gains[1]);
+  }
+
+  return filter->state != NULL;
+}
+
+
+// Sensors can be oversampled, then prefilters decimate them to the fusion rate.
+static bool start_prefilters(imu_t* imu, float acc_rate, float gyro_rate) {
+  const float* gain = imu->frame.gain;
+
+  return prefilter_start(&imu->acc_prefilter, imu->acc_prefilter_spec,
+                         acc_rate, gain[FLIGHT_ACC])
+      && prefilter_start(&imu->gyro_prefilter, imu->gyro_prefilter_spec,
+                         gyro_rate, gain[FLIGHT_GYRO]);
+}
+
+
+// Devices are listed in order of the accelerometer, magnetometer, gyroscope.
+static bool open_iio(imu_t* imu) {
+  static const iio_kind_t kinds[3] = {IIO_ACCEL, IIO_MAGN, IIO_ANGLVEL};
+
+  char names[128];
+  snprintf(names, sizeof(names), "%s", imu->iio_devices);
+
+  char* saveptr;
+  char* name = strtok_r(names, " ,", &saveptr);
+
+  for (int i = 0; i < 3; ++i, name = strtok_r(NULL, " ,", &saveptr)) {
+    if (!name)
+      return log_error("%s:iio must list 3 devices.", imu->section);
+
+    iio_dev_t* dev = iio_open(imu->iio_root, name, kinds[i], imu->rates[i]);
+    if (!(imu->iio[i] = dev)) return false;
+
+    if (!(dev->rate > 0))
+      return log_error("Unknown sampling frequency of %s.", name);
+
+    imu->frame.gain[i] = dev->gain;
+  }
+
+  if (imu->use_thread) {
+    log_warning("The thread mode is ignored in the IIO mode.");
+    imu->use_thread = false;
+  }
+
+  imu->rate = imu->iio[FLIGHT_GYRO]->rate;
+  imu->stream = true;
+  imu->mag_batch.count = 0;
+  return start_prefilters(imu, imu->iio[FLIGHT_ACC]->rate, imu->rate);
+}
+
+
+// Open and tune sensors or the flight log, nothing is started yet.
+static bool probe_imu(imu_t* imu) {
+  if (*imu->replay_path) {
+    if (!(start_filter(imu) && open_replay(imu, imu->replay_path)))
+      goto failure;
+
+    return true;
+  }
+
+  if (*imu->iio_devices) {
+    memset(&imu->frame, 0, sizeof(imu->frame));
+    if (!(start_filter(imu) && open_iio(imu)))
+      goto failure;
+
+    return true;
+  }
+
+  const char* bus = imu->bus;
+  float acc_rate = imu->rates[FLIGHT_ACC];
+  float mag_rate = imu->rates[FLIGHT_MAG];
+  imu->rate = imu->rates[FLIGHT_GYRO];
+
+  bool ok = (imu->adxl345 = adxl345_open(bus, ADXL345_ADDR))
+         && (imu->hmc5883l = hmc5883l_open(bus, HMC5883L_ADDR))
+         && (imu->l3g4200d = l3g4200d_open(bus, L3G4200D_ADDR))
+         && start_filter(imu)
+         && adxl345_tune(imu->adxl345, acc_rate, 4.0f)
+         && hmc5883l_tune(imu->hmc5883l, mag_rate, 4.0f)
+         && l3g4200d_tune(imu->l3g4200d, imu->rate, 250.0f);
 
   if (!ok) goto failure;
 
-  last_run = uv_hrtime();
-  uv_timer_start(&timer_update, update, 1000/rate, 1000/rate);
+  flight_frame_t* fr = &imu->frame;
+  memset(fr, 0, sizeof(*fr));
+  fr->gain[FLIGHT_ACC] = imu->adxl345->gain;
+  fr->gain[FLIGHT_MAG] = imu->hmc5883l->gain;
+  fr->gain[FLIGHT_GYRO] = imu->l3g4200d->gain;
+
+  l3g4200d_prepare_status(imu->l3g4200d, &imu->polls[0]);
+  l3g4200d_prepare_read(imu->l3g4200d, &imu->polls[1]);
+  adxl345_prepare_status(imu->adxl345, &imu->polls[2]);
+  hmc5883l_prepare_status(imu->hmc5883l, &imu->polls[3]);
+
+  imu->mag_period = 1e9/mag_rate;
+  imu->mag_due = 0;
+  imu->mag_check = 0;
+
+  if (imu->use_thread && imu->stream) {
+    log_warning("The stream mode is ignored in the thread mode.");
+    imu->stream = false;
+  }
+
+  if (!imu->stream && (*imu->acc_prefilter_spec
+                       || *imu->gyro_prefilter_spec))
+    log_warning("Prefilters of %s need the stream mode.", imu->section);
+
+  if (imu->stream && !(start_prefilters(imu, imu->adxl345->rate,
+                                        imu->l3g4200d->rate)
+                       && adxl345_stream_start(imu->adxl345)
+                       && l3g4200d_stream_start(imu->l3g4200d)))
+    goto failure;
 
   return true;
 
 failure:
-  term();
+  log_error("Cannot start %s.", imu->section);
+  release(imu);
   return false;
 }
 
 
-NODE_REGISTER(ahrs, init, term);
+static void probe_thread(void* arg) {
+  imu_t* imu = arg;
+  imu->probed = probe_imu(imu);
+}
+
+
+// Keys of the mode only, so sections of replays may omit keys of sensors.
+static void read_settings(imu_t* imu) {
+  imu->replay_path = imu_str(imu, "replay");
+
+  if (*imu->replay_path) {
+    imu->warp = imu_double(imu, "warp");
+    return;
+  }
+
+  imu->iio_devices = imu_str(imu, "iio");
+  if (*imu->iio_devices) imu->iio_root = imu_str(imu, "iio_root");
+  else imu->bus = imu_str(imu, "bus");
+
+  imu->rates[FLIGHT_ACC] = imu_double(imu, "acc_rate");
+  imu->rates[FLIGHT_MAG] = imu_double(imu, "mag_rate");
+  imu->rates[FLIGHT_GYRO] = imu_double(imu, "rate");
+  imu->acc_prefilter_spec = imu_str(imu, "acc_prefilter");
+  imu->gyro_prefilter_spec = imu_str(imu, "gyro_prefilter");
+  imu->use_thread = imu_bool(imu, "thread");
+
+  if (*imu->iio_devices) return;
+
+  imu->stream = imu_bool(imu, "stream");
+  imu->priority = imu_int(imu, "priority");
+  imu->cpu = imu_int(imu, "cpu");
+  imu->mlock = imu_bool(imu, "mlock");
+}
+
+
+static bool read_sections(void) {
+  char* names[MAX_IMUS];
+  imu_count = cfg_words("ahrs:imus", sections, sizeof(sections), names,
+                        MAX_IMUS);
+
+  if (imu_count > MAX_IMUS)
+    return log_error("Too many IMUs, the maximum is %d.", MAX_IMUS);
+
+  for (int i = 0; i < imu_count; ++i) {
+    imu_t* imu = &imus[i];
+    memset(imu, 0, sizeof(*imu));
+    imu->section = names[i];
+    imu->index = i;
+    read_settings(imu);
+  }
+
+  return imu_count > 0 || log_error("No IMU is specified in ahrs:imus.");
+}
+
+
+// IMUs are probed in parallel, the first one by the calling thread. Only
+// this thread reads the config.
+static bool probe(void) {
+  if (!(read_filter() && read_sections())) return false;
+
+  use_mag = cfg_bool("ahrs:magnetometer");
+  max_angle = deg_to_rad(cfg_double("ahrs:vote"));
+  stale = cfg_double("ahrs:stale") * 1e9;
+
+  uv_thread_t threads[MAX_IMUS];
+  int spawned = 1;
+
+  while (spawned < imu_count && uv_thread_create(&threads[spawned],
+                                                 probe_thread,
+                                                 &imus[spawned]) == 0)
+    ++spawned;
+
+  bool ok = probe_imu(&imus[0]);
+
+  for (int i = 1; i < spawned; ++i) {
+    uv_thread_join(&threads[i]);
+    ok = ok && imus[i].probed;
+  }
+
+  if (spawned < imu_count)
+    ok = log_error("Cannot create threads to probe IMUs.");
+
+  if (!ok)
+    for (int i = 0; i < imu_count; ++i)
+      release(&imus[i]);
+
+  return ok;
+}
+
+
+static bool start_imu(imu_t* imu) {
+  imu->alive = true;
+
+  if (imu->replay) {
+    start_replay(imu);
+    return true;
+  }
+
+  if (imu->use_thread)
+    return start_thread(imu);
+
+  if (imu->stream) {
+    // Wake up when the faster FIFO is half full.
+    iio_dev_t** iio = imu->iio;
+    float max_rate = iio[FLIGHT_GYRO]
+                   ? fmax(iio[FLIGHT_ACC]->rate, iio[FLIGHT_GYRO]->rate)
+                   : fmax(imu->adxl345->rate, imu->l3g4200d->rate);
+    uint64_t wakeup = fmax(1000 * SENSOR_BATCH_CAPACITY/2 / max_rate, 1);
+
+    imu->fusion.last_run = uv_hrtime();
+    uv_timer_start(&imu->timer_update, update_stream, wakeup, wakeup);
+    return true;
+  }
+
+  float rate = imu->rate;
+  if (1000/rate != (int)(1000/rate))
+    log_warning("The period of %s is rounded to %d ms, use the thread mode.",
+                imu->section, (int)(1000/rate));
+
+  imu->period = (uint64_t)(1000/rate) * 1000000;
+  imu->fusion.last_run = imu->ticked = uv_hrtime();
+  uv_timer_start(&imu->timer_update, update, 1000/rate, 1000/rate);
+  return true;
+}
+
+
+static bool init(void) {
+  // It's necessary to initialize handles before the termination.
+  for (int i = 0; i < imu_count; ++i) {
+    imu_t* imu = &imus[i];
+
+    uv_timer_init(uv_default_loop(), &imu->timer_update);
+    uv_idle_init(uv_default_loop(), &imu->idle_replay);
+    imu->timer_update.data = imu;
+    imu->idle_replay.data = imu;
+    register_metrics(imu);
+  }
+
+  worker_count = 0;
+
+  for (int i = 0; i < imu_count; ++i)
+    if (!start_imu(&imus[i])) {
+      term();
+      return false;
+    }
+
+  if (!start_workers()) {
+    term();
+    return false;
+  }
+
+  return true;
+}
+
+
+NODE_REGISTER(ahrs, .probe = probe, .init = init, .term = term,
+              .publishes = NODE_EVENTS(&ev_ahrs, &ev_ahrs_raw));
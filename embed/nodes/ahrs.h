@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 
+#include "base/flight_log.h"
 #include "base/node.h"
 #include "base/pubsub.h"
 
@@ -10,10 +11,19 @@ extern node_t ahrs;
 
 
 /*
- * Event 'ahrs'
+ * Event 'ahrs': the attitude by every fused sample of the gyroscope, also
+ * in the stream mode, where samples are fused by batches.
  */
 extern event_t ev_ahrs;
 
 typedef struct {
   float attitude[4];
 } ev_ahrs_t;
+
+
+/*
+ * Event 'ahrs_raw': every frame of measurements fused by the first IMU.
+ */
+extern event_t ev_ahrs_raw;
+
+typedef flight_frame_t ev_ahrs_raw_t;
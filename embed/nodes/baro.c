@@ -0,0 +1,160 @@
+#include "nodes/baro.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+#include "base/aux_math.h"
+#include "base/config.h"
+#include "base/logging.h"
+#include "base/node.h"
+#include "base/pubsub.h"
+#include "base/trace.h"
+#include "devices/bmp085.h"
+#include "devices/i2c_async.h"
+
+
+event_t ev_baro = EVENT_INIT("baro");
+
+
+static uv_timer_t timer_conversion;
+static bmp085_t* bmp085;
+static uint64_t temp_period;  // [ns]
+static uint64_t temp_due;     // Time to measure temperature again [ns].
+
+
+static void term(void) {
+  uv_timer_stop(&timer_conversion);
+  if (bmp085) bmp085_close(bmp085);
+  bmp085 = NULL;
+}
+
+
+static void fail(void) {
+  log_error("Failure while updating baro data. Stopped.");
+  term();
+}
+
+
+// Wake up by the first tick of the loop's clock after the conversion. The clock
+// is truncated to milliseconds and may lag, so the timer is never early.
+static void wait(uv_timer_cb cb, uint32_t conversion) {
+  uint64_t ready = uv_hrtime() + conversion * 1000ull;
+  uv_loop_t* loop = uv_default_loop();
+
+  uv_update_time(loop);
+  uv_timer_start(&timer_conversion, cb, (ready + 999999)/1000000 - uv_now(loop),
+                 0);
+}
+
+
+/*
+ * Transactions go through the queue of the bus, so the loop doesn't wait
+ * the bus. The conversion is waited since its request is completed.
+ */
+
+static void on_temperature(uv_timer_t* timer);
+static void on_pressure(uv_timer_t* timer);
+
+
+static void on_ut_requested(void* ctx, bool ok) {
+  if (ok) wait(on_temperature, BMP085_TEMP_TIME);
+  else fail();
+}
+
+
+static void on_up_requested(void* ctx, bool ok) {
+  if (ok) wait(on_pressure, bmp085_press_time(bmp085));
+  else fail();
+}
+
+
+static void on_temp_read(void* ctx, bool ok) {
+  if (!ok) fail();
+}
+
+
+static void on_press_read(void* ctx, bool ok) {
+  if (!ok) {
+    fail();
+    return;
+  }
+
+  ev_baro_t data = {
+    press_to_alt(bmp085->pressure), bmp085->pressure, bmp085->temperature
+  };
+
+  publish(&ev_baro, &data);
+}
+
+
+static void on_temperature(uv_timer_t* timer) {
+  uint64_t span = trace_begin();
+
+  if (!(bmp085_read_temp_async(bmp085, on_temp_read, NULL)
+        && bmp085_request_up_async(bmp085, on_up_requested, NULL)))
+    fail();
+
+  trace_end(span, "baro.temperature", NULL);
+}
+
+
+static void on_pressure(uv_timer_t* timer) {
+  // The next conversion is requested right after the read to keep the chip
+  // busy.
+  uint64_t span = trace_begin();
+  uint64_t now = uv_hrtime();
+  bool temp = now >= temp_due;
+  if (temp) temp_due = now + temp_period;
+
+  bool ok = bmp085_read_press_async(bmp085, on_press_read, NULL)
+         && (temp ? bmp085_request_ut_async(bmp085, on_ut_requested, NULL)
+                  : bmp085_request_up_async(bmp085, on_up_requested, NULL));
+
+  if (!ok) fail();
+  trace_end(span, "baro.pressure", NULL);
+}
+
+
+static bool probe(void) {
+  bmp085 = NULL;
+
+  const char* bus = cfg_str("baro:bus");
+  if (!*bus) return true;
+
+  int oss = cfg_int("baro:oss");
+  if (oss < 0 || oss > 3)
+    return log_error("Oversampling of bmp085 must be 0..3, not %d.", oss);
+
+  temp_period = cfg_double("baro:temp_period") * 1e9;
+
+  if (!(bmp085 = bmp085_open(bus, BMP085_ADDR)))
+    return false;
+
+  bmp085_set_oss(bmp085, oss);
+
+  // Conversions take milliseconds, so transactions of bmp085 yield to other
+  // queued devices of the bus, e.g. frames of servos. Sensors of ahrs are
+  // polled synchronously, bypassing the queue, so it doesn't order them.
+  i2c_set_priority(bmp085->underline, I2C_PRIORITY_LOW);
+  return true;
+}
+
+
+static bool init(void) {
+  uv_timer_init(uv_default_loop(), &timer_conversion);
+  if (!bmp085) return true;
+
+  temp_due = uv_hrtime() + temp_period;
+
+  if (!bmp085_request_ut_async(bmp085, on_ut_requested, NULL)) {
+    term();
+    return false;
+  }
+
+  return true;
+}
+
+
+NODE_REGISTER(baro, .probe = probe, .init = init, .term = term,
+              .publishes = NODE_EVENTS(&ev_baro));
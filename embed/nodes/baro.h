@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "base/node.h"
+#include "base/pubsub.h"
+
+
+/*!
+ * Reads bmp085 of gy-80 as fast as its conversions allow. Conversions are
+ * waited by timers, so the bus is touched only to start and to read them.
+ */
+extern node_t baro;
+
+
+/*
+ * Event 'baro'
+ */
+extern event_t ev_baro;
+
+typedef struct {
+  float altitude;     //!< [m]
+  int32_t pressure;   //!< [Pa]
+  float temperature;  //!< [°C]
+} ev_baro_t;
@@ -0,0 +1,298 @@
+#include "nodes/gait.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <uv.h>
+
+#include "base/aux_math.h"
+#include "base/config.h"
+#include "base/logging.h"
+#include "base/metrics.h"
+#include "base/node.h"
+#include "base/pubsub.h"
+#include "base/trace.h"
+#include "control/leg_ik.h"
+
+
+event_t ev_gait_command = EVENT_INIT("gait_command");
+event_t ev_joints = EVENT_INIT("joints");
+
+
+/*
+ * The cycle is the 32-bit phase: it wraps around by itself. Every leg stands
+ * from its offset to `duty` and swings up to the end of the cycle. Swings are
+ * eased by tables of the swing phase, so ticks have no trigonometry.
+ */
+#define TABLE_SIZE 256
+
+#define MAX_LEGS LEG_IK_MAX_LEGS
+
+
+typedef struct {
+  float x[MAX_LEGS], y[MAX_LEGS], z[MAX_LEGS];
+} feet_t;
+
+
+static uv_timer_t timer_tick;
+static leg_ik_t ik;
+static int legs;
+
+static uint32_t phase;
+static uint32_t step;      // Of the phase per tick.
+static uint32_t duty;      // The part of the cycle on the ground.
+static uint32_t offsets[MAX_LEGS];
+static float swing_scale;  // From the swing phase to the table index.
+static float stance_time;  // [s]
+static float dt;           // [s]
+
+static float ease[TABLE_SIZE + 1];  // Horizontal progress of the swing.
+static float lift[TABLE_SIZE + 1];  // Height of the foot.
+
+static float height, step_height;
+static feet_t neutral;
+static feet_t feet;
+// The current swing goes from the lift off to the touchdown, both are fixed
+// when it starts, so commands change next swings only.
+static float lift_x[MAX_LEGS], lift_y[MAX_LEGS];
+static float touch_x[MAX_LEGS], touch_y[MAX_LEGS];
+static bool swinging[MAX_LEGS];
+
+static ev_gait_command_t command;
+static ev_joints_t joints;
+
+static histogram_t tick_latency;
+static counter_t unreached;
+
+
+static void on_command(void* ctx, ev_gait_command_t* data) {
+  command = *data;
+}
+
+
+// Linear interpolation between entries of the table.
+static inline float lookup(const float* table, float index) {
+  int k = index < TABLE_SIZE ? index : TABLE_SIZE - 1;
+  return table[k] + (index - k) * (table[k+1] - table[k]);
+}
+
+
+static bool stopped(void) {
+  return command.vx == 0 && command.vy == 0 && command.yaw == 0;
+}
+
+
+// Without a command the phase stops right before the next swing, when
+// the previous one has touched down.
+static uint32_t next_phase(void) {
+  uint32_t next = phase + step;
+  if (!stopped()) return next;
+
+  for (int i = 0; i < legs; ++i)
+    if (!swinging[i] && next + offsets[i] >= duty)
+      return duty - offsets[i] - 1;
+
+  return next;
+}
+
+
+static void move_feet(void) {
+  float vx = command.vx, vy = command.vy, w = command.yaw;
+
+  for (int i = 0; i < legs; ++i) {
+    uint32_t leg_phase = phase + offsets[i];
+    float nx = neutral.x[i], ny = neutral.y[i];
+
+    if (leg_phase < duty) {
+      swinging[i] = false;
+
+      // Planted feet move against the body: -(v + ω×p)·dt.
+      float x = feet.x[i], y = feet.y[i];
+      feet.x[i] = x - (vx - w*y) * dt;
+      feet.y[i] = y - (vy + w*x) * dt;
+      feet.z[i] = -height;
+      continue;
+    }
+
+    // Touch down ahead of the neutral point by a half of the stance stride.
+    if (!swinging[i]) {
+      swinging[i] = true;
+      lift_x[i] = feet.x[i];
+      lift_y[i] = feet.y[i];
+      touch_x[i] = nx + (vx - w*ny) * stance_time / 2;
+      touch_y[i] = ny + (vy + w*nx) * stance_time / 2;
+    }
+
+    float index = (leg_phase - duty) * swing_scale;
+    float progress = lookup(ease, index);
+
+    feet.x[i] = lift_x[i] + progress * (touch_x[i] - lift_x[i]);
+    feet.y[i] = lift_y[i] + progress * (touch_y[i] - lift_y[i]);
+    feet.z[i] = -height + step_height * lookup(lift, index);
+  }
+}
+
+
+static void tick(uv_timer_t* timer) {
+  uint64_t span = trace_begin();
+  uint64_t start = metrics_now();
+
+  phase = next_phase();
+  move_feet();
+
+  const float* foot[3] = {feet.x, feet.y, feet.z};
+  float* angles[3] = {joints.angles[0], joints.angles[1], joints.angles[2]};
+  int states[MAX_LEGS];
+
+  leg_ik_solve(&ik, foot, angles, states);
+
+  joints.unreached = 0;
+  for (int i = 0; i < legs; ++i)
+    if (states[i] != LEG_IK_NORMAL)
+      joints.unreached |= 1u << i;
+
+  if (joints.unreached) counter_add(&unreached, 1);
+
+  publish(&ev_joints, &joints);
+
+  histogram_record(&tick_latency, metrics_now() - start);
+  trace_end(span, "gait.tick", NULL);
+}
+
+
+/*
+ * Configuration.
+ */
+
+static bool start_legs(void) {
+  float mounts[MAX_LEGS];
+  legs = cfg_floats("gait:mounts", mounts, MAX_LEGS);
+  if (legs < 2 || legs > MAX_LEGS)
+    return log_error("gait:mounts must list 2..%d legs.", MAX_LEGS);
+
+  float radius = cfg_double("gait:radius");
+  float reach = cfg_double("gait:reach");
+  height = cfg_double("gait:height");
+
+  leg_ik_leg_t geometry[MAX_LEGS];
+
+  for (int i = 0; i < legs; ++i) {
+    float yaw = deg_to_rad(mounts[i]);
+
+    geometry[i] = (leg_ik_leg_t){
+      .x = radius * cos(yaw), .y = radius * sin(yaw), .z = 0, .yaw = yaw,
+      .coxa = cfg_double("gait:coxa"),
+      .femur = cfg_double("gait:femur"),
+      .tibia = cfg_double("gait:tibia"),
+      .beta = deg_to_rad(cfg_double("gait:beta"))
+    };
+
+    neutral.x[i] = feet.x[i] = reach * cos(yaw);
+    neutral.y[i] = feet.y[i] = reach * sin(yaw);
+    neutral.z[i] = feet.z[i] = -height;
+    swinging[i] = false;
+  }
+
+  joints.legs = legs;
+  return leg_ik_start(&ik, geometry, legs);
+}
+
+
+// Tripods are alternate legs. The wave lifts legs one by one in order.
+static bool start_gait(void) {
+  const char* name = cfg_str("gait:gait");
+  double on_ground;
+
+  if (!strcmp(name, "tripod")) {
+    on_ground = 0.5;
+    for (int i = 0; i < legs; ++i)
+      offsets[i] = i % 2 ? 1u << 31 : 0;
+  } else if (!strcmp(name, "wave")) {
+    on_ground = 1 - 1.0/legs;
+    for (int i = 0; i < legs; ++i)
+      offsets[i] = (uint64_t)(legs - i) % legs * 4294967296.0 / legs;
+  } else {
+    return log_error("Unknown gait %s.", name);
+  }
+
+  // Every swing takes a tick at least.
+  double cycle = cfg_double("gait:cycle");
+  if (!(cycle * (1 - on_ground) >= dt))
+    return log_error("gait:cycle %g s is too short.", cycle);
+
+  duty = on_ground * 4294967296.0;
+  step = 4294967296.0 * dt / cycle;
+  stance_time = on_ground * cycle;
+  swing_scale = TABLE_SIZE / (4294967296.0 - duty);
+  step_height = cfg_double("gait:lift");
+
+  // The swing starts and ends at rest.
+  for (int k = 0; k <= TABLE_SIZE; ++k) {
+    double u = (double)k / TABLE_SIZE;
+    ease[k] = (1 - cos(M_PI * u)) / 2;
+    lift[k] = sin(M_PI * u);
+  }
+
+  // Standing: the first leg is about to swing, the previous one touches down.
+  phase = duty - 1;
+  for (int i = 0; i < legs; ++i) {
+    swinging[i] = phase + offsets[i] >= duty;
+    lift_x[i] = touch_x[i] = feet.x[i];
+    lift_y[i] = touch_y[i] = feet.y[i];
+  }
+
+  return true;
+}
+
+
+static bool read_command(void) {
+  float velocity[3] = {0, 0, 0};
+  if (cfg_floats("gait:velocity", velocity, 3) != 3)
+    return log_error("gait:velocity must be 3 numbers.");
+
+  command = (ev_gait_command_t){
+    velocity[0], velocity[1], deg_to_rad(velocity[2])
+  };
+
+  return true;
+}
+
+
+static void term(void) {
+  unsubscribe(&ev_gait_command, on_command, NULL);
+  uv_timer_stop(&timer_tick);
+  histogram_unregister(&tick_latency);
+  counter_unregister(&unreached);
+}
+
+
+static bool init(void) {
+  int rate = cfg_int("gait:rate");
+  if (rate <= 0 || 1000 % rate)
+    return log_error("gait:rate must be a divisor of 1000, not %d.", rate);
+
+  // Steps of the timer are exact milliseconds.
+  uint64_t period = 1000 / rate;
+  dt = period / 1e3f;
+
+  if (!(start_legs() && start_gait() && read_command()))
+    return false;
+
+  uv_timer_init(uv_default_loop(), &timer_tick);
+  histogram_register(&tick_latency, "gait.tick");
+  counter_register(&unreached, "gait.unreached");
+
+  if (!subscribe(&ev_gait_command, on_command, NULL)) {
+    term();
+    return false;
+  }
+
+  uv_timer_start(&timer_tick, tick, period, period);
+  return true;
+}
+
+
+// Commands are optional, the gait starts with the configured one.
+NODE_REGISTER(gait, .init = init, .term = term,
+              .publishes = NODE_EVENTS(&ev_joints));
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "base/node.h"
+#include "base/pubsub.h"
+#include "control/leg_ik.h"
+
+
+/*!
+ * Walks by the tripod or wave gait at the body velocity of the command. Every
+ * tick of the control rate moves feet along their trajectories and solves
+ * the IK of all legs. Planted feet follow the body motion, swinging ones are
+ * carried to the next touchdown by curves of the precomputed phase tables.
+ * Without a command the robot stands on the touched down feet.
+ */
+extern node_t gait;
+
+
+/*
+ * Event 'gait_command': the desired motion of the body.
+ */
+extern event_t ev_gait_command;
+
+typedef struct {
+  float vx, vy;  //!< Forward, left [cm/s].
+  float yaw;     //!< Turning left [rad/s].
+} ev_gait_command_t;
+
+
+/*
+ * Event 'joints': setpoints of all joints, one per control tick.
+ */
+extern event_t ev_joints;
+
+typedef struct {
+  int legs;
+  float angles[3][LEG_IK_MAX_LEGS];  //!< Of coxas, femurs, tibias [rad].
+  uint32_t unreached;                //!< Legs out of reach, by bits.
+} ev_joints_t;
@@ -0,0 +1,61 @@
+#include "nodes/recorder.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "base/config.h"
+#include "base/flight_log.h"
+#include "base/logging.h"
+#include "base/node.h"
+#include "base/pubsub.h"
+#include "nodes/ahrs.h"
+
+
+static flight_log_t* flight;
+static const char* path;
+
+
+static void record(flight_log_t* fl, ev_ahrs_raw_t* frame) {
+  if (flight_log_append(fl, frame)) return;
+
+  log_warning("The flight log %s is full, recording is stopped.", path);
+  unsubscribe(&ev_ahrs_raw, record, fl);
+}
+
+
+static void term(void) {
+  if (!flight) return;
+
+  unsubscribe(&ev_ahrs_raw, record, flight);
+  log_info("Recorded %llu frames to %s.",
+           (unsigned long long)flight_log_frames(flight), path);
+
+  flight_log_close(flight);
+  flight = NULL;
+}
+
+
+static bool probe(void) {
+  path = cfg_str("recorder:path");
+  if (!*path) return true;
+
+  size_t size = cfg_int("recorder:size");
+  size <<= 20;
+  return (flight = flight_log_create(path, size)) != NULL;
+}
+
+
+static bool init(void) {
+  if (!flight) return true;
+
+  if (!subscribe(&ev_ahrs_raw, record, flight)) {
+    term();
+    return log_error("Cannot subscribe to ahrs_raw.");
+  }
+
+  return true;
+}
+
+
+NODE_REGISTER(recorder, .probe = probe, .init = init, .term = term,
+              .consumes = NODE_EVENTS(&ev_ahrs_raw));
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "base/node.h"
+
+
+/*!
+ * Records raw frames of ahrs to the flight log (see `base/flight_log.h`).
+ * The log is replayed by ahrs with `gy-80:replay`.
+ */
+extern node_t recorder;
@@ -0,0 +1,243 @@
+#include "nodes/servo.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <tgmath.h>
+
+#include "base/aux_math.h"
+#include "base/config.h"
+#include "base/logging.h"
+#include "base/metrics.h"
+#include "base/node.h"
+#include "base/pubsub.h"
+#include "base/trace.h"
+#include "devices/pca9685.h"
+#include "nodes/gait.h"
+
+
+/*
+ * Channels are numbered through chips by 16 in order of "servo:chips". The
+ * table maps the position of the servo in its range to ticks of the pulse,
+ * so frames cost a multiplication and a lookup per joint.
+ */
+#define TABLE_SIZE 1024
+
+#define MAX_CHIPS 4
+#define MAX_JOINTS (3 * LEG_IK_MAX_LEGS)
+#define MAX_POINTS 16
+
+
+static pca9685_t* chips[MAX_CHIPS];
+static int chip_count;
+
+static int channels[MAX_JOINTS];  // By legs, -1 for unwired joints.
+static bool reversed[MAX_JOINTS];
+static int joint_count;
+
+static float lower[3];  // Of ranges of coxas, femurs, tibias [rad].
+static float scale;     // From the angle to the table index.
+static uint16_t table[TABLE_SIZE + 1];
+
+static int writing;           // Chips writing the frame.
+static uint64_t frame_start;  // [ns]
+
+static histogram_t frame_latency;
+static counter_t late;
+static counter_t clipped;
+
+
+static void on_written(void* ctx, bool ok) {
+  if (--writing == 0)
+    histogram_record(&frame_latency, metrics_now() - frame_start);
+}
+
+
+static void on_joints(void* ctx, ev_joints_t* data) {
+  uint64_t span = trace_begin();
+  int count = 3*data->legs < joint_count ? 3*data->legs : joint_count;
+
+  for (int k = 0; k < count; ++k) {
+    int channel = channels[k];
+    if (channel < 0) continue;
+
+    float index = (data->angles[k % 3][k / 3] - lower[k % 3]) * scale;
+    if (!(0 <= index && index <= TABLE_SIZE)) {
+      counter_add(&clipped, 1);
+      index = index > 0 ? TABLE_SIZE : 0;
+    }
+
+    if (reversed[k]) index = TABLE_SIZE - index;
+
+    pca9685_set(chips[channel / PCA9685_CHANNELS],
+                channel % PCA9685_CHANNELS, table[(int)(index + .5f)]);
+  }
+
+  // The frame is measured if no chip is late.
+  bool complete = writing == 0;
+  if (complete) frame_start = metrics_now();
+
+  for (int i = 0; i < chip_count; ++i) {
+    if (chips[i]->busy) {
+      counter_add(&late, 1);
+      continue;
+    }
+
+    bool pending = chips[i]->dirty_lo <= chips[i]->dirty_hi;
+    if (!pca9685_flush_async(chips[i], complete ? on_written : NULL, NULL))
+      log_error("Cannot send the frame to pca9685.");
+    else if (pending && complete)
+      ++writing;
+  }
+
+  trace_end(span, "servo.frame", NULL);
+}
+
+
+/*
+ * Configuration.
+ */
+
+static bool read_joints(void) {
+  joint_count = cfg_ints("servo:channels", channels, MAX_JOINTS);
+  if (joint_count < 1 || joint_count > MAX_JOINTS)
+    return log_error("servo:channels must list 1..%d joints.", MAX_JOINTS);
+
+  bool used[MAX_CHIPS * PCA9685_CHANNELS] = {false};
+
+  for (int k = 0; k < joint_count; ++k) {
+    int channel = channels[k];
+    if (channel < 0) continue;
+
+    if (channel >= chip_count * PCA9685_CHANNELS || used[channel])
+      return log_error("Bad channel %d of servo:channels.", channel);
+
+    used[channel] = true;
+  }
+
+  int list[MAX_JOINTS];
+  int count = cfg_ints("servo:reversed", list, MAX_JOINTS);
+  if (count > MAX_JOINTS) return log_error("Too many servo:reversed.");
+
+  for (int k = 0; k < MAX_JOINTS; ++k)
+    reversed[k] = false;
+
+  for (int i = 0; i < count; ++i) {
+    if (list[i] < 0 || list[i] >= joint_count)
+      return log_error("Bad joint %d of servo:reversed.", list[i]);
+
+    reversed[list[i]] = true;
+  }
+
+  return true;
+}
+
+
+// Pulses of points are spread evenly over the range, linear between them.
+static bool build_table(float rate) {
+  float points[MAX_POINTS];
+  int count = cfg_floats("servo:pulse", points, MAX_POINTS);
+  if (count < 2 || count > MAX_POINTS)
+    return log_error("servo:pulse must list 2..%d pulses.", MAX_POINTS);
+
+  float middle[3];
+  if (cfg_floats("servo:middle", middle, 3) != 3)
+    return log_error("servo:middle must be 3 angles.");
+
+  float range = deg_to_rad(cfg_double("servo:range"));
+  if (!(range > 0)) return log_error("servo:range must be positive.");
+
+  for (int j = 0; j < 3; ++j)
+    lower[j] = deg_to_rad(middle[j]) - range/2;
+
+  scale = TABLE_SIZE / range;
+
+  // From [µs] to 1/4096 of the period.
+  double ticks_per_us = 4096 * rate * 1e-6;
+
+  for (int k = 0; k <= TABLE_SIZE; ++k) {
+    double at = (double)k * (count - 1) / TABLE_SIZE;
+    int i = at < count - 1 ? at : count - 2;
+    double pulse = points[i] + (at - i) * (points[i+1] - points[i]);
+    double ticks = round(pulse * ticks_per_us);
+
+    if (!(ticks >= 1 && ticks <= 4095))
+      return log_error("The pulse %g us is out of the period.", pulse);
+
+    table[k] = ticks;
+  }
+
+  return true;
+}
+
+
+static void term(void) {
+  if (!chip_count) return;
+
+  unsubscribe(&ev_joints, on_joints, NULL);
+
+  for (int i = 0; i < chip_count; ++i)
+    pca9685_close(chips[i]);
+
+  chip_count = 0;
+  writing = 0;
+  histogram_unregister(&frame_latency);
+  counter_unregister(&late);
+  counter_unregister(&clipped);
+}
+
+
+static bool probe(void) {
+  chip_count = 0;
+
+  const char* bus = cfg_str("servo:bus");
+  if (!*bus) return true;
+
+  int addrs[MAX_CHIPS];
+  int count = cfg_ints("servo:chips", addrs, MAX_CHIPS);
+  if (count < 1 || count > MAX_CHIPS)
+    return log_error("servo:chips must list 1..%d chips.", MAX_CHIPS);
+
+  float rate = cfg_double("servo:rate");
+  if (!(rate > 0)) return log_error("servo:rate must be positive.");
+
+  for (; chip_count < count; ++chip_count) {
+    pca9685_t* chip = pca9685_open(bus, addrs[chip_count]);
+
+    if (!(chip && pca9685_tune(chip, rate))) {
+      if (chip) pca9685_close(chip);
+      goto failure;
+    }
+
+    chips[chip_count] = chip;
+  }
+
+  if (read_joints() && build_table(chips[0]->rate))
+    return true;
+
+failure:
+  for (int i = 0; i < chip_count; ++i)
+    pca9685_close(chips[i]);
+
+  chip_count = 0;
+  return false;
+}
+
+
+static bool init(void) {
+  if (!chip_count) return true;
+
+  histogram_register(&frame_latency, "servo.frame");
+  counter_register(&late, "servo.late");
+  counter_register(&clipped, "servo.clipped");
+
+  if (!subscribe(&ev_joints, on_joints, NULL)) {
+    term();
+    return false;
+  }
+
+  return true;
+}
+
+
+NODE_REGISTER(servo, .probe = probe, .init = init, .term = term,
+              .consumes = NODE_EVENTS(&ev_joints));
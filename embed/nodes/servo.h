@@ -0,0 +1,13 @@
+#pragma once
+
+#include "base/node.h"
+
+
+/*!
+ * Drives servos of joints by pca9685 chips. Every setpoint of joints is
+ * quantized to pulses by the precomputed table of the servo response, and
+ * every chip gets one write of its changed channels. Chips which are still
+ * writing the previous frame skip the current one, their channels go with
+ * the next frame.
+ */
+extern node_t servo;
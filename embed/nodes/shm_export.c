@@ -0,0 +1,93 @@
+#include "nodes/shm_export.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <uv.h>
+
+#include "base/config.h"
+#include "base/logging.h"
+#include "base/node.h"
+#include "base/pubsub.h"
+#include "base/shm_channel.h"
+#include "nodes/ahrs.h"
+#include "nodes/baro.h"
+
+
+typedef struct {
+  const char* key;  // Path of the channel, empty to skip the event.
+  event_t* ev;
+  size_t size;
+  shm_channel_t* channel;
+} export_t;
+
+static export_t exports[] = {
+  {"shm_export:ahrs", &ev_ahrs, sizeof(ev_ahrs_t), NULL},
+  {"shm_export:ahrs_raw", &ev_ahrs_raw, sizeof(ev_ahrs_raw_t), NULL},
+  {"shm_export:baro", &ev_baro, sizeof(ev_baro_t), NULL}
+};
+
+#define EXPORTS (int)(sizeof(exports)/sizeof(exports[0]))
+
+
+static void write_sample(export_t* export, void* data) {
+  shm_channel_write(export->channel, data, uv_hrtime());
+}
+
+
+static void close_channels(void) {
+  for (int i = 0; i < EXPORTS; ++i) {
+    if (exports[i].channel) shm_channel_close(exports[i].channel);
+    exports[i].channel = NULL;
+  }
+}
+
+
+static void term(void) {
+  for (int i = 0; i < EXPORTS; ++i)
+    if (exports[i].channel)
+      unsubscribe(exports[i].ev, write_sample, &exports[i]);
+
+  close_channels();
+}
+
+
+static bool probe(void) {
+  int capacity = cfg_int("shm_export:capacity");
+  if (capacity < 2 || (capacity & (capacity - 1)))
+    return log_error("Capacity of channels must be a power of two >= 2.");
+
+  for (int i = 0; i < EXPORTS; ++i) {
+    export_t* export = &exports[i];
+    const char* path = cfg_str(export->key);
+    if (!*path) continue;
+
+    if (!(export->channel = shm_channel_create(path, export->size, capacity))) {
+      log_error("Cannot create the channel %s: %s.", path, strerror(errno));
+      close_channels();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+static bool init(void) {
+  for (int i = 0; i < EXPORTS; ++i) {
+    export_t* export = &exports[i];
+    if (!export->channel) continue;
+
+    if (!subscribe(export->ev, write_sample, export)) {
+      term();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+NODE_REGISTER(shm_export, .probe = probe, .init = init, .term = term,
+              .consumes = NODE_EVENTS(&ev_ahrs, &ev_ahrs_raw, &ev_baro));
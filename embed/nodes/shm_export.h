@@ -0,0 +1,13 @@
+#pragma once
+
+#include "base/node.h"
+
+
+/*!
+ * Exports events to other processes through channels in the shared memory
+ * (see `base/shm_channel.h`), samples are events as is:
+ *   ahrs      ev_ahrs_t
+ *   ahrs_raw  ev_ahrs_raw_t
+ *   baro      ev_baro_t
+ */
+extern node_t shm_export;
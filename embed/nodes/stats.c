@@ -0,0 +1,130 @@
+#include "nodes/stats.h"
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "base/config.h"
+#include "base/logging.h"
+#include "base/metrics.h"
+#include "base/node.h"
+
+
+typedef struct {
+  uv_pipe_t pipe;
+  uv_write_t req;
+  char* snapshot;
+} client_t;
+
+
+static uv_signal_t sigusr1;
+static uv_pipe_t server;
+static const char* path;
+static bool listening;
+
+
+static void dump(uv_signal_t* handle, int signum) {
+  metrics_write(stderr);
+  fflush(stderr);
+}
+
+
+static void free_client(uv_handle_t* handle) {
+  client_t* client = handle->data;
+  free(client->snapshot);
+  free(client);
+}
+
+
+static void on_written(uv_write_t* req, int status) {
+  client_t* client = req->data;
+
+  if (status < 0)
+    log_warning("Cannot write the snapshot: %s.", uv_strerror(status));
+
+  uv_close((uv_handle_t*)&client->pipe, free_client);
+}
+
+
+// Every client gets the snapshot and is disconnected.
+static void on_connection(uv_stream_t* handle, int status) {
+  if (status < 0) {
+    log_warning("Cannot accept the connection: %s.", uv_strerror(status));
+    return;
+  }
+
+  client_t* client = calloc(1, sizeof(client_t));
+  uv_pipe_init(uv_default_loop(), &client->pipe, 0);
+  client->pipe.data = client;
+  client->req.data = client;
+
+  if (uv_accept(handle, (uv_stream_t*)&client->pipe) < 0) {
+    uv_close((uv_handle_t*)&client->pipe, free_client);
+    return;
+  }
+
+  size_t size;
+  FILE* file = open_memstream(&client->snapshot, &size);
+  metrics_write(file);
+  fclose(file);
+
+  uv_buf_t buf = uv_buf_init(client->snapshot, size);
+  int err = uv_write(&client->req, (uv_stream_t*)&client->pipe, &buf, 1,
+                     on_written);
+
+  if (err < 0) {
+    log_warning("Cannot write the snapshot: %s.", uv_strerror(err));
+    uv_close((uv_handle_t*)&client->pipe, free_client);
+  }
+}
+
+
+static bool listen_socket(void) {
+  // The socket of the previous run is left on crashes.
+  unlink(path);
+
+  int err;
+  uv_pipe_init(uv_default_loop(), &server, 0);
+
+  if ((err = uv_pipe_bind(&server, path)) < 0
+      || (err = uv_listen((uv_stream_t*)&server, 4, on_connection)) < 0) {
+    uv_close((uv_handle_t*)&server, NULL);
+    return log_error("Cannot listen %s: %s.", path, uv_strerror(err));
+  }
+
+  listening = true;
+  return true;
+}
+
+
+static void term(void) {
+  uv_signal_stop(&sigusr1);
+  uv_close((uv_handle_t*)&sigusr1, NULL);
+
+  if (listening) {
+    uv_close((uv_handle_t*)&server, NULL);
+    unlink(path);
+    listening = false;
+  }
+}
+
+
+static bool init(void) {
+  path = cfg_str("stats:socket");
+
+  uv_signal_init(uv_default_loop(), &sigusr1);
+  uv_signal_start(&sigusr1, dump, SIGUSR1);
+
+  if (*path && !listen_socket()) {
+    uv_close((uv_handle_t*)&sigusr1, NULL);
+    return false;
+  }
+
+  return true;
+}
+
+
+NODE_REGISTER(stats, .init = init, .term = term);
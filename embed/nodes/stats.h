@@ -0,0 +1,11 @@
+#pragma once
+
+#include "base/node.h"
+
+
+/*!
+ * Exposes metrics (see `base/metrics.h`): the snapshot is dumped to stderr on
+ * SIGUSR1 and written to every client connected to `stats:socket`, e.g.
+ * `socat - UNIX-CONNECT:/tmp/tech6.sock`.
+ */
+extern node_t stats;
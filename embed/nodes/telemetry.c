@@ -0,0 +1,415 @@
+#include "nodes/telemetry.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "base/config.h"
+#include "base/logging.h"
+#include "base/node.h"
+#include "base/pubsub.h"
+#include "nodes/ahrs.h"
+#include "nodes/baro.h"
+
+
+#define MAX_CLIENTS 4
+
+// Datagrams fit the ethernet MTU. Every client keeps `QUEUE` datagrams, the
+// loop fills them between sendings.
+#define DATAGRAM_SIZE 1472
+#define QUEUE 8
+
+#define HEADER_SIZE 12
+#define SAMPLE_HEADER_SIZE 16
+
+
+typedef struct {
+  uint8_t data[DATAGRAM_SIZE];
+  int size;
+  int samples;
+} datagram_t;
+
+typedef struct {
+  char* spec;
+  int fd;
+  struct sockaddr_storage addr;
+  socklen_t addr_size;
+  uint32_t every;  // Takes every n-th sample.
+
+  // The ring of datagrams: `ready` full ones from `first`, then the filled.
+  datagram_t queue[QUEUE];
+  int first;
+  int ready;
+  uint32_t number;   // Of the next datagram.
+  uint32_t dropped;  // Datagrams, since the last report.
+  bool failing;      // Reported until sending succeeds.
+} client_t;
+
+typedef struct {
+  const char* name;
+  event_t* ev;
+  uint8_t type;
+  int size;         // Of the payload.
+  bool enabled;
+  uint32_t number;  // Of the next sample.
+} stream_t;
+
+
+static client_t clients[MAX_CLIENTS];
+static int client_count;
+
+static stream_t streams[] = {
+  {"ahrs", &ev_ahrs, TELEMETRY_AHRS, 16, false, 0},
+  {"baro", &ev_baro, TELEMETRY_BARO, 12, false, 0},
+  {"ahrs_raw", &ev_ahrs_raw, TELEMETRY_AHRS_RAW, 54, false, 0}
+};
+
+#define STREAMS (int)(sizeof(streams)/sizeof(streams[0]))
+
+static int batch;  // Samples per datagram.
+static uv_check_t check_send;
+static uv_timer_t timer_flush;
+
+
+/*
+ * Packing.
+ */
+
+static uint8_t* put(uint8_t* p, const void* value, size_t size) {
+  memcpy(p, value, size);
+  return p + size;
+}
+
+
+static void pack_payload(const stream_t* stream, const void* data,
+                         uint8_t* p) {
+  switch (stream->type) {
+    case TELEMETRY_AHRS:
+      put(p, ((const ev_ahrs_t*)data)->attitude, 16);
+      break;
+
+    case TELEMETRY_BARO: {
+      const ev_baro_t* air = data;
+      p = put(p, &air->altitude, 4);
+      p = put(p, &air->pressure, 4);
+      put(p, &air->temperature, 4);
+      break;
+    }
+
+    case TELEMETRY_AHRS_RAW: {
+      const ev_ahrs_raw_t* frame = data;
+      p = put(p, frame->stamp, sizeof(frame->stamp));
+      p = put(p, frame->raw, sizeof(frame->raw));
+      put(p, frame->gain, sizeof(frame->gain));
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+
+static datagram_t* filled(client_t* client) {
+  return &client->queue[(client->first + client->ready) % QUEUE];
+}
+
+
+static void start_datagram(client_t* client, datagram_t* dgram) {
+  static const uint16_t reserved = 0;
+  uint8_t version = TELEMETRY_VERSION;
+
+  uint8_t* p = put(dgram->data, "T6TM", 4);
+  p = put(p, &version, 1);
+  p += 1;  // The number of samples.
+  p = put(p, &reserved, 2);
+  put(p, &client->number, 4);
+
+  ++client->number;
+  dgram->size = HEADER_SIZE;
+  dgram->samples = 0;
+}
+
+
+// Queue the filled datagram, the oldest one is dropped if the queue is full.
+static void seal(client_t* client) {
+  datagram_t* dgram = filled(client);
+  if (dgram->samples == 0) return;
+
+  dgram->data[5] = dgram->samples;
+
+  if (client->ready == QUEUE - 1) {
+    client->first = (client->first + 1) % QUEUE;
+    ++client->dropped;
+  } else {
+    ++client->ready;
+  }
+
+  start_datagram(client, filled(client));
+}
+
+
+static void append(client_t* client, const stream_t* stream, const void* data,
+                   uint64_t stamp) {
+  int size = SAMPLE_HEADER_SIZE + stream->size;
+  datagram_t* dgram = filled(client);
+
+  if (dgram->size + size > DATAGRAM_SIZE) {
+    seal(client);
+    dgram = filled(client);
+  }
+
+  static const uint8_t reserved = 0;
+  uint16_t payload = stream->size;
+
+  uint8_t* p = dgram->data + dgram->size;
+  p = put(p, &stream->type, 1);
+  p = put(p, &reserved, 1);
+  p = put(p, &payload, 2);
+  p = put(p, &stream->number, 4);
+  p = put(p, &stamp, 8);
+  pack_payload(stream, data, p);
+
+  dgram->size += size;
+  if (++dgram->samples == batch) seal(client);
+}
+
+
+// Samples are only copied here, sockets are touched after the iteration.
+static void on_sample(stream_t* stream, void* data) {
+  uint64_t stamp = uv_hrtime();
+
+  for (int i = 0; i < client_count; ++i)
+    if (stream->number % clients[i].every == 0)
+      append(&clients[i], stream, data, stamp);
+
+  ++stream->number;
+}
+
+
+/*
+ * Sending.
+ */
+
+static void send_ready(client_t* client) {
+  struct mmsghdr msgs[QUEUE];
+  struct iovec iovs[QUEUE];
+  int count = client->ready;
+
+  for (int i = 0; i < count; ++i) {
+    datagram_t* dgram = &client->queue[(client->first + i) % QUEUE];
+    iovs[i] = (struct iovec){dgram->data, dgram->size};
+    msgs[i].msg_hdr = (struct msghdr){
+      .msg_name = &client->addr, .msg_namelen = client->addr_size,
+      .msg_iov = &iovs[i], .msg_iovlen = 1
+    };
+  }
+
+  int sent = sendmmsg(client->fd, msgs, count, 0);
+
+  // Stations may be absent, datagrams are dropped then.
+  if (sent < 0) {
+    if (errno != EAGAIN && !client->failing)
+      log_warning("Cannot send telemetry to %s: %s.",
+                  client->spec, strerror(errno));
+
+    client->failing = errno != EAGAIN;
+    sent = count;
+  } else {
+    client->failing = false;
+  }
+
+  client->first = (client->first + sent) % QUEUE;
+  client->ready -= sent;
+
+  if (client->dropped) {
+    log_warning("Telemetry to %s is late, dropped %u datagrams.",
+                client->spec, client->dropped);
+    client->dropped = 0;
+  }
+}
+
+
+static void send_all(uv_check_t* handle) {
+  for (int i = 0; i < client_count; ++i)
+    if (clients[i].ready > 0)
+      send_ready(&clients[i]);
+}
+
+
+static void flush(uv_timer_t* timer) {
+  for (int i = 0; i < client_count; ++i) {
+    seal(&clients[i]);
+    if (clients[i].ready > 0)
+      send_ready(&clients[i]);
+  }
+}
+
+
+/*
+ * Clients.
+ */
+
+// "udp:<host>:<port>" or "unix:<path>", optionally followed by "@<every>".
+static bool resolve(client_t* client, char* spec) {
+  char* every = strrchr(spec, '@');
+  int decimation = 1;
+
+  if (every) {
+    *every++ = '\0';
+    if ((decimation = atoi(every)) < 1)
+      return log_error("Bad decimation of telemetry client %s.", spec);
+  }
+
+  client->every = decimation;
+
+  if (strncmp(spec, "unix:", 5) == 0) {
+    struct sockaddr_un* addr = (struct sockaddr_un*)&client->addr;
+    const char* path = spec + 5;
+
+    if (strlen(path) >= sizeof(addr->sun_path))
+      return log_error("The socket path %s is too long.", path);
+
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    client->addr_size = sizeof(*addr);
+  } else if (strncmp(spec, "udp:", 4) == 0) {
+    char* host = spec + 4;
+    char* port = strrchr(host, ':');
+    if (!port) return log_error("No port in telemetry client %s.", spec);
+    *port++ = '\0';
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC,
+                             .ai_socktype = SOCK_DGRAM};
+    struct addrinfo* res;
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err)
+      return log_error("Cannot resolve %s: %s.", host, gai_strerror(err));
+
+    memcpy(&client->addr, res->ai_addr, res->ai_addrlen);
+    client->addr_size = res->ai_addrlen;
+    freeaddrinfo(res);
+  } else {
+    return log_error("Unknown telemetry client %s.", spec);
+  }
+
+  client->fd = socket(client->addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  if (client->fd < 0)
+    return log_error("Cannot create the socket: %s.", strerror(errno));
+
+  return true;
+}
+
+
+static void close_clients(void) {
+  for (int i = 0; i < client_count; ++i) {
+    if (clients[i].fd >= 0) close(clients[i].fd);
+    free(clients[i].spec);
+  }
+
+  client_count = 0;
+}
+
+
+static bool read_streams(void) {
+  char list[64];
+  char* names[STREAMS];
+  int count = cfg_words("telemetry:events", list, sizeof(list), names,
+                        STREAMS);
+
+  if (count > STREAMS)
+    return log_error("Too many telemetry events, the maximum is %d.",
+                     STREAMS);
+
+  for (int k = 0; k < count; ++k) {
+    const char* name = names[k];
+    int i = 0;
+    while (i < STREAMS && strcmp(streams[i].name, name) != 0) ++i;
+
+    if (i == STREAMS)
+      return log_error("Unknown telemetry event %s.", name);
+
+    streams[i].enabled = true;
+  }
+
+  return true;
+}
+
+
+static bool probe(void) {
+  char list[256];
+  char* specs[MAX_CLIENTS];
+  int count = cfg_words("telemetry:clients", list, sizeof(list), specs,
+                        MAX_CLIENTS);
+
+  if (count > MAX_CLIENTS)
+    return log_error("Too many telemetry clients, the maximum is %d.",
+                     MAX_CLIENTS);
+
+  batch = cfg_int("telemetry:batch");
+  if (batch < 1 || batch > 255)
+    return log_error("Telemetry batch must be 1..255, not %d.", batch);
+
+  if (!read_streams()) return false;
+
+  for (int k = 0; k < count; ++k) {
+    char* spec = specs[k];
+    client_t* client = &clients[client_count++];
+    memset(client, 0, sizeof(*client));
+    client->spec = strdup(spec);
+    client->fd = -1;
+
+    if (!resolve(client, spec)) {
+      close_clients();
+      return false;
+    }
+
+    start_datagram(client, filled(client));
+  }
+
+  return true;
+}
+
+
+static void term(void) {
+  for (int i = 0; i < STREAMS; ++i)
+    unsubscribe(streams[i].ev, on_sample, &streams[i]);
+
+  uv_check_stop(&check_send);
+  uv_timer_stop(&timer_flush);
+  uv_close((uv_handle_t*)&check_send, NULL);
+  uv_close((uv_handle_t*)&timer_flush, NULL);
+
+  close_clients();
+}
+
+
+static bool init(void) {
+  uv_check_init(uv_default_loop(), &check_send);
+  uv_timer_init(uv_default_loop(), &timer_flush);
+  if (client_count == 0) return true;
+
+  for (int i = 0; i < STREAMS; ++i)
+    if (streams[i].enabled && !subscribe(streams[i].ev, on_sample,
+                                         &streams[i])) {
+      term();
+      return false;
+    }
+
+  uint64_t period = cfg_int("telemetry:flush");
+  uv_check_start(&check_send, send_all);
+  uv_timer_start(&timer_flush, flush, period, period);
+  return true;
+}
+
+
+NODE_REGISTER(telemetry, .probe = probe, .init = init, .term = term,
+              .consumes = NODE_EVENTS(&ev_ahrs, &ev_baro, &ev_ahrs_raw));
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "base/node.h"
+
+
+/*!
+ * Streams events to ground stations by UDP or UNIX datagrams. Samples are
+ * appended to datagrams of clients and full datagrams are sent by one
+ * `sendmmsg()` per client after the loop iteration, partial ones are flushed
+ * by the timer. Every client takes every n-th sample (`telemetry:clients`).
+ *
+ * The layout is fixed, fields are in the byte order of the robot (LE):
+ *   datagram  "T6TM", u8 version, u8 samples, u16 reserved,
+ *             u32 number of the datagram (per client), samples...
+ *   sample    u8 type, u8 reserved, u16 size of the payload,
+ *             u32 number of the sample (per event), u64 stamp [ns], payload
+ *
+ * Payloads:
+ *   TELEMETRY_AHRS      f32 attitude[4]
+ *   TELEMETRY_BARO      f32 altitude [m], i32 pressure [Pa], f32 temp [°C]
+ *   TELEMETRY_AHRS_RAW  u64 stamp[3], i16 raw[3][3], f32 gain[3]
+ */
+extern node_t telemetry;
+
+
+enum {
+  TELEMETRY_AHRS = 1,
+  TELEMETRY_BARO = 2,
+  TELEMETRY_AHRS_RAW = 3
+};
+
+#define TELEMETRY_VERSION 1